@@ -0,0 +1,598 @@
+#include "batch_sim.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+// The kernels below repeat the arithmetic of updatePlayerState() and
+// updateGameState() expression for expression, including where a float gets
+// promoted to double by delta_time, so that they round the same way. If you
+// change the scalar code, change them too and run svb_bench to check.
+
+constexpr uint32_t BUTTON_UP = 1 << 0;
+constexpr uint32_t BUTTON_DOWN = 1 << 1;
+constexpr uint32_t BUTTON_LEFT = 1 << 2;
+constexpr uint32_t BUTTON_RIGHT = 1 << 3;
+constexpr uint32_t BUTTON_TARGET_UP = 1 << 4;
+constexpr uint32_t BUTTON_TARGET_DOWN = 1 << 5;
+constexpr uint32_t BUTTON_TARGET_LEFT = 1 << 6;
+constexpr uint32_t BUTTON_TARGET_RIGHT = 1 << 7;
+constexpr uint32_t BUTTON_JUMP = 1 << 8;
+constexpr uint32_t BUTTON_HIT = 1 << 9;
+
+// the flags only have to be conservative, so give them room to spare rather
+// than trying to round exactly like the scalar checks
+constexpr float FLAG_MARGIN = 1.0;
+
+constexpr float JUMP_FALL_SPEED = -jump_speed / 1.5;
+
+// the scalar code checks a float magnitude against the double 0.01. no float
+// lies between 0.01f and 0.01, so comparing against 0.01f gives the same
+// answer while keeping the whole kernel in float
+constexpr float NORMALIZE_MIN_MAGNITUDE = 0.01f;
+static_assert(NORMALIZE_MIN_MAGNITUDE < 0.01);
+
+void BodyColumns::resize(size_t size) {
+  pos_x.resize(size);
+  pos_y.resize(size);
+  pos_z.resize(size);
+  vel_x.resize(size);
+  vel_y.resize(size);
+  vel_z.resize(size);
+  jump_cooldown.resize(size);
+}
+
+void BodyColumns::set(size_t match, const PhysicsState &body) {
+  pos_x[match] = body.pos.x;
+  pos_y[match] = body.pos.y;
+  pos_z[match] = body.pos.z;
+  vel_x[match] = body.vel.x;
+  vel_y[match] = body.vel.y;
+  vel_z[match] = body.vel.z;
+  jump_cooldown[match] = body.jump_cooldown;
+}
+
+void BodyColumns::get(size_t match, PhysicsState &body) const {
+  body.pos.x = pos_x[match];
+  body.pos.y = pos_y[match];
+  body.pos.z = pos_z[match];
+  body.vel.x = vel_x[match];
+  body.vel.y = vel_y[match];
+  body.vel.z = vel_z[match];
+  body.jump_cooldown = jump_cooldown[match];
+}
+
+void BatchSimulation::Columns::resize(size_t size) {
+  for (BodyColumns &player : players) {
+    player.resize(size);
+  }
+  ball.resize(size);
+  target.resize(size);
+  landing_zone.resize(size);
+  team1_score.resize(size);
+  team2_score.resize(size);
+  team1_points_to_give.resize(size);
+  team2_points_to_give.resize(size);
+  tick.resize(size);
+  ball_state.resize(size);
+  last_server.resize(size);
+  ball_owner.resize(size);
+  can_owner_move.resize(size);
+  is_blocking_allowed.resize(size);
+  timer.resize(size);
+  rng_seed.resize(size);
+}
+
+void BatchSimulation::Columns::set(size_t match, const GameState &state) {
+  players[0].set(match, state.p1);
+  players[1].set(match, state.p2);
+  players[2].set(match, state.p3);
+  players[3].set(match, state.p4);
+  ball.set(match, state.ball);
+  target.set(match, state.target);
+  landing_zone.set(match, state.landing_zone);
+  team1_score[match] = state.team1_score;
+  team2_score[match] = state.team2_score;
+  team1_points_to_give[match] = state.team1_points_to_give;
+  team2_points_to_give[match] = state.team2_points_to_give;
+  tick[match] = state.tick;
+  ball_state[match] = state.ball_state;
+  last_server[match] = state.last_server;
+  ball_owner[match] = state.ball_owner;
+  can_owner_move[match] = state.can_owner_move;
+  is_blocking_allowed[match] = state.is_blocking_allowed;
+  timer[match] = state.timer;
+  rng_seed[match] = state.rng_seed;
+}
+
+void BatchSimulation::Columns::get(size_t match, GameState &state) const {
+  players[0].get(match, state.p1);
+  players[1].get(match, state.p2);
+  players[2].get(match, state.p3);
+  players[3].get(match, state.p4);
+  ball.get(match, state.ball);
+  target.get(match, state.target);
+  landing_zone.get(match, state.landing_zone);
+  state.team1_score = team1_score[match];
+  state.team2_score = team2_score[match];
+  state.team1_points_to_give = team1_points_to_give[match];
+  state.team2_points_to_give = team2_points_to_give[match];
+  state.tick = tick[match];
+  state.ball_state = ball_state[match];
+  state.last_server = last_server[match];
+  state.ball_owner = ball_owner[match];
+  state.can_owner_move = can_owner_move[match];
+  state.is_blocking_allowed = is_blocking_allowed[match];
+  state.timer = timer[match];
+  state.rng_seed = rng_seed[match];
+}
+
+BatchSimulation::BatchSimulation(size_t num_matches)
+    : num_matches_(num_matches) {
+  columns_.resize(num_matches);
+  for (std::vector<uint32_t> &buttons : buttons_) {
+    buttons.resize(num_matches);
+  }
+  owner_.resize(num_matches);
+  frozen_owner_.resize(num_matches);
+  needs_scalar_.resize(num_matches);
+
+  GameState state;
+  resetGameState(state);
+  for (size_t i = 0; i < num_matches; i++) {
+    columns_.set(i, state);
+  }
+}
+
+void BatchSimulation::set(size_t match, const GameState &state) {
+  columns_.set(match, state);
+}
+
+GameState BatchSimulation::get(size_t match) const {
+  GameState state;
+  columns_.get(match, state);
+  return state;
+}
+
+void BatchSimulation::step(const InputMessage *inputs, uint32_t tick,
+                           double delta_time) {
+#ifdef SVB_FIXED_POINT
+  // the kernels are float only, with fixed point everything is scalar
+  std::fill(needs_scalar_.begin(), needs_scalar_.end(), 1);
+  saveFallbacks();
+#else
+  loadButtons(inputs);
+  flagFallbacks(delta_time);
+  saveFallbacks();
+
+  movePlayers(delta_time);
+  moveTarget(delta_time);
+  updateBall(delta_time);
+  std::fill(columns_.tick.begin(), columns_.tick.end(), tick);
+#endif
+  runScalarFallbacks(inputs, tick, delta_time);
+}
+
+// the matches the kernels can't step, taken before they step them anyway
+void BatchSimulation::saveFallbacks() {
+  fallback_matches_.clear();
+  for (size_t i = 0; i < num_matches_; i++) {
+    if (needs_scalar_[i]) {
+      fallback_matches_.push_back(i);
+    }
+  }
+  fallback_states_.resize(fallback_matches_.size());
+  for (size_t k = 0; k < fallback_matches_.size(); k++) {
+    columns_.get(fallback_matches_[k], fallback_states_[k]);
+  }
+}
+
+#ifndef SVB_FIXED_POINT
+// all ones where cond holds, for blending floats without a branch. GCC won't
+// if-convert the paddle kernel with plain selects on the owner check
+static uint32_t maskOf(bool cond) { return 0u - static_cast<uint32_t>(cond); }
+
+static float blend(uint32_t mask, float a, float b) {
+  uint32_t a_bits;
+  uint32_t b_bits;
+  memcpy(&a_bits, &a, sizeof(float));
+  memcpy(&b_bits, &b, sizeof(float));
+  uint32_t bits = (a_bits & mask) | (b_bits & ~mask);
+  float result;
+  memcpy(&result, &bits, sizeof(float));
+  return result;
+}
+
+// the input of the player who owns the ball, 0 if nobody does
+static uint32_t ownersInput(int owner, uint32_t p1, uint32_t p2, uint32_t p3,
+                            uint32_t p4) {
+  return (p1 & maskOf(owner == 0)) | (p2 & maskOf(owner == 1)) |
+         (p3 & maskOf(owner == 2)) | (p4 & maskOf(owner == 3));
+}
+
+// and the same for a position
+static float ownersValue(int owner, float p1, float p2, float p3, float p4) {
+  float value = blend(maskOf(owner == 0), p1, 0.0f);
+  value = blend(maskOf(owner == 1), p2, value);
+  value = blend(maskOf(owner == 2), p3, value);
+  return blend(maskOf(owner == 3), p4, value);
+}
+
+void BatchSimulation::loadButtons(const InputMessage *inputs) {
+  for (size_t i = 0; i < num_matches_; i++) {
+    for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      const InputMessage &input = inputs[i * PLAYERS_PER_ROOM + player];
+      buttons_[player][i] =
+          input.up * BUTTON_UP | input.down * BUTTON_DOWN |
+          input.left * BUTTON_LEFT | input.right * BUTTON_RIGHT |
+          input.target_up * BUTTON_TARGET_UP |
+          input.target_down * BUTTON_TARGET_DOWN |
+          input.target_left * BUTTON_TARGET_LEFT |
+          input.target_right * BUTTON_TARGET_RIGHT | input.jump * BUTTON_JUMP |
+          input.hit * BUTTON_HIT;
+    }
+  }
+
+  // the kernels vectorize as many matches at once as fit the narrowest
+  // column they touch, so they get the owner as wide as a float
+  const int16_t *ball_owner = columns_.ball_owner.data();
+  const uint8_t *can_owner_move = columns_.can_owner_move.data();
+  for (size_t i = 0; i < num_matches_; i++) {
+    owner_[i] = ball_owner[i] - 1;
+    frozen_owner_[i] = can_owner_move[i] ? -1 : owner_[i];
+  }
+}
+
+// a looser playerBallInCollision(), which also covers blocking. the paddle
+// is where it was before this tick, reach covers how far it can move in one
+static bool ballInReach(float ball_x, float ball_y, float ball_z,
+                        float paddle_x, float paddle_y, float paddle_step) {
+  float dx = ball_x - paddle_x;
+  float dy = ball_y - paddle_y;
+  float reach = ball_radius + (ball_z * Z_TO_SIZE_RATIO) + paddle_width +
+                FLAG_MARGIN + paddle_step;
+  return (dx * dx) + (dy * dy) < reach * reach;
+}
+
+// the columns flagMatches() reads, one pointer each
+struct FlagColumns {
+  std::array<const uint32_t *, PLAYERS_PER_ROOM> buttons;
+  std::array<const float *, PLAYERS_PER_ROOM> paddle_x;
+  std::array<const float *, PLAYERS_PER_ROOM> paddle_y;
+  std::array<const float *, PLAYERS_PER_ROOM> paddle_z;
+  const uint32_t *ball_state;
+  const int32_t *owner;
+  const uint8_t *blocking;
+  const float *timer;
+  const float *ball_x;
+  const float *ball_y;
+  const float *ball_z;
+  const float *ball_vel_z;
+  const float *target_x;
+  const float *target_y;
+};
+
+// anything that could happen this tick that the kernels don't model, read
+// off the state before the tick: a player serving, hitting or blocking the
+// ball, the ball reaching its target or the floor, and the end of a round.
+// only needs_scalar is written, so it alone has to be __restrict for the
+// loop to vectorize
+[[gnu::noinline]] static void
+flagMatches(size_t num_matches, const FlagColumns &c,
+            uint8_t *__restrict needs_scalar, double delta_time) {
+  float paddle_step = paddle_speed * delta_time;
+  for (size_t i = 0; i < num_matches; i++) {
+    uint32_t state = c.ball_state[i];
+    int owner = c.owner[i];
+    uint32_t owner_input =
+        ownersInput(owner, c.buttons[0][i], c.buttons[1][i], c.buttons[2][i],
+                    c.buttons[3][i]);
+    float ball_x = c.ball_x[i];
+    float ball_y = c.ball_y[i];
+    float ball_z = c.ball_z[i];
+    float ball_vel_z = c.ball_vel_z[i];
+    bool passing = (state == BALL_STATE_FIRST_PASS) |
+                   (state == BALL_STATE_SECOND_PASS);
+
+    bool serves = (state == BALL_STATE_READY_TO_SERVE) &
+                  ((owner_input & BUTTON_JUMP) != 0);
+    bool hits_serve = (state == BALL_STATE_IN_SERVICE) &
+                      ((owner_input & BUTTON_HIT) != 0) &
+                      (c.timer[i] > service_hittable_time);
+    float owner_x = ownersValue(owner, c.paddle_x[0][i], c.paddle_x[1][i],
+                                c.paddle_x[2][i], c.paddle_x[3][i]);
+    float owner_y = ownersValue(owner, c.paddle_y[0][i], c.paddle_y[1][i],
+                                c.paddle_y[2][i], c.paddle_y[3][i]);
+    float owner_z = ownersValue(owner, c.paddle_z[0][i], c.paddle_z[1][i],
+                                c.paddle_z[2][i], c.paddle_z[3][i]);
+    // the owner's height only changes after they've had their go at the ball
+    bool reaches_up =
+        std::abs(ball_z - owner_z) < hitting_max_z_dist + FLAG_MARGIN;
+    bool spikes = (state == BALL_STATE_SECOND_PASS) &
+                  (owner_z > spiking_min_player_z - FLAG_MARGIN);
+    bool passes = passing & ((owner_input & BUTTON_HIT) != 0) &
+                  ballInReach(ball_x, ball_y, ball_z, owner_x, owner_y,
+                              paddle_step) &
+                  (reaches_up | spikes);
+
+    bool touched = false;
+    for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      bool in_reach = ballInReach(ball_x, ball_y, ball_z, c.paddle_x[player][i],
+                                  c.paddle_y[player][i], paddle_step);
+      bool hits = (c.buttons[player][i] & BUTTON_HIT) != 0;
+      // blocking looks at the paddle's height before it moves vertically
+      bool can_block = (c.blocking[i] != 0) &
+                       (c.paddle_z[player][i] >=
+                        blocking_min_height - FLAG_MARGIN);
+      touched |= in_reach & (hits | can_block);
+    }
+    float dx = c.target_x[i] - ball_x;
+    float dy = c.target_y[i] - ball_y;
+    float target_reach = target_radius + FLAG_MARGIN;
+    bool scores = (dx * dx) + (dy * dy) < target_reach * target_reach;
+    bool travels = (state == BALL_STATE_TRAVELLING) & (touched | scores);
+
+    // the ball turning around at the top of a pass is the kernels' job
+    bool turns = (ball_vel_z > 0) & (ball_z >= ball_max_passing_height);
+    bool drops = passing & !turns & (ball_z <= 0);
+    float next_timer = c.timer[i] + delta_time;
+    bool round_ends = (state == BALL_STATE_GAME_OVER) &
+                      (next_timer > game_over_grace_period);
+
+    needs_scalar[i] = (owner >= static_cast<int>(PLAYERS_PER_ROOM)) |
+                      serves | hits_serve | passes | travels |
+                      (state == BALL_STATE_FAILED_SERVICE) | drops |
+                      round_ends;
+  }
+}
+
+void BatchSimulation::flagFallbacks(double delta_time) {
+  FlagColumns c;
+  for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    c.buttons[player] = buttons_[player].data();
+    c.paddle_x[player] = columns_.players[player].pos_x.data();
+    c.paddle_y[player] = columns_.players[player].pos_y.data();
+    c.paddle_z[player] = columns_.players[player].pos_z.data();
+  }
+  c.ball_state = columns_.ball_state.data();
+  c.owner = owner_.data();
+  c.blocking = columns_.is_blocking_allowed.data();
+  c.timer = columns_.timer.data();
+  c.ball_x = columns_.ball.pos_x.data();
+  c.ball_y = columns_.ball.pos_y.data();
+  c.ball_z = columns_.ball.pos_z.data();
+  c.ball_vel_z = columns_.ball.vel_z.data();
+  c.target_x = columns_.target.pos_x.data();
+  c.target_y = columns_.target.pos_y.data();
+  flagMatches(num_matches_, c, needs_scalar_.data(), delta_time);
+}
+
+// the movement half of updatePlayerState() for one paddle in every match.
+// written as selects over values loaded up front rather than branches, and
+// taking the columns as __restrict parameters, so that the loop vectorizes.
+// inlining it into the loop over players would lose the __restrict
+[[gnu::noinline]] static void
+movePaddles(size_t num_matches, int player,
+            const uint32_t *__restrict buttons,
+            const int32_t *__restrict frozen_owner, float *__restrict pos_x,
+            float *__restrict pos_y, float *__restrict pos_z,
+            float *__restrict vel_x, float *__restrict vel_y,
+            float *__restrict vel_z, float *__restrict cooldown,
+            double delta_time) {
+  for (size_t i = 0; i < num_matches; i++) {
+    // uint32_t keeps every condition in the loop the width of a float
+    uint32_t input = buttons[i];
+    uint32_t moves = maskOf(frozen_owner[i] != player);
+    float x = pos_x[i];
+    float y = pos_y[i];
+    float z = pos_z[i];
+    float old_vx = vel_x[i];
+    float old_vy = vel_y[i];
+    float old_vz = vel_z[i];
+    float old_cooldown = cooldown[i];
+
+    float vx = (input & BUTTON_RIGHT)  ? paddle_speed
+               : (input & BUTTON_LEFT) ? -paddle_speed
+                                       : 0.0f;
+    float vy = (input & BUTTON_DOWN) ? paddle_speed
+               : (input & BUTTON_UP) ? -paddle_speed
+                                     : 0.0f;
+
+    float decayed = old_cooldown - delta_time;
+    float cooldown_left = std::max(decayed, 0.0f);
+    float vz = z >= jump_height ? JUMP_FALL_SPEED : old_vz;
+    // same as cooldown_left == 0.0
+    bool jumps =
+        ((input & BUTTON_JUMP) != 0) & (z == 0.0f) & (decayed <= 0.0f);
+    cooldown_left = jumps ? jump_cooldown : cooldown_left;
+    vz = jumps ? jump_speed : vz;
+
+    float magnitude = std::sqrt((vx * vx) + (vy * vy));
+    float normalized_x = (vx / magnitude) * paddle_speed;
+    float normalized_y = (vy / magnitude) * paddle_speed;
+    bool normalize = magnitude > NORMALIZE_MIN_MAGNITUDE;
+    vx = normalize ? normalized_x : vx;
+    vy = normalize ? normalized_y : vy;
+
+    float moved_x = x + vx * delta_time;
+    float moved_y = y + vy * delta_time;
+    moved_x = z == 0.0f ? moved_x : x;
+    moved_y = z == 0.0f ? moved_y : y;
+    moved_y = std::clamp(moved_y, 0.0f, arena_height - paddle_height);
+
+    vx = blend(moves, vx, old_vx);
+    vy = blend(moves, vy, old_vy);
+    vz = blend(moves, vz, old_vz);
+    float moved_z = z + vz * delta_time;
+    vel_x[i] = vx;
+    vel_y[i] = vy;
+    vel_z[i] = vz;
+    cooldown[i] = blend(moves, cooldown_left, old_cooldown);
+    pos_x[i] = blend(moves, moved_x, x);
+    pos_y[i] = blend(moves, moved_y, y);
+    pos_z[i] = std::max(0.0f, moved_z);
+  }
+}
+
+// the end of updateGameState()
+[[gnu::noinline]] static void
+moveBall(size_t num_matches, float *__restrict pos_x, float *__restrict pos_y,
+         float *__restrict pos_z, const float *__restrict vel_x,
+         const float *__restrict vel_y, const float *__restrict vel_z,
+         double delta_time) {
+  for (size_t i = 0; i < num_matches; i++) {
+    pos_x[i] += vel_x[i] * delta_time;
+    pos_y[i] += vel_y[i] * delta_time;
+    pos_z[i] += vel_z[i] * delta_time;
+    pos_z[i] = std::max(pos_z[i], 0.0f);
+  }
+}
+
+void BatchSimulation::movePlayers(double delta_time) {
+  for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    BodyColumns &paddle = columns_.players[player];
+    movePaddles(num_matches_, static_cast<int>(player),
+                buttons_[player].data(), frozen_owner_.data(),
+                paddle.pos_x.data(), paddle.pos_y.data(), paddle.pos_z.data(),
+                paddle.vel_x.data(), paddle.vel_y.data(), paddle.vel_z.data(),
+                paddle.jump_cooldown.data(), delta_time);
+  }
+}
+
+// the owner aiming while serving or setting up a spike. every match computes
+// a move and the ones nobody is aiming in keep what they had
+[[gnu::noinline]] static void
+aimTargets(size_t num_matches, const uint32_t *__restrict buttons1,
+           const uint32_t *__restrict buttons2,
+           const uint32_t *__restrict buttons3,
+           const uint32_t *__restrict buttons4,
+           const int32_t *__restrict owners,
+           const uint32_t *__restrict ball_state, float *__restrict pos_x,
+           float *__restrict pos_y, float *__restrict pos_z,
+           float *__restrict vel_x, float *__restrict vel_y,
+           double delta_time) {
+  for (size_t i = 0; i < num_matches; i++) {
+    int owner = owners[i];
+    uint32_t state = ball_state[i];
+    uint32_t aims =
+        maskOf((owner >= 0) & (owner < static_cast<int>(PLAYERS_PER_ROOM)) &
+               ((state == BALL_STATE_IN_SERVICE) |
+                (state == BALL_STATE_SECOND_PASS)));
+    uint32_t input = ownersInput(owner, buttons1[i], buttons2[i], buttons3[i],
+                                 buttons4[i]);
+    float x = pos_x[i];
+    float y = pos_y[i];
+    float z = pos_z[i];
+
+    float vx = (input & BUTTON_TARGET_RIGHT)  ? target_speed
+               : (input & BUTTON_TARGET_LEFT) ? -target_speed
+                                              : 0.0f;
+    float vy = (input & BUTTON_TARGET_DOWN) ? target_speed
+               : (input & BUTTON_TARGET_UP) ? -target_speed
+                                            : 0.0f;
+    float magnitude = std::sqrt((vx * vx) + (vy * vy));
+    float normalized_x = (vx / magnitude) * target_speed;
+    float normalized_y = (vy / magnitude) * target_speed;
+    bool normalize = magnitude > NORMALIZE_MIN_MAGNITUDE;
+    vx = normalize ? normalized_x : vx;
+    vy = normalize ? normalized_y : vy;
+
+    float moved_x = x + vx * delta_time;
+    float moved_y = y + vy * delta_time;
+    // the first team aims at the second team's court and the other way
+    bool first_team = owner < 2;
+    float min_x = first_team ? (arena_width / 2.0f) + center_line_width : 0.0f;
+    float max_x = first_team ? arena_width - paddle_width
+                             : arena_width / 2.0f - paddle_width;
+    moved_x = std::clamp(moved_x, min_x, max_x);
+    moved_y = std::clamp(moved_y, 0.0f, arena_height - target_radius);
+
+    vel_x[i] = blend(aims, vx, vel_x[i]);
+    vel_y[i] = blend(aims, vy, vel_y[i]);
+    pos_x[i] = blend(aims, moved_x, x);
+    pos_y[i] = blend(aims, moved_y, y);
+    pos_z[i] = blend(aims, std::max(0.0f, z), z);
+  }
+}
+
+void BatchSimulation::moveTarget(double delta_time) {
+  BodyColumns &target = columns_.target;
+  aimTargets(num_matches_, buttons_[0].data(), buttons_[1].data(),
+             buttons_[2].data(), buttons_[3].data(), owner_.data(),
+             columns_.ball_state.data(), target.pos_x.data(),
+             target.pos_y.data(), target.pos_z.data(), target.vel_x.data(),
+             target.vel_y.data(), delta_time);
+}
+
+// the timers and the ball turning around at the top of a shot or a pass.
+// which part of updatePlayerState() or updateGameState() does each doesn't
+// matter, the ball only moves after all of them
+[[gnu::noinline]] static void
+runBallStates(size_t num_matches, uint32_t *__restrict ball_state,
+              float *__restrict timer, const float *__restrict pos_z,
+              float *__restrict vel_z, double delta_time) {
+  for (size_t i = 0; i < num_matches; i++) {
+    uint32_t state = ball_state[i];
+    float z = pos_z[i];
+    float vz = vel_z[i];
+    float old_timer = timer[i];
+    float next_timer = old_timer + delta_time;
+
+    bool in_service = state == BALL_STATE_IN_SERVICE;
+    bool counts = in_service | (state == BALL_STATE_GAME_OVER);
+    timer[i] = blend(maskOf(counts), next_timer, old_timer);
+    ball_state[i] = in_service & (next_timer > service_max_time)
+                        ? BALL_STATE_FAILED_SERVICE
+                        : state;
+
+    bool turns = (vz > 0) & (z >= ball_max_passing_height);
+    bool passing = (state == BALL_STATE_FIRST_PASS) |
+                   (state == BALL_STATE_SECOND_PASS);
+    // every non owner turns a shot around, the first one to get there wins
+    float shot_turned = vz * -1;
+    float pass_turned = vz * -0.95;
+    vz = blend(maskOf(turns & (state == BALL_STATE_TRAVELLING)), shot_turned,
+               vz);
+    vel_z[i] = blend(maskOf(turns & passing), pass_turned, vz);
+  }
+}
+
+// updateGameState()
+void BatchSimulation::updateBall(double delta_time) {
+  for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    float *pos_x = columns_.players[player].pos_x.data();
+    float min_x = 0.0f;
+    float max_x = arena_width / 2.0f - paddle_width;
+    if (player >= 2) {
+      min_x = (arena_width / 2.0f) + center_line_width;
+      max_x = arena_width - paddle_width;
+    }
+    for (size_t i = 0; i < num_matches_; i++) {
+      pos_x[i] = std::clamp(pos_x[i], min_x, max_x);
+    }
+  }
+
+  BodyColumns &ball = columns_.ball;
+  runBallStates(num_matches_, columns_.ball_state.data(),
+                columns_.timer.data(), ball.pos_z.data(), ball.vel_z.data(),
+                delta_time);
+  moveBall(num_matches_, ball.pos_x.data(), ball.pos_y.data(),
+           ball.pos_z.data(), ball.vel_x.data(), ball.vel_y.data(),
+           ball.vel_z.data(), delta_time);
+}
+#endif
+
+void BatchSimulation::runScalarFallbacks(const InputMessage *inputs,
+                                         uint32_t tick, double delta_time) {
+  for (size_t k = 0; k < fallback_matches_.size(); k++) {
+    size_t i = fallback_matches_[k];
+    GameState &state = fallback_states_[k];
+    for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      updatePlayerState(state, inputs[i * PLAYERS_PER_ROOM + player],
+                        delta_time, player);
+    }
+    updateGameState(state, delta_time);
+    state.tick = tick;
+    columns_.set(i, state);
+  }
+  scalar_fallbacks_ += fallback_matches_.size();
+}
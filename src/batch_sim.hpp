@@ -0,0 +1,94 @@
+#pragma once
+#include "game_state.hpp"
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+// one PhysicsState per match, a column per component
+struct BodyColumns {
+  std::vector<Scalar> pos_x;
+  std::vector<Scalar> pos_y;
+  std::vector<Scalar> pos_z;
+  std::vector<Scalar> vel_x;
+  std::vector<Scalar> vel_y;
+  std::vector<Scalar> vel_z;
+  std::vector<Scalar> jump_cooldown;
+
+  void resize(size_t size);
+  void set(size_t match, const PhysicsState &body);
+  void get(size_t match, PhysicsState &body) const;
+};
+
+// Steps many matches at once. Every GameState field is stored as its own
+// contiguous column so the common case of a tick (paddles moving, the ball
+// flying, timers running) is a handful of branch free loops over the columns
+// that the compiler can vectorize.
+//
+// Before the kernels run, the matches where something they don't model could
+// happen this tick, like a hit, a block or a point being scored, are flagged
+// and only those are saved. The kernels then step every match regardless and
+// the flagged ones are stepped again from the saved state with the scalar
+// updatePlayerState()/updateGameState(), so the results are bit for bit the
+// same as the scalar path. The kernels are float only, in an SVB_FIXED_POINT
+// build every match is stepped scalar.
+class BatchSimulation {
+public:
+  explicit BatchSimulation(size_t num_matches);
+
+  size_t size() const { return num_matches_; }
+  void set(size_t match, const GameState &state);
+  GameState get(size_t match) const;
+
+  // inputs[match * PLAYERS_PER_ROOM + player], one for every player. ticks
+  // like the server does when nobody's input is missing
+  void step(const InputMessage *inputs, uint32_t tick, double delta_time);
+
+  // matches that took the scalar path, since construction
+  uint64_t scalarFallbacks() const { return scalar_fallbacks_; }
+
+private:
+  struct Columns {
+    std::array<BodyColumns, PLAYERS_PER_ROOM> players;
+    BodyColumns ball;
+    BodyColumns target;
+    BodyColumns landing_zone;
+    std::vector<uint16_t> team1_score;
+    std::vector<uint16_t> team2_score;
+    std::vector<uint16_t> team1_points_to_give;
+    std::vector<uint16_t> team2_points_to_give;
+    std::vector<uint32_t> tick;
+    std::vector<uint32_t> ball_state;
+    std::vector<uint8_t> last_server;
+    std::vector<int16_t> ball_owner;
+    std::vector<uint8_t> can_owner_move;
+    std::vector<uint8_t> is_blocking_allowed;
+    std::vector<Scalar> timer;
+    std::vector<uint32_t> rng_seed;
+
+    void resize(size_t size);
+    void set(size_t match, const GameState &state);
+    void get(size_t match, GameState &state) const;
+  };
+
+  void loadButtons(const InputMessage *inputs);
+  void movePlayers(double delta_time);
+  void moveTarget(double delta_time);
+  void flagFallbacks(double delta_time);
+  void saveFallbacks();
+  void updateBall(double delta_time);
+  void runScalarFallbacks(const InputMessage *inputs, uint32_t tick,
+                          double delta_time);
+
+  size_t num_matches_;
+  Columns columns_;
+  // each player's input packed into the bits of a uint32_t
+  std::array<std::vector<uint32_t>, PLAYERS_PER_ROOM> buttons_;
+  // ball_owner - 1, and the same but -1 when the owner is free to move
+  std::vector<int32_t> owner_;
+  std::vector<int32_t> frozen_owner_;
+  std::vector<uint8_t> needs_scalar_;
+  // the flagged matches and their state from before the kernels ran
+  std::vector<size_t> fallback_matches_;
+  std::vector<GameState> fallback_states_;
+  uint64_t scalar_fallbacks_ = 0;
+};
@@ -0,0 +1,855 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "batch_sim.hpp"
+#include "game_state.hpp"
+#include "match_rng.hpp"
+#include "metrics.hpp"
+#include "scripted_players.hpp"
+#include "snapshot_delta.hpp"
+#include "wire_format.hpp"
+
+// Headless benchmark of the simulation hot path. Only links the simulation so
+// it measures exactly what the server and the client's rollback run per tick,
+// plus the metrics the server keeps next to it and a check that states and
+// inputs come through the wire format intact.
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+constexpr uint64_t DEFAULT_TICKS = 2'000'000;
+constexpr double DEFAULT_TOLERANCE = 0.10;
+constexpr size_t DEFAULT_BATCH_MATCHES = 256;
+constexpr int BENCH_JSON_VERSION = 3;
+
+constexpr std::array<const char *, BALL_STATE_GAME_OVER + 1> BALL_STATE_NAMES =
+    {"READY_TO_SERVE", "IN_SERVICE",  "TRAVELLING", "FAILED_SERVICE",
+     "FIRST_PASS",     "SECOND_PASS", "GAME_OVER"};
+constexpr size_t NUM_BALL_STATES = BALL_STATE_NAMES.size();
+
+// count every heap allocation so we can report allocations per tick. every
+// form of new and delete is replaced so they all end up in malloc and free
+static std::atomic<uint64_t> allocations{0};
+
+static void *countedAlloc(size_t size, size_t alignment) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  size = std::max<size_t>(size, 1);
+  void *ptr = nullptr;
+  if (alignment <= alignof(std::max_align_t)) {
+    ptr = malloc(size);
+  } else {
+    // aligned_alloc wants a whole number of alignments
+    size = (size + alignment - 1) / alignment * alignment;
+    ptr = aligned_alloc(alignment, size);
+  }
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+// out of line, gcc warns about free() on memory from a new expression when it
+// can see both
+[[gnu::noinline]] static void countedFree(void *ptr) noexcept { free(ptr); }
+
+void *operator new(size_t size) { return countedAlloc(size, 0); }
+void *operator new[](size_t size) { return countedAlloc(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) {
+  return countedAlloc(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return countedAlloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  countedFree(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+  countedFree(ptr);
+}
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept {
+  countedFree(ptr);
+}
+
+// every way the ball state machine can move, a trace that never takes one
+// of them isn't benchmarking all of the simulation
+constexpr std::array<std::pair<uint32_t, uint32_t>, 11> BALL_STATE_TRANSITIONS =
+    {{{BALL_STATE_READY_TO_SERVE, BALL_STATE_IN_SERVICE},
+      {BALL_STATE_IN_SERVICE, BALL_STATE_TRAVELLING},
+      {BALL_STATE_IN_SERVICE, BALL_STATE_FAILED_SERVICE},
+      {BALL_STATE_FAILED_SERVICE, BALL_STATE_GAME_OVER},
+      {BALL_STATE_TRAVELLING, BALL_STATE_FIRST_PASS},
+      {BALL_STATE_TRAVELLING, BALL_STATE_GAME_OVER},
+      {BALL_STATE_FIRST_PASS, BALL_STATE_SECOND_PASS},
+      {BALL_STATE_FIRST_PASS, BALL_STATE_GAME_OVER},
+      {BALL_STATE_SECOND_PASS, BALL_STATE_TRAVELLING},
+      {BALL_STATE_SECOND_PASS, BALL_STATE_GAME_OVER},
+      {BALL_STATE_GAME_OVER, BALL_STATE_READY_TO_SERVE}}};
+
+// a trace is simulated a chunk of ticks at a time, once to pick the inputs
+// and follow the ball state machine and then again from the same state with
+// the clock around the whole chunk. a single phase of a tick is cheaper than
+// reading the clock, so we don't time anything smaller than this
+constexpr uint64_t TRACE_CHUNK_TICKS = 1024;
+
+struct TraceResult {
+  std::string name;
+  uint64_t ticks = 0;
+  double ns = 0.0; // all four updatePlayerState() calls and updateGameState()
+  uint64_t allocations = 0;
+  // the timed run came out different from the untimed one
+  bool nondeterministic = false;
+  std::array<uint64_t, NUM_BALL_STATES> ticks_in_state = {};
+  std::array<std::array<uint64_t, NUM_BALL_STATES>, NUM_BALL_STATES>
+      transitions = {};
+
+  double nsPerTick() const { return ns / ticks; }
+  double ticksPerSec() const { return 1e9 / nsPerTick(); }
+
+  void countTransition(uint32_t from, uint32_t to) {
+    if (from != to) {
+      transitions[std::min<size_t>(from, NUM_BALL_STATES - 1)]
+                 [std::min<size_t>(to, NUM_BALL_STATES - 1)]++;
+    }
+  }
+};
+
+template <class Players>
+TraceResult runTrace(const std::string &name, Players players, uint64_t seed,
+                     uint64_t ticks) {
+  TraceResult result;
+  result.name = name;
+  result.ticks = ticks;
+
+  GameState state;
+  resetGameState(state);
+  state.rng_seed = static_cast<uint32_t>(seed);
+  std::vector<InputMessage> inputs(TRACE_CHUNK_TICKS * PLAYERS_PER_ROOM);
+  for (uint64_t first = 0; first < ticks; first += TRACE_CHUNK_TICKS) {
+    uint64_t chunk_ticks = std::min(TRACE_CHUNK_TICKS, ticks - first);
+    GameState timed_state = state;
+
+    // every player's update can move the ball state on, so look after each
+    for (uint64_t i = 0; i < chunk_ticks; i++) {
+      InputMessage *tick_inputs = &inputs[i * PLAYERS_PER_ROOM];
+      for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        tick_inputs[player] = players.input(state, player);
+        tick_inputs[player].tick = first + i;
+      }
+      for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        uint32_t before = state.ball_state;
+        updatePlayerState(state, tick_inputs[player], DESIRED_TICK_LENGTH,
+                          player);
+        result.countTransition(before, state.ball_state);
+      }
+      uint32_t before = state.ball_state;
+      updateGameState(state, DESIRED_TICK_LENGTH);
+      state.tick = first + i;
+      result.countTransition(before, state.ball_state);
+      result.ticks_in_state[std::min<size_t>(state.ball_state,
+                                             NUM_BALL_STATES - 1)]++;
+    }
+
+    uint64_t allocations_before = allocations.load();
+    auto start = steady_clock::now();
+    for (uint64_t i = 0; i < chunk_ticks; i++) {
+      const InputMessage *tick_inputs = &inputs[i * PLAYERS_PER_ROOM];
+      for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        updatePlayerState(timed_state, tick_inputs[player],
+                          DESIRED_TICK_LENGTH, player);
+      }
+      updateGameState(timed_state, DESIRED_TICK_LENGTH);
+      timed_state.tick = first + i;
+    }
+    result.ns +=
+        duration<double, std::nano>(steady_clock::now() - start).count();
+    result.allocations += allocations.load() - allocations_before;
+    // also keeps the timed run from being optimized away
+    if (!(timed_state == state)) {
+      result.nondeterministic = true;
+    }
+  }
+  return result;
+}
+
+struct BatchResult {
+  std::string name;
+  size_t matches = 0;
+  uint64_t ticks = 0; // per match
+  double scalar_ns = 0.0;
+  double batch_ns = 0.0;
+  uint64_t scalar_fallbacks = 0;
+  uint64_t mismatches = 0;
+  std::string first_mismatch;
+
+  uint64_t matchTicks() const { return matches * ticks; }
+  double fallbackRate() const {
+    return static_cast<double>(scalar_fallbacks) / matchTicks();
+  }
+};
+
+// name of the first field that isn't bit for bit the same, empty if none
+std::string firstDifferentField(const GameState &a, const GameState &b) {
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    if (memcmp(reinterpret_cast<const uint8_t *>(&a) + field.offset,
+               reinterpret_cast<const uint8_t *>(&b) + field.offset,
+               field.size) != 0) {
+      return field.name;
+    }
+  }
+  return "";
+}
+
+// steps the same matches with the scalar functions and with BatchSimulation,
+// timing both and checking after every tick that they agree exactly
+template <class Players>
+BatchResult runBatch(const std::string &name, std::vector<Players> players,
+                     uint64_t seed, uint64_t ticks) {
+  BatchResult result;
+  result.name = name;
+  result.matches = players.size();
+  result.ticks = ticks;
+
+  std::vector<GameState> states(result.matches);
+  BatchSimulation batch(result.matches);
+  for (size_t i = 0; i < result.matches; i++) {
+    resetGameState(states[i]);
+    states[i].rng_seed = static_cast<uint32_t>(seed + i);
+    batch.set(i, states[i]);
+  }
+  std::vector<InputMessage> inputs(result.matches * PLAYERS_PER_ROOM);
+  for (uint64_t tick = 0; tick < ticks; tick++) {
+    for (size_t i = 0; i < result.matches; i++) {
+      for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        InputMessage &input = inputs[i * PLAYERS_PER_ROOM + player];
+        input = players[i].input(states[i], player);
+        input.tick = tick;
+      }
+    }
+
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < result.matches; i++) {
+      for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        updatePlayerState(states[i], inputs[i * PLAYERS_PER_ROOM + player],
+                          DESIRED_TICK_LENGTH, player);
+      }
+      updateGameState(states[i], DESIRED_TICK_LENGTH);
+      states[i].tick = tick;
+    }
+    auto scalar_done = steady_clock::now();
+    batch.step(inputs.data(), tick, DESIRED_TICK_LENGTH);
+    auto batch_done = steady_clock::now();
+
+    result.scalar_ns +=
+        duration<double, std::nano>(scalar_done - start).count();
+    result.batch_ns +=
+        duration<double, std::nano>(batch_done - scalar_done).count();
+
+    for (size_t i = 0; i < result.matches; i++) {
+      std::string field = firstDifferentField(states[i], batch.get(i));
+      if (field.empty()) {
+        continue;
+      }
+      if (result.mismatches == 0) {
+        result.first_mismatch = "match " + std::to_string(i) + " tick " +
+                                std::to_string(tick) + " " + field;
+      }
+      result.mismatches++;
+      // keep going from the scalar result so one bug doesn't flag every tick
+      batch.set(i, states[i]);
+    }
+  }
+  result.scalar_fallbacks = batch.scalarFallbacks();
+  return result;
+}
+
+// net_message.hpp's MAX_MESSAGE_SIZE, without pulling in the networking
+// library
+constexpr size_t WIRE_BUFFER_SIZE = 1200;
+
+struct WireResult {
+  uint64_t ticks = 0;
+  uint64_t full_bytes = 0;
+  uint64_t deltas = 0;
+  uint64_t delta_bytes = 0;
+  double max_error = 0.0;
+  uint64_t input_packets = 0;
+  // with buttons that change partway through, and so take the long form
+  uint64_t changing_packets = 0;
+  uint64_t failures = 0;
+  std::string first_failure;
+
+  double bytesPerFull() const {
+    return static_cast<double>(full_bytes) / ticks;
+  }
+  double bytesPerDelta() const {
+    return static_cast<double>(delta_bytes) / std::max<uint64_t>(1, deltas);
+  }
+
+  void fail(uint64_t tick, const std::string &what) {
+    if (failures == 0) {
+      first_failure = "tick " + std::to_string(tick) + " " + what;
+    }
+    failures++;
+  }
+};
+
+// sends a scripted match through the wire format: every tick as a full
+// snapshot and as a delta against a baseline up to SNAPSHOT_HISTORY_CAPACITY
+// ticks older, the way the server does, and the last MAX_INPUTS_PER_PACKET
+// inputs of one of the players as an InputPacket. the decoder only ever
+// sees what came through the wire, like a client
+WireResult runWire(uint64_t seed, uint64_t ticks) {
+  WireResult result;
+  result.ticks = ticks;
+  ScriptedPlayers players(seed);
+  std::mt19937_64 rng(seed);
+  GameState state;
+  resetGameState(state);
+  state.rng_seed = static_cast<uint32_t>(seed);
+  SnapshotHistory sent;
+  SnapshotHistory received;
+  std::array<std::array<InputMessage, MAX_INPUTS_PER_PACKET>, PLAYERS_PER_ROOM>
+      recent_inputs;
+  std::array<uint8_t, WIRE_BUFFER_SIZE> buffer;
+
+  for (uint64_t tick = 0; tick < ticks; tick++) {
+    for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      InputMessage input = players.input(state, player);
+      input.tick = static_cast<uint32_t>(tick);
+      recent_inputs[player][tick % MAX_INPUTS_PER_PACKET] = input;
+      updatePlayerState(state, input, DESIRED_TICK_LENGTH, player);
+    }
+    updateGameState(state, DESIRED_TICK_LENGTH);
+    state.tick = static_cast<uint32_t>(tick);
+    // each player's acks trail the tick by a different amount
+    InputAcks acks;
+    for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      acks[player] = tick + 1 > player ? tick + 1 - player : 0;
+    }
+
+    WireWriter full_writer(buffer.data(), buffer.size());
+    encodeSnapshot(full_writer, nullptr, state, acks);
+    result.full_bytes += full_writer.size();
+    WireReader full_reader(buffer.data(), full_writer.size());
+    GameState full;
+    InputAcks full_acks;
+    if (!full_writer.ok() ||
+        decodeSnapshot(full_reader, received, full, full_acks) !=
+            SNAPSHOT_OK) {
+      result.fail(tick, "full snapshot didn't decode");
+      continue;
+    }
+    if (full_acks != acks) {
+      result.fail(tick, "input acks");
+    }
+    if (hashGameState(full) != hashGameState(state)) {
+      result.fail(tick, "hash of the decoded state");
+    }
+    for (const GameStateField &field : GAME_STATE_FIELDS) {
+      double error =
+          std::abs(fieldValue(field, full) - fieldValue(field, state));
+      result.max_error = std::max(result.max_error, error);
+      if (!(error < EPSILON)) {
+        result.fail(tick, std::string(field.name) + " off by " +
+                              std::to_string(error));
+      }
+    }
+
+    uint32_t age = 1 + rng() % (SNAPSHOT_HISTORY_CAPACITY - 1);
+    const GameState *baseline = tick >= age ? sent.find(tick - age) : nullptr;
+    if (baseline != nullptr) {
+      WireWriter delta_writer(buffer.data(), buffer.size());
+      encodeSnapshot(delta_writer, baseline, state, acks);
+      result.deltas++;
+      result.delta_bytes += delta_writer.size();
+      WireReader delta_reader(buffer.data(), delta_writer.size());
+      GameState delta;
+      InputAcks delta_acks;
+      if (!delta_writer.ok() ||
+          decodeSnapshot(delta_reader, received, delta, delta_acks) !=
+              SNAPSHOT_OK) {
+        result.fail(tick, "delta snapshot didn't decode");
+      } else if (std::string field = firstDifferentField(full, delta);
+                 !field.empty()) {
+        result.fail(tick, "delta decoded differently in " + field);
+      } else if (delta_acks != acks) {
+        result.fail(tick, "delta input acks");
+      }
+    }
+    sent.store(state);
+    received.store(full);
+
+    if (tick + 1 < MAX_INPUTS_PER_PACKET) {
+      continue;
+    }
+    uint8_t player = tick % PLAYERS_PER_ROOM;
+    InputPacket packet;
+    packet.count = MAX_INPUTS_PER_PACKET;
+    for (size_t i = 0; i < MAX_INPUTS_PER_PACKET; i++) {
+      packet.inputs[i] =
+          recent_inputs[player][(tick + 1 + i) % MAX_INPUTS_PER_PACKET];
+    }
+    WireWriter input_writer(buffer.data(), buffer.size());
+    packet.serialize(input_writer);
+    WireReader input_reader(buffer.data(), input_writer.size());
+    InputPacket decoded;
+    decoded.serialize(input_reader);
+    result.input_packets++;
+    if (!input_writer.ok() || !input_reader.ok() ||
+        decoded.count != packet.count) {
+      result.fail(tick, "input packet didn't decode");
+      continue;
+    }
+    bool changes = false;
+    for (size_t i = 0; i < packet.count; i++) {
+      changes |= i > 0 && packButtons(packet.inputs[i]) !=
+                              packButtons(packet.inputs[i - 1]);
+      if (decoded.inputs[i].tick != packet.inputs[i].tick ||
+          packButtons(decoded.inputs[i]) != packButtons(packet.inputs[i])) {
+        result.fail(tick, "input " + std::to_string(i) + " of a packet");
+        break;
+      }
+    }
+    result.changing_packets += changes;
+  }
+  if (result.changing_packets == 0) {
+    result.fail(ticks, "no input packet had a button change in it");
+  }
+  return result;
+}
+
+struct RngResult {
+  uint64_t calls = 0;
+  double mt19937_ns = 0.0;
+  double counter_ns = 0.0;
+};
+
+// the random numbers for one movePositionRandomly() call, made the way it
+// used to (seed a fresh mt19937_64 with the tick, draw two floats) and with
+// matchRandom()
+RngResult runRng(uint64_t seed, uint64_t calls) {
+  RngResult result;
+  result.calls = calls;
+
+  float mt19937_sum = 0.0f;
+  auto start = steady_clock::now();
+  for (uint64_t i = 0; i < calls; i++) {
+    std::mt19937_64 rand(i);
+    mt19937_sum += std::generate_canonical<float, 128>(rand);
+    mt19937_sum += std::generate_canonical<float, 128>(rand);
+  }
+  auto mt19937_done = steady_clock::now();
+  uint32_t match_seed = static_cast<uint32_t>(seed);
+  Scalar counter_sum = 0.0;
+  for (uint64_t i = 0; i < calls; i++) {
+    uint32_t tick = static_cast<uint32_t>(i);
+    counter_sum +=
+        randomUnit(matchRandom(match_seed, tick, RANDOM_FIRST_PASS, 0));
+    counter_sum +=
+        randomUnit(matchRandom(match_seed, tick, RANDOM_FIRST_PASS, 1));
+  }
+  auto counter_done = steady_clock::now();
+  // use the sums so neither loop can be thrown away
+  volatile float sink = mt19937_sum + toFloat(counter_sum);
+  (void)sink;
+
+  result.mt19937_ns =
+      duration<double, std::nano>(mt19937_done - start).count() / calls;
+  result.counter_ns =
+      duration<double, std::nano>(counter_done - mt19937_done).count() /
+      calls;
+  return result;
+}
+
+struct MetricsResult {
+  uint64_t calls = 0;
+  double counter_ns = 0.0;
+  double histogram_ns = 0.0;
+  // everything a room's step updates, all of it every 8th step: timing, the
+  // tick counter and every player's input queue depth
+  double step_ns = 0.0;
+  double render_us = 0.0; // a scrape of a server with every room registered
+  size_t series = 0;
+};
+
+MetricsResult runMetrics(uint64_t calls) {
+  MetricsResult result;
+  result.calls = calls;
+  MetricsRegistry registry;
+  std::vector<LatencyHistogram *> step_times;
+  std::vector<Counter *> ticks;
+  std::vector<std::array<Gauge *, PLAYERS_PER_ROOM>> depths;
+  // the same series the server registers for each room
+  for (int room = 0; room < static_cast<int>(MAX_ROOMS); room++) {
+    std::string room_label = label("room", room);
+    step_times.push_back(
+        &registry.histogram("svb_room_step_seconds", "", room_label));
+    ticks.push_back(&registry.counter("svb_room_ticks_total", "", room_label));
+    registry.gauge("svb_room_players", "", room_label);
+    registry.histogram("svb_room_broadcast_seconds", "", room_label);
+    for (const char *name :
+         {"svb_room_snapshots_sent_total", "svb_room_state_hashes_sent_total",
+          "svb_room_messages_sent_total", "svb_room_bytes_sent_total"}) {
+      registry.counter(name, "", room_label);
+    }
+    depths.emplace_back();
+    for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      depths.back()[player] =
+          &registry.gauge("svb_room_input_queue_depth", "",
+                          room_label + "," + label("player", player));
+    }
+    result.series += 12;
+  }
+
+  auto start = steady_clock::now();
+  for (uint64_t i = 0; i < calls; i++) {
+    ticks[i % MAX_ROOMS]->add();
+  }
+  auto counter_done = steady_clock::now();
+  for (uint64_t i = 0; i < calls; i++) {
+    step_times[i % MAX_ROOMS]->observe(static_cast<int64_t>(i % 4096) * 64);
+  }
+  auto histogram_done = steady_clock::now();
+  for (uint64_t i = 0; i < calls; i++) {
+    size_t room = i % MAX_ROOMS;
+    if ((i / MAX_ROOMS) % STEP_TIME_SAMPLE_INTERVAL == 0) {
+      auto step_start = steady_clock::now();
+      step_times[room]->observe(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              steady_clock::now() - step_start)
+              .count());
+      ticks[room]->add(STEP_TIME_SAMPLE_INTERVAL);
+      for (Gauge *depth : depths[room]) {
+        depth->set(static_cast<int64_t>(i % 8));
+      }
+    }
+  }
+  auto step_done = steady_clock::now();
+
+  const int renders = 100;
+  size_t rendered = 0;
+  for (int i = 0; i < renders; i++) {
+    rendered += registry.render().size();
+  }
+  auto render_done = steady_clock::now();
+  volatile size_t sink = rendered;
+  (void)sink;
+
+  result.counter_ns =
+      duration<double, std::nano>(counter_done - start).count() / calls;
+  result.histogram_ns =
+      duration<double, std::nano>(histogram_done - counter_done).count() /
+      calls;
+  result.step_ns =
+      duration<double, std::nano>(step_done - histogram_done).count() / calls;
+  result.render_us =
+      duration<double, std::micro>(render_done - step_done).count() / renders;
+  return result;
+}
+
+void writeJson(std::ostream &out, const std::vector<TraceResult> &results,
+               const std::vector<BatchResult> &batches, const WireResult &wire,
+               const RngResult &rng, const MetricsResult &metrics,
+               uint64_t seed) {
+  out << std::fixed << std::setprecision(3);
+  out << "{\n";
+  out << "  \"version\": " << BENCH_JSON_VERSION << ",\n";
+  out << "  \"seed\": " << seed << ",\n";
+  out << "  \"scalar\": \"" << (SCALAR_IS_FIXED ? "fixed" : "float")
+      << "\",\n";
+  out << "  \"traces\": {\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const TraceResult &r = results[i];
+    out << "    \"" << r.name << "\": {\n";
+    out << "      \"ticks\": " << r.ticks << ",\n";
+    out << "      \"ticks_per_sec\": " << r.ticksPerSec() << ",\n";
+    out << "      \"ns_per_tick\": " << r.nsPerTick() << ",\n";
+    out << "      \"allocations_per_tick\": "
+        << static_cast<double>(r.allocations) / r.ticks << ",\n";
+    out << "      \"ticks_in_state\": {";
+    for (size_t s = 0; s < NUM_BALL_STATES; s++) {
+      out << (s == 0 ? "" : ", ") << "\"" << BALL_STATE_NAMES[s]
+          << "\": " << r.ticks_in_state[s];
+    }
+    out << "},\n";
+    out << "      \"transitions\": {";
+    bool first = true;
+    for (size_t from = 0; from < NUM_BALL_STATES; from++) {
+      for (size_t to = 0; to < NUM_BALL_STATES; to++) {
+        if (r.transitions[from][to] == 0) {
+          continue;
+        }
+        out << (first ? "" : ", ") << "\"" << BALL_STATE_NAMES[from] << "->"
+            << BALL_STATE_NAMES[to] << "\": " << r.transitions[from][to];
+        first = false;
+      }
+    }
+    out << "}\n";
+    out << "    }" << (i + 1 == results.size() ? "" : ",") << "\n";
+  }
+  out << "  },\n";
+  out << "  \"batch\": {\n";
+  for (size_t i = 0; i < batches.size(); i++) {
+    const BatchResult &b = batches[i];
+    out << "    \"" << b.name << "\": {\n";
+    out << "      \"matches\": " << b.matches << ",\n";
+    out << "      \"ticks\": " << b.ticks << ",\n";
+    out << "      \"ns_per_match_tick_scalar\": "
+        << b.scalar_ns / b.matchTicks() << ",\n";
+    out << "      \"ns_per_match_tick_batch\": "
+        << b.batch_ns / b.matchTicks() << ",\n";
+    out << "      \"scalar_fallback_rate\": " << b.fallbackRate() << ",\n";
+    out << "      \"mismatches\": " << b.mismatches << "\n";
+    out << "    }" << (i + 1 == batches.size() ? "" : ",") << "\n";
+  }
+  out << "  },\n";
+  out << "  \"wire\": {\n";
+  out << "    \"ticks\": " << wire.ticks << ",\n";
+  out << "    \"bytes_per_full_snapshot\": " << wire.bytesPerFull()
+      << ",\n";
+  out << "    \"bytes_per_delta_snapshot\": " << wire.bytesPerDelta()
+      << ",\n";
+  out << "    \"max_error\": " << wire.max_error << ",\n";
+  out << "    \"input_packets\": " << wire.input_packets << ",\n";
+  out << "    \"failures\": " << wire.failures << "\n";
+  out << "  },\n";
+  out << "  \"rng\": {\n";
+  out << "    \"calls\": " << rng.calls << ",\n";
+  out << "    \"ns_per_call_mt19937_64\": " << rng.mt19937_ns << ",\n";
+  out << "    \"ns_per_call_counter\": " << rng.counter_ns << "\n";
+  out << "  },\n";
+  out << "  \"metrics\": {\n";
+  out << "    \"calls\": " << metrics.calls << ",\n";
+  out << "    \"ns_per_counter_add\": " << metrics.counter_ns << ",\n";
+  out << "    \"ns_per_histogram_observe\": " << metrics.histogram_ns
+      << ",\n";
+  out << "    \"ns_per_room_step\": " << metrics.step_ns << ",\n";
+  out << "    \"us_per_render\": " << metrics.render_us << ",\n";
+  out << "    \"series\": " << metrics.series << "\n";
+  out << "  }\n";
+  out << "}\n";
+}
+
+// pull "ns_per_tick" for one trace out of a baseline file we wrote earlier.
+// not a general json parser, it only has to read our own output
+bool baselineNsPerTick(const std::string &json, const std::string &trace,
+                       double &ns_per_tick) {
+  size_t trace_start = json.find("\"" + trace + "\"");
+  if (trace_start == std::string::npos) {
+    return false;
+  }
+  const std::string key = "\"ns_per_tick\":";
+  size_t key_start = json.find(key, trace_start);
+  if (key_start == std::string::npos) {
+    return false;
+  }
+  ns_per_tick = atof(json.c_str() + key_start + key.size());
+  return ns_per_tick > 0.0;
+}
+
+void printUsage() {
+  std::cerr << "usage: svb_bench [--ticks N] [--seed N] [--json FILE] "
+               "[--baseline FILE] [--tolerance FRACTION] [--matches N]"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  uint64_t ticks = DEFAULT_TICKS;
+  uint64_t seed = 1;
+  double tolerance = DEFAULT_TOLERANCE;
+  size_t batch_matches = DEFAULT_BATCH_MATCHES;
+  std::string json_path;
+  std::string baseline_path;
+
+  int curr_arg = 0;
+  while (++curr_arg != argc) {
+    bool has_value = curr_arg + 1 != argc;
+    if (strcmp(argv[curr_arg], "--ticks") == 0 && has_value) {
+      ticks = strtoull(argv[++curr_arg], nullptr, 10);
+    } else if (strcmp(argv[curr_arg], "--seed") == 0 && has_value) {
+      seed = strtoull(argv[++curr_arg], nullptr, 10);
+    } else if (strcmp(argv[curr_arg], "--json") == 0 && has_value) {
+      json_path = argv[++curr_arg];
+    } else if (strcmp(argv[curr_arg], "--baseline") == 0 && has_value) {
+      baseline_path = argv[++curr_arg];
+    } else if (strcmp(argv[curr_arg], "--tolerance") == 0 && has_value) {
+      tolerance = atof(argv[++curr_arg]);
+    } else if (strcmp(argv[curr_arg], "--matches") == 0 && has_value) {
+      batch_matches = strtoull(argv[++curr_arg], nullptr, 10);
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (ticks == 0 || batch_matches == 0) {
+    printUsage();
+    return 1;
+  }
+
+  std::vector<TraceResult> results;
+  results.push_back(runTrace("scripted", ScriptedPlayers(seed), seed, ticks));
+  results.push_back(runTrace("random", RandomPlayers(seed), seed, ticks));
+
+  // the same number of simulated ticks, spread over many matches
+  uint64_t batch_ticks = std::max<uint64_t>(1, ticks / batch_matches);
+  std::vector<ScriptedPlayers> scripted;
+  std::vector<RandomPlayers> random;
+  for (size_t i = 0; i < batch_matches; i++) {
+    scripted.emplace_back(seed + i);
+    random.emplace_back(seed + i);
+  }
+  std::vector<BatchResult> batches;
+  batches.push_back(runBatch("scripted", scripted, seed, batch_ticks));
+  batches.push_back(runBatch("random", random, seed, batch_ticks));
+
+  // a tenth of the ticks is plenty to go through every ball state
+  WireResult wire = runWire(seed, std::max<uint64_t>(1, ticks / 10));
+  // seeding mt19937_64 is slow enough that a fraction of the ticks will do
+  RngResult rng = runRng(seed, std::max<uint64_t>(1, ticks / 64));
+  MetricsResult metrics = runMetrics(ticks);
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "simulating with " << (SCALAR_IS_FIXED ? "fixed point" : "float")
+            << std::endl;
+  for (const TraceResult &r : results) {
+    std::cout << r.name << ": " << r.ticksPerSec() << " ticks/s, "
+              << r.nsPerTick() << " ns/tick, " << std::setprecision(3)
+              << static_cast<double>(r.allocations) / r.ticks
+              << " allocations/tick" << std::setprecision(1) << std::endl;
+  }
+  for (const BatchResult &b : batches) {
+    std::cout << b.name << " x" << b.matches << ": scalar "
+              << b.scalar_ns / b.matchTicks() << " ns/match tick, batch "
+              << b.batch_ns / b.matchTicks() << " ns/match tick, "
+              << std::setprecision(2) << b.fallbackRate() * 100.0
+              << "% scalar fallbacks"
+              << (SCALAR_IS_FIXED ? " (the batch kernels are float only)" : "")
+              << std::setprecision(1) << std::endl;
+  }
+  std::cout << "wire: " << wire.ticks << " ticks, " << wire.bytesPerFull()
+            << " bytes per full snapshot, " << wire.bytesPerDelta()
+            << " per delta, max error " << std::setprecision(4)
+            << wire.max_error << std::setprecision(1) << ", "
+            << wire.input_packets << " input packets" << std::endl;
+  std::cout << "rng: mt19937_64 " << rng.mt19937_ns << " ns/call, counter "
+            << rng.counter_ns << " ns/call" << std::endl;
+  std::cout << "metrics: counter " << metrics.counter_ns << " ns, histogram "
+            << metrics.histogram_ns << " ns, room step " << metrics.step_ns
+            << " ns (" << metrics.step_ns / results.front().nsPerTick() * 100.0
+            << "% of a scripted tick), scrape of " << metrics.series
+            << " series " << metrics.render_us << " us" << std::endl;
+
+  int exit_code = 0;
+
+  // every ball state and every transition between them has to show up in
+  // at least one trace, otherwise we aren't benchmarking the whole state
+  // machine
+  for (size_t s = 0; s < NUM_BALL_STATES; s++) {
+    bool covered = std::any_of(
+        results.begin(), results.end(),
+        [s](const TraceResult &r) { return r.ticks_in_state[s] > 0; });
+    if (!covered) {
+      std::cout << "WARN: no trace reached BALL_STATE_" << BALL_STATE_NAMES[s]
+                << std::endl;
+      exit_code = 1;
+    }
+  }
+  std::array<std::array<bool, NUM_BALL_STATES>, NUM_BALL_STATES> expected = {};
+  for (const auto &[from, to] : BALL_STATE_TRANSITIONS) {
+    expected[from][to] = true;
+    bool covered = std::any_of(
+        results.begin(), results.end(),
+        [&](const TraceResult &r) { return r.transitions[from][to] > 0; });
+    if (!covered) {
+      std::cout << "WARN: no trace went from BALL_STATE_"
+                << BALL_STATE_NAMES[from] << " to BALL_STATE_"
+                << BALL_STATE_NAMES[to] << std::endl;
+      exit_code = 1;
+    }
+  }
+  for (const TraceResult &r : results) {
+    for (size_t from = 0; from < NUM_BALL_STATES; from++) {
+      for (size_t to = 0; to < NUM_BALL_STATES; to++) {
+        if (r.transitions[from][to] > 0 && !expected[from][to]) {
+          std::cout << "WARN: " << r.name << " went from BALL_STATE_"
+                    << BALL_STATE_NAMES[from] << " to BALL_STATE_"
+                    << BALL_STATE_NAMES[to]
+                    << ", which BALL_STATE_TRANSITIONS doesn't know about"
+                    << std::endl;
+          exit_code = 1;
+        }
+      }
+    }
+    if (r.nondeterministic) {
+      std::cout << "ERROR: trace " << r.name
+                << " came out different when simulated again" << std::endl;
+      exit_code = 3;
+    }
+  }
+
+  // the batched engine is only worth having if it's exact
+  for (const BatchResult &b : batches) {
+    if (b.mismatches > 0) {
+      std::cout << "ERROR: batch " << b.name << " differs from scalar in "
+                << b.mismatches << " match ticks, first at "
+                << b.first_mismatch << std::endl;
+      exit_code = 3;
+    }
+  }
+
+  // and so is the wire format
+  if (wire.failures > 0) {
+    std::cout << "ERROR: " << wire.failures
+              << " wire format round trips failed, first at "
+              << wire.first_failure << std::endl;
+    exit_code = 4;
+  }
+
+  if (!json_path.empty()) {
+    std::ofstream json_file(json_path);
+    writeJson(json_file, results, batches, wire, rng, metrics, seed);
+  } else {
+    writeJson(std::cout, results, batches, wire, rng, metrics, seed);
+  }
+
+  if (!baseline_path.empty()) {
+    std::ifstream baseline_file(baseline_path);
+    std::stringstream buffer;
+    buffer << baseline_file.rdbuf();
+    for (const TraceResult &r : results) {
+      double baseline = 0.0;
+      if (!baselineNsPerTick(buffer.str(), r.name, baseline)) {
+        std::cout << "WARN: no baseline for trace " << r.name << std::endl;
+        continue;
+      }
+      double change = r.nsPerTick() / baseline - 1.0;
+      std::cout << r.name << ": " << std::showpos << change * 100.0
+                << std::noshowpos << "% vs baseline";
+      if (change > tolerance) {
+        std::cout << " REGRESSION";
+        exit_code = std::max(exit_code, 2);
+      }
+      std::cout << std::endl;
+    }
+  }
+  return exit_code;
+}
@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bot_player.hpp"
+#include "client_net.hpp"
+#include "game_state.hpp"
+#include "net_impairment.hpp"
+
+// Headless load generator for capacity testing. Fills a server with rooms of
+// four scripted players, each its own connection driving the same Client the
+// game does, and adds rooms step by step until the server can't keep its
+// ticks on time anymore.
+//
+// A tick is late when its snapshot or state hash shows up later than the
+// room's earliest one would have it: we keep the smallest
+// arrival - tick * tick length a room ever had, and how far each tick lands
+// past that is its lateness. That covers the server stepping late, skipping
+// ticks and broadcasting slowly, plus whatever the network adds, which is
+// next to nothing on loopback.
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+constexpr const char *DEFAULT_SERVER = "127.0.0.1:25565";
+constexpr int DEFAULT_START_ROOMS = 1;
+constexpr int DEFAULT_ADD_ROOMS = 1;
+constexpr double DEFAULT_STEP_SECONDS = 10.0;
+constexpr double DEFAULT_BUDGET_MS = 5.0;
+// new rooms settle their input leads and snapshot acks before we measure
+constexpr double WARMUP_SECONDS = 2.0;
+// a room that isn't playing by then isn't coming, the server is full
+constexpr double ROOM_START_TIMEOUT = 10.0;
+// when the bot itself is this busy its own frames make ticks look late
+constexpr double MAX_BOT_BUSY = 0.8;
+
+static double secondsSince(steady_clock::time_point start) {
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+// four bots playing one match, the first one makes the room and the others
+// join it once we know which one it is
+class BotRoom {
+public:
+  BotRoom(const SteamNetworkingIPAddr &server, uint64_t seed,
+          double started_at)
+      : server_(server), seed_(seed), started_at_(started_at) {
+    bots_.push_back(std::make_unique<Bot>(server_, seed_));
+    bots_[0]->client().makeRoom();
+  }
+
+  void frame(double frame_time, double now) {
+    for (std::unique_ptr<Bot> &bot : bots_) {
+      bot->frame(frame_time);
+    }
+    Client &host = bots_[0]->client();
+    if (bots_.size() == 1 && host.room_state &&
+        host.room_state->current_room != -1) {
+      for (int player = 1; player < PLAYERS_PER_ROOM; player++) {
+        bots_.push_back(std::make_unique<Bot>(server_, seed_ + player));
+        bots_.back()->client().joinRoom(host.room_state->current_room);
+      }
+    }
+
+    std::optional<uint32_t> tick = host.receive_stats.newest_tick;
+    if (!tick || tick == newest_tick_) {
+      return;
+    }
+    if (newest_tick_ && *tick < *newest_tick_) {
+      earliest_ = std::nullopt; // a new match
+    }
+    newest_tick_ = tick;
+    double arrival = now - *tick * DESIRED_TICK_LENGTH;
+    earliest_ = std::min(earliest_.value_or(arrival), arrival);
+    arrivals_.push_back(arrival);
+  }
+
+  bool playing() const {
+    return bots_.size() == PLAYERS_PER_ROOM &&
+           std::all_of(bots_.begin(), bots_.end(),
+                       [](const std::unique_ptr<Bot> &bot) {
+                         return bot->playing();
+                       });
+  }
+
+  bool lostConnection() const {
+    return std::any_of(bots_.begin(), bots_.end(),
+                       [](const std::unique_ptr<Bot> &bot) {
+                         return bot->client().lost_connection;
+                       });
+  }
+
+  double startedAt() const { return started_at_; }
+
+  // lateness of every tick that arrived since the last call, in ms
+  void takeLateness(std::vector<double> &lateness_ms) {
+    for (double arrival : arrivals_) {
+      lateness_ms.push_back((arrival - *earliest_) * 1000.0);
+    }
+    arrivals_.clear();
+  }
+
+private:
+  SteamNetworkingIPAddr server_;
+  uint64_t seed_;
+  double started_at_;
+  std::vector<std::unique_ptr<Bot>> bots_;
+  std::optional<uint32_t> newest_tick_;
+  std::optional<double> earliest_;
+  std::vector<double> arrivals_;
+};
+
+struct BotOptions {
+  std::string server = DEFAULT_SERVER;
+  int start_rooms = DEFAULT_START_ROOMS;
+  int add_rooms = DEFAULT_ADD_ROOMS;
+  // stop here even if the server keeps up, 0 for no limit
+  int max_rooms = 0;
+  double step_seconds = DEFAULT_STEP_SECONDS;
+  double budget_ms = DEFAULT_BUDGET_MS;
+  uint64_t seed = 1;
+  const ImpairmentProfile *net_profile = nullptr;
+};
+
+// how one step of the ramp went
+struct StepResult {
+  size_t ticks = 0;
+  double ticks_per_room_per_sec = 0.0;
+  double p50_ms = 0.0;
+  double p99_ms = 0.0;
+  double max_ms = 0.0;
+  double busy = 0.0; // share of the time the bot spent working
+};
+
+static double percentile(std::vector<double> &values, double fraction) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  size_t i = std::min(values.size() - 1,
+                      static_cast<size_t>(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+static void printStep(size_t rooms, const StepResult &step) {
+  std::cout << std::fixed << std::setprecision(2) << "rooms: " << rooms
+            << " bots: " << rooms * PLAYERS_PER_ROOM
+            << " ticks/s per room: " << step.ticks_per_room_per_sec
+            << " lateness p50: " << step.p50_ms << " ms p99: " << step.p99_ms
+            << " ms max: " << step.max_ms
+            << " ms bot busy: " << step.busy * 100.0 << "%" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  BotOptions options;
+  int curr_arg = 0;
+  while (++curr_arg != argc) {
+    const char *arg = argv[curr_arg];
+    bool has_value = curr_arg + 1 != argc;
+    if (strcmp(arg, "--server") == 0 && has_value) {
+      options.server = argv[++curr_arg];
+    } else if (strcmp(arg, "--rooms") == 0 && has_value) {
+      options.start_rooms = std::max(1, atoi(argv[++curr_arg]));
+    } else if (strcmp(arg, "--add-rooms") == 0 && has_value) {
+      options.add_rooms = std::max(1, atoi(argv[++curr_arg]));
+    } else if (strcmp(arg, "--max-rooms") == 0 && has_value) {
+      options.max_rooms = atoi(argv[++curr_arg]);
+    } else if (strcmp(arg, "--step-seconds") == 0 && has_value) {
+      options.step_seconds = atof(argv[++curr_arg]);
+    } else if (strcmp(arg, "--budget-ms") == 0 && has_value) {
+      options.budget_ms = atof(argv[++curr_arg]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      options.seed = strtoull(argv[++curr_arg], nullptr, 10);
+    } else if (strcmp(arg, "--net-profile") == 0 && has_value) {
+      options.net_profile = findImpairmentProfile(argv[++curr_arg]);
+      if (!options.net_profile) {
+        std::cerr << "error: network profile must be one of "
+                  << impairmentProfileNames() << std::endl;
+        return 2;
+      }
+    } else {
+      std::cerr << "usage: svb_bot [--server ADDRESS:PORT] [--rooms N] "
+                   "[--add-rooms N] [--max-rooms N] [--step-seconds S] "
+                   "[--budget-ms MS] [--seed N] [--net-profile NAME]"
+                << std::endl;
+      return 2;
+    }
+  }
+
+  SteamNetworkingIPAddr server;
+  if (!server.ParseString(options.server.c_str())) {
+    std::cerr << "error: can't parse server address " << options.server
+              << std::endl;
+    return 2;
+  }
+  if (!initNetworking()) {
+    return 2;
+  }
+  if (options.net_profile && !applyImpairment(*options.net_profile)) {
+    return 2;
+  }
+  std::cout << "testing " << options.server << ", the tick lateness budget is "
+            << options.budget_ms << " ms at p99, seed " << options.seed
+            << std::endl;
+
+  auto start = steady_clock::now();
+  std::vector<std::unique_ptr<BotRoom>> rooms;
+  size_t target_rooms = options.start_rooms;
+  size_t sustained = 0;
+  std::optional<StepResult> sustained_step;
+  std::optional<double> measure_from;
+  std::vector<double> lateness_ms;
+  double busy_seconds = 0.0;
+  double last_frame = 0.0;
+  while (true) {
+    double now = secondsSince(start);
+    double frame_time = now - last_frame;
+    last_frame = now;
+    while (rooms.size() < target_rooms) {
+      uint64_t seed = options.seed + rooms.size() * PLAYERS_PER_ROOM;
+      rooms.push_back(std::make_unique<BotRoom>(server, seed, now));
+    }
+
+    Client::runCallbacks();
+    for (std::unique_ptr<BotRoom> &room : rooms) {
+      room->frame(frame_time, now);
+    }
+    busy_seconds += secondsSince(start) - now;
+
+    if (std::any_of(rooms.begin(), rooms.end(),
+                    [](const std::unique_ptr<BotRoom> &room) {
+                      return room->lostConnection();
+                    })) {
+      std::cout << "ERROR: lost the connection to the server" << std::endl;
+      return 1;
+    }
+
+    if (!measure_from) {
+      // every room has to be playing before the clock starts
+      bool all_playing = true;
+      bool stuck = false;
+      for (const std::unique_ptr<BotRoom> &room : rooms) {
+        all_playing &= room->playing();
+        stuck |= !room->playing() &&
+                 now - room->startedAt() > ROOM_START_TIMEOUT;
+      }
+      if (stuck) {
+        std::cout << "the server didn't start all " << rooms.size()
+                  << " rooms in " << ROOM_START_TIMEOUT
+                  << "s, it's probably out of rooms (see --max-rooms)"
+                  << std::endl;
+        break;
+      }
+      if (all_playing) {
+        measure_from = now + WARMUP_SECONDS;
+      }
+    } else if (now < *measure_from) {
+      // throw away what came in while warming up
+      for (std::unique_ptr<BotRoom> &room : rooms) {
+        room->takeLateness(lateness_ms);
+      }
+      lateness_ms.clear();
+      busy_seconds = 0.0;
+    } else {
+      for (std::unique_ptr<BotRoom> &room : rooms) {
+        room->takeLateness(lateness_ms);
+      }
+      double window = now - *measure_from;
+      if (window >= options.step_seconds) {
+        StepResult step;
+        step.ticks = lateness_ms.size();
+        step.ticks_per_room_per_sec = step.ticks / window / rooms.size();
+        step.p50_ms = percentile(lateness_ms, 0.5);
+        step.p99_ms = percentile(lateness_ms, 0.99);
+        step.max_ms =
+            lateness_ms.empty()
+                ? 0.0
+                : *std::max_element(lateness_ms.begin(), lateness_ms.end());
+        step.busy = busy_seconds / window;
+        printStep(rooms.size(), step);
+        if (step.busy > MAX_BOT_BUSY) {
+          std::cout << "WARN: the bot was busy " << step.busy * 100.0
+                    << "% of the time, its own frames are part of the "
+                       "lateness. run the rooms from more processes"
+                    << std::endl;
+        }
+        // a room that stops getting ticks at all is as late as it gets
+        if (step.p99_ms > options.budget_ms ||
+            step.ticks_per_room_per_sec < TICK_RATE * 0.9) {
+          break;
+        }
+        sustained = rooms.size();
+        sustained_step = step;
+        if (options.max_rooms > 0 &&
+            static_cast<int>(rooms.size()) >= options.max_rooms) {
+          break;
+        }
+        target_rooms = rooms.size() + options.add_rooms;
+        if (options.max_rooms > 0) {
+          target_rooms = std::min<size_t>(target_rooms, options.max_rooms);
+        }
+        measure_from = std::nullopt;
+        lateness_ms.clear();
+      }
+    }
+
+    // frames at about a millisecond, like a fast client
+    if (secondsSince(start) - now < 0.001) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  if (sustained == 0) {
+    std::cout << "the server couldn't keep " << options.start_rooms
+              << " rooms within budget" << std::endl;
+    return 1;
+  }
+  std::cout << "sustained " << sustained << " rooms ("
+            << sustained * PLAYERS_PER_ROOM << " bots) at p99 lateness "
+            << std::setprecision(2) << sustained_step->p99_ms << " ms"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <optional>
+#include <stdint.h>
+#include <vector>
+
+#include "client_net.hpp"
+#include "game_state.hpp"
+#include "scripted_players.hpp"
+
+// One scripted player on its own connection, for the load testing bot and
+// the latency benchmark. Drives the same Client the game does, with the
+// scripted player pressing the buttons.
+class Bot {
+public:
+  Bot(const SteamNetworkingIPAddr &server, uint64_t seed) : players_(seed) {
+    client_.verbose = false;
+    client_.nickname = "bot";
+    client_.start(server);
+  }
+
+  Client &client() { return client_; }
+  const Client &client() const { return client_; }
+
+  bool playing() const {
+    return client_.room_state && client_.room_state->current_room != -1 &&
+           client_.room_state->state == RS_PLAYING;
+  }
+
+  // what the game does every frame
+  void frame(double frame_time) {
+    ticks_sent_.clear();
+    client_.processIncomingMessages();
+    if (!playing()) {
+      tick_ = 0;
+      time_accumulator_ = 0.0;
+      return;
+    }
+
+    double tick_length = client_.tickLength();
+    if (client_.snapped_tick) {
+      tick_ = *client_.snapped_tick + 1;
+      client_.snapped_tick = std::nullopt;
+    }
+    time_accumulator_ += frame_time;
+    uint8_t player = client_.room_state->player_index;
+    while (time_accumulator_ >= tick_length) {
+      time_accumulator_ -= tick_length;
+      InputMessage input = players_.input(client_.game_state, player);
+      input.tick = tick_;
+      client_.queueInput(input);
+      client_.predictTick(input);
+      ticks_sent_.push_back(tick_);
+      tick_++;
+    }
+    client_.sendInputs();
+  }
+
+  // the ticks whose inputs went out during the last frame
+  const std::vector<uint32_t> &ticksSent() const { return ticks_sent_; }
+
+private:
+  Client client_;
+  ScriptedPlayers players_;
+  uint32_t tick_ = 0;
+  double time_accumulator_ = 0.0;
+  std::vector<uint32_t> ticks_sent_;
+};
@@ -1,23 +1,25 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <queue>
+#include <sstream>
 #include <string>
 
 #include <raylib.h>
-#include <steam/isteamnetworkingutils.h>
-#include <steam/steamnetworkingsockets.h>
 
+#include "client_net.hpp"
 #include "game_state.hpp"
+#include "net_impairment.hpp"
+#include "trace.hpp"
 
 using std::chrono::duration;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 
-constexpr size_t INPUT_HISTORY_CAPACITY = 300;
 constexpr int SCENE_MAIN_MENU = 0;
 constexpr int SCENE_ROOM_SELECT = 1;
 constexpr int SCENE_SETTINGS = 2;
@@ -29,271 +31,23 @@ constexpr std::array<std::pair<int, int>, 4> AVAILABLE_RESOLUTIONS = {
     std::make_pair(1920, 1080), std::make_pair(2560, 1440)};
 
 static bool debug_mode = false;
-
-class Client {
-public:
-  Client() = default;
-
-  void start() {
-    // init connection lib
-    SteamDatagramErrMsg error_msg;
-    if (!GameNetworkingSockets_Init(nullptr, error_msg)) {
-      std::cout
-          << "ERROR: Failed to Intialize Game Networking Sockets because: "
-          << error_msg << std::endl;
-    }
-    network_interface_ = SteamNetworkingSockets();
-    SteamNetworkingIPAddr server_address;
-    std::ifstream server_config_file("server_config.txt");
-
-    if (server_config_file.good()) {
-      std::stringstream buffer;
-      buffer << server_config_file.rdbuf();
-      server_address.ParseString(buffer.str().c_str());
-    } else {
-      server_address.ParseString("64.23.207.248:25565");
-    }
-    // connect to server
-    SteamNetworkingConfigValue_t opt;
-    opt.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged,
-               (void *)connectionStatusCallback);
-    connection_ =
-        network_interface_->ConnectByIPAddress(server_address, 1, &opt);
-    if (connection_ == k_HSteamNetConnection_Invalid) {
-      std::cout << "Server connection parameters were invalid!" << std::endl;
-    }
-  }
-
-  ~Client() {
-    network_interface_->CloseConnection(connection_, 0, "Client Exiting", true);
-  }
-
-  void processIncomingMessages() {
-    // go through all messages one at a time
-    while (true) {
-      ISteamNetworkingMessage *incoming_msg = nullptr;
-      int num_msgs = network_interface_->ReceiveMessagesOnConnection(
-          connection_, &incoming_msg, 1);
-
-      if (num_msgs == 0) {
-        break;
-      }
-
-      if (num_msgs < 0) {
-        std::cout << "WARNING: we failed to get a message from the poll group"
-                  << std::endl;
-      }
-
-      // deserialize the server request
-      MessageTag msg_tag;
-      std::stringstream ss(std::ios::binary | std::ios_base::app |
-                           std::ios_base::in | std::ios_base::out);
-      ss.write((char const *)incoming_msg->m_pData, incoming_msg->m_cbSize);
-      cereal::BinaryInputArchive dearchive(ss);
-      dearchive(msg_tag);
-      if (msg_tag.type == MSG_LOBBY_STATE) {
-        LobbyState lobby_state_msg;
-        dearchive(lobby_state_msg);
-        rooms = std::move(lobby_state_msg.available_rooms);
-      } else if (msg_tag.type == MSG_ROOM_STATE) {
-        RoomState room_state_msg;
-        dearchive(room_state_msg);
-
-        // detect match start to reset game state
-        if (room_state_msg.state == RS_PLAYING &&
-            room_state->state != room_state_msg.state) {
-          resetGameState(game_state);
-        }
-
-        room_state = room_state_msg;
-      } else if (msg_tag.type == MSG_PING) {
-        // just send it right back
-        PingMessage ping_msg;
-        dearchive(ping_msg);
-        sendPing(ping_msg);
-      } else if (msg_tag.type == MSG_GAME_STATE) {
-        GameState game_state_msg;
-        dearchive(game_state_msg);
-        // find the time in our history buffer where this recvd state was
-        // computed from if that state does not match what we recvd, we force
-        // update it and then recompute using future inputs the server
-        // presumably has not consumed yet
-        if (room_state->state == RS_PLAYING) {
-          bool is_recomputing = false;
-          bool found_id = false;
-          GameState running_gamestate;
-          for (std::pair<InputMessage, GameState> &p : input_history) {
-            if (is_recomputing) {
-              updatePlayerState(running_gamestate, p.first, DESIRED_TICK_LENGTH,
-                                room_state->player_index);
-              updateGameState(running_gamestate, DESIRED_TICK_LENGTH);
-              running_gamestate.tick = p.first.tick;
-              p.second = running_gamestate;
-            } else {
-              // find the timestamp where this recv'd state was computed from
-              if (game_state_msg.tick == p.first.tick) {
-                found_id = true;
-                if (game_state_msg != p.second) {
-                  /*
-                  std::cout << "disagreement on tick: " << game_state_msg.tick;
-                  std::cout << " ( " << game_state_msg.ball.pos.x << ", "
-                            << game_state_msg.ball.pos.y << ") vs ";
-                  std::cout << " ( " << p.second.ball.pos.x << ", "
-                            << p.second.ball.pos.y << ")\n";
-                  */
-                  is_recomputing = true;
-                  p.second = game_state_msg;
-                  running_gamestate = game_state_msg;
-                  running_gamestate.tick = p.first.tick;
-                } else {
-                  break;
-                }
-              }
-            }
-          }
-
-          // if we had to recompute, update the master gamestate as well
-          if (is_recomputing) {
-            game_state = input_history.back().second;
-          }
-
-          // if we outran our buffer ...?
-          // FIXME: this can lead to a desync lol
-          if (!found_id) {
-            std::cout << "we didn't find id: " << game_state_msg.tick
-                      << " and we're on id: " << game_state.tick << std::endl;
-          }
-        }
-      } else {
-        std::cout << "WARN: we got an unexpected message type from the server: "
-                  << msg_tag.type << std::endl;
-      }
-
-      incoming_msg->Release();
-    }
-  }
-
-  void runCallbacks() {
-    current_callback_instance_ = this;
-    network_interface_->RunCallbacks();
-  }
-
-  void updateRoomList() {
-    RoomRequest msg;
-    msg.command = RR_LIST_ROOMS;
-    sendRoomRequest(msg);
-  }
-
-  void joinRoom(uint16_t desired_room) {
-    RoomRequest msg;
-    msg.command = RR_JOIN_ROOM;
-    msg.desired_room = desired_room;
-    msg.nickname = nickname;
-    sendRoomRequest(msg);
-  }
-
-  void makeRoom() {
-    RoomRequest msg;
-    msg.command = RR_MAKE_ROOM;
-    msg.nickname = nickname;
-    sendRoomRequest(msg);
-  }
-
-  void saveFrame(InputMessage input) {
-    input_history.push_back(std::make_pair(input, game_state));
-    if (input_history.size() > INPUT_HISTORY_CAPACITY) {
-      input_history.pop_front();
-    }
-  }
-
-  void sendInput(const InputMessage &input) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_CLIENT_INPUT;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(input);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection_, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Unreliable, nullptr);
-  }
-
-  void sendPing(const PingMessage &ping) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_PING;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(ping);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection_, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Reliable, nullptr);
-  }
-
-  void sendRoomRequest(RoomRequest &room_request) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_ROOM_REQUEST;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(room_request);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection_, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Reliable, nullptr);
-  }
-
-  std::vector<int> rooms;
-  bool connected = false;
-  std::optional<RoomState> room_state;
-  GameState game_state;
-  std::string nickname; // FIXME why are there two of these... this is dumb
-  std::deque<std::pair<InputMessage, GameState>> input_history;
-
-private:
-  // singleton-ish structure here s.t we can use C API to call callbacks
-  // not very cool!
-  static Client *current_callback_instance_;
-
-  static void
-  connectionStatusCallback(SteamNetConnectionStatusChangedCallback_t *info) {
-    current_callback_instance_->onConnectionStatusChanged(info);
-  }
-
-  void
-  onConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t *info) {
-    switch (info->m_info.m_eState) {
-    case k_ESteamNetworkingConnectionState_Connected:
-      connected = true;
-      break;
-    case k_ESteamNetworkingConnectionState_ClosedByPeer:
-    case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
-      connected = false;
-      std::cout << "We lost connection the server" << std::endl;
-      exit(1); // TODO: maybe try to gracefully exit back to the title screen
-               // instead of crashing?
-      break;
-    default:
-      break;
-    }
-  }
-
-  ISteamNetworkingSockets *network_interface_ = nullptr;
-  HSteamNetConnection connection_;
-};
-
-Client *Client::current_callback_instance_ = nullptr;
+// fake a worse network than we have, for testing
+static const ImpairmentProfile *net_profile = nullptr;
+
+// the server in server_config.txt if there is one, otherwise ours
+SteamNetworkingIPAddr serverAddress() {
+  SteamNetworkingIPAddr server_address;
+  std::ifstream server_config_file("server_config.txt");
+
+  if (server_config_file.good()) {
+    std::stringstream buffer;
+    buffer << server_config_file.rdbuf();
+    server_address.ParseString(buffer.str().c_str());
+  } else {
+    server_address.ParseString("64.23.207.248:25565");
+  }
+  return server_address;
+}
 
 void DrawTextCentered(const std::string &text, int x, int y, int font_size,
                       Color color) {
@@ -328,11 +82,11 @@ void drawDebugOverlay(const GameState &state, double w_ratio, double h_ratio) {
   char ball_physics[100];
   snprintf(ball_state, 20, "ball_state: %d", state.ball_state);
   snprintf(ball_owner, 20, "ball_owner: %d", state.ball_owner);
-  snprintf(timer, 20, "timer: %f", state.timer);
+  snprintf(timer, 20, "timer: %f", toFloat(state.timer));
   snprintf(can_block, 20, "can_block: %d", state.is_blocking_allowed);
   snprintf(ball_physics, 100, "ball z: %f, vx: %f, vy:%f, vz: %f",
-           state.ball.pos.z, state.ball.vel.x, state.ball.vel.y,
-           state.ball.vel.z);
+           toFloat(state.ball.pos.z), toFloat(state.ball.vel.x),
+           toFloat(state.ball.vel.y), toFloat(state.ball.vel.z));
 
   DrawText(ball_state, (arena_width / 25) * w_ratio, 30 * h_ratio, 10 * h_ratio,
            YELLOW);
@@ -370,8 +124,8 @@ void drawGameState(const GameState &state, double w_ratio, double h_ratio) {
 
   int adjusted_ball_radius =
       (int)(ball_radius + (state.ball.pos.z * Z_TO_SIZE_RATIO)) * w_ratio;
-  DrawCircle(state.ball.pos.x * w_ratio, state.ball.pos.y * h_ratio,
-             adjusted_ball_radius, WHITE);
+  DrawCircle(toFloat(state.ball.pos.x) * w_ratio,
+             toFloat(state.ball.pos.y) * h_ratio, adjusted_ball_radius, WHITE);
 
   Color owner_color;
   switch (state.ball_owner) {
@@ -469,13 +223,81 @@ void drawRoomState(const RoomState &state, double w_ratio, double h_ratio) {
                    10 * h_ratio, WHITE);
 }
 
+void drawInputTiming(const InputTiming &timing, double w_ratio,
+                     double h_ratio) {
+  char lead[60];
+  char counts[60];
+  snprintf(lead, 60, "input lead: %.2f target: %.2f", timing.lead,
+           timing.target_lead);
+  snprintf(counts, 60, "on time: %u late: %u dropped: %u", timing.on_time,
+           timing.late, timing.dropped);
+  DrawText(lead, 12 * (arena_width / 25) * w_ratio, 30 * h_ratio, 10 * h_ratio,
+           YELLOW);
+  DrawText(counts, 12 * (arena_width / 25) * w_ratio, 40 * h_ratio,
+           10 * h_ratio, YELLOW);
+}
+
+void drawRollbackStats(const RollbackStats &stats, double w_ratio,
+                       double h_ratio) {
+  char frame[60];
+  char totals[80];
+  char corrections[80];
+  snprintf(frame, 60, "rollback depth: %u (max %u) resimulated: %u",
+           stats.depth, stats.max_depth, stats.resimulated_ticks);
+  snprintf(totals, 80, "rollbacks: %llu ticks: %llu hard snaps: %llu",
+           (unsigned long long)stats.rollbacks,
+           (unsigned long long)stats.total_resimulated_ticks,
+           (unsigned long long)stats.hard_snaps);
+  snprintf(corrections, 80, "correction: %.1f (max %.1f) input misses: %llu",
+           stats.correction, stats.max_correction,
+           (unsigned long long)stats.input_corrections);
+  DrawText(frame, 12 * (arena_width / 25) * w_ratio, 50 * h_ratio,
+           10 * h_ratio, YELLOW);
+  DrawText(totals, 12 * (arena_width / 25) * w_ratio, 60 * h_ratio,
+           10 * h_ratio, YELLOW);
+  DrawText(corrections, 12 * (arena_width / 25) * w_ratio, 70 * h_ratio,
+           10 * h_ratio, YELLOW);
+}
+
+void drawPlayoutStats(const PlayoutBuffer &buffer, double w_ratio,
+                      double h_ratio) {
+  const PlayoutStats &stats = buffer.stats();
+  char depth[60];
+  char underruns[80];
+  snprintf(depth, 60, "playout delay: %.0f ms depth: %.1f ticks",
+           buffer.delay() * 1000.0, stats.depth);
+  snprintf(underruns, 80, "underruns: %llu holds: %llu resyncs: %llu",
+           (unsigned long long)stats.underruns,
+           (unsigned long long)stats.holds,
+           (unsigned long long)stats.resyncs);
+  DrawText(depth, 12 * (arena_width / 25) * w_ratio, 80 * h_ratio,
+           10 * h_ratio, YELLOW);
+  DrawText(underruns, 12 * (arena_width / 25) * w_ratio, 90 * h_ratio,
+           10 * h_ratio, YELLOW);
+}
+
+void drawSyncStats(const SyncStats &stats, double w_ratio, double h_ratio) {
+  char hashes[80];
+  snprintf(hashes, 80, "state hashes: %llu mismatches: %llu desyncs: %llu",
+           (unsigned long long)stats.hashes,
+           (unsigned long long)stats.mismatches,
+           (unsigned long long)stats.desyncs);
+  DrawText(hashes, 12 * (arena_width / 25) * w_ratio, 100 * h_ratio,
+           10 * h_ratio, YELLOW);
+}
+
 class Game {
 public:
   Game() = default;
   ~Game() { CloseWindow(); }
 
   void start() {
-    client_.start();
+    initNetworking();
+    if (net_profile && !applyImpairment(*net_profile)) {
+      exit(1);
+    }
+    client_.write_desync_dumps = debug_mode;
+    client_.start(serverAddress());
     InitWindow(horizontal_resolution_, vertical_resolution_, "SuperVolleyball");
     SetTargetFPS(144);
     SetExitKey(0);
@@ -492,7 +314,14 @@ public:
     client_.makeRoom();
   }
 
+  // 0 draws everyone from our own prediction
+  void set_playout_delay(double seconds) {
+    client_.playout_buffer.setDelay(seconds);
+  }
+
   void run() {
+    TRACE_THREAD_NAME("main");
+    requestTraceOnSignal();
     auto frame_start = steady_clock::now();
     while (!WindowShouldClose()) {
       delta_time_ =
@@ -501,7 +330,12 @@ public:
       frame_start = steady_clock::now();
 
       BeginDrawing();
-      client_.runCallbacks();
+      Client::runCallbacks();
+      if (client_.lost_connection) {
+        // TODO: maybe try to gracefully exit back to the title screen
+        // instead of crashing?
+        exit(1);
+      }
       client_.processIncomingMessages();
 
       // menu system
@@ -541,6 +375,11 @@ public:
         }
       }
       EndDrawing();
+
+      // F9 saves the last few seconds of frames in a tracing build
+      if (IsKeyReleased(KEY_F9) || traceRequested()) {
+        writeTrace();
+      }
     }
   }
 
@@ -728,32 +567,57 @@ private:
   }
 
   void play_game() {
+    TRACE_SPAN("play_game");
+    // the simulation always steps by DESIRED_TICK_LENGTH, we just take
+    // slightly more or less wall time per tick to hold our input lead
+    double tick_length = client_.tickLength();
+    if (client_.snapped_tick) {
+      tick_ = *client_.snapped_tick + 1;
+      previous_gamestate_ = client_.game_state;
+      client_.snapped_tick = std::nullopt;
+    }
     time_accumulator_ += delta_time_;
-    while (time_accumulator_ >= DESIRED_TICK_LENGTH) {
-      time_accumulator_ -= DESIRED_TICK_LENGTH;
+    while (time_accumulator_ >= tick_length) {
+      time_accumulator_ -= tick_length;
       // store previous
       previous_gamestate_ = client_.game_state;
 
       // input handling
       InputMessage input = getInput(tick_);
-      client_.sendInput(input);
+      client_.queueInput(input);
 
       // game update
-      updatePlayerState(client_.game_state, input, DESIRED_TICK_LENGTH,
-                        client_.room_state->player_index);
-      updateGameState(client_.game_state, DESIRED_TICK_LENGTH);
-      client_.game_state.tick = tick_;
-      client_.saveFrame(input);
+      client_.predictTick(input);
       tick_++;
     }
+    client_.sendInputs();
 
     // interpolate before drawing
-    double a = time_accumulator_ / DESIRED_TICK_LENGTH;
+    double a = time_accumulator_ / tick_length;
     GameState state = interpolate(previous_gamestate_, client_.game_state, a);
+    // the other players are drawn a little in the past from what the server
+    // told us, where they really were, instead of from our guesses
+    GameState remote;
+    if (client_.playout_buffer.delay() > 0.0 &&
+        client_.playout_buffer.sample(delta_time_, remote)) {
+      for (int player = 0; player < PLAYERS_PER_ROOM; player++) {
+        if (player != client_.room_state->player_index) {
+          *playerFromIndex(state, player) = *playerFromIndex(remote, player);
+        }
+      }
+    }
     drawGameState(state, horizontal_resolution_ / arena_width,
                   vertical_resolution_ / arena_height);
     drawRoomState(*client_.room_state, horizontal_resolution_ / arena_width,
                   vertical_resolution_ / arena_height);
+    if (debug_mode && client_.input_timing) {
+      drawInputTiming(*client_.input_timing, w_ratio_, h_ratio_);
+    }
+    if (debug_mode) {
+      drawRollbackStats(client_.rollbackStats(), w_ratio_, h_ratio_);
+      drawPlayoutStats(client_.playout_buffer, w_ratio_, h_ratio_);
+      drawSyncStats(client_.sync_stats, w_ratio_, h_ratio_);
+    }
   }
 };
 
@@ -764,6 +628,7 @@ int main(int argc, char **argv) {
   int curr_arg = 0;
   int room_to_join = -1;
   bool make_room = false;
+  double playout_delay = DEFAULT_PLAYOUT_DELAY;
   while (++curr_arg != argc) {
     if (strcmp(argv[curr_arg], "-c") == 0) {
       make_room = true;
@@ -773,9 +638,26 @@ int main(int argc, char **argv) {
         return 1;
       }
       room_to_join = atoi(argv[curr_arg]);
+    } else if (strcmp(argv[curr_arg], "--playout-delay") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify the playout delay in ms" << std::endl;
+        return 1;
+      }
+      playout_delay = atoi(argv[curr_arg]) / 1000.0;
     } else if (strcmp(argv[curr_arg], "-d") == 0 ||
                strcmp(argv[curr_arg], "--debug") == 0) {
       debug_mode = true;
+    } else if (strcmp(argv[curr_arg], "--net-profile") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify a network profile" << std::endl;
+        return 1;
+      }
+      net_profile = findImpairmentProfile(argv[curr_arg]);
+      if (!net_profile) {
+        std::cerr << "error: network profile must be one of "
+                  << impairmentProfileNames() << std::endl;
+        return 1;
+      }
     } else {
       std::cerr << "unknown argument: " << argv[curr_arg] << std::endl;
       return 1;
@@ -791,6 +673,7 @@ int main(int argc, char **argv) {
 
   Game game;
   game.start();
+  game.set_playout_delay(playout_delay);
   if (room_to_join != -1) {
     game.join_room(room_to_join);
   } else if (make_room) {
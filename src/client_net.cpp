@@ -0,0 +1,443 @@
+#include "client_net.hpp"
+#include <algorithm>
+#include <iostream>
+
+#include "input_lead.hpp"
+#include "state_dump.hpp"
+#include "trace.hpp"
+
+// desyncs we write dumps for, one is usually enough to debug
+constexpr int MAX_DESYNC_DUMPS = 8;
+
+bool initNetworking() {
+  SteamDatagramErrMsg error_msg;
+  if (!GameNetworkingSockets_Init(nullptr, error_msg)) {
+    std::cout
+        << "ERROR: Failed to Intialize Game Networking Sockets because: "
+        << error_msg << std::endl;
+    return false;
+  }
+  return true;
+}
+
+Client::~Client() {
+  if (network_interface_ != nullptr) {
+    network_interface_->CloseConnection(connection_, 0, "Client Exiting",
+                                        true);
+  }
+}
+
+void Client::start(const SteamNetworkingIPAddr &server_address) {
+  network_interface_ = SteamNetworkingSockets();
+  // the connection remembers which client it belongs to, so its status
+  // changes find their way back here
+  SteamNetworkingConfigValue_t opts[2];
+  opts[0].SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged,
+                 (void *)connectionStatusCallback);
+  opts[1].SetInt64(k_ESteamNetworkingConfig_ConnectionUserData,
+                   reinterpret_cast<int64>(this));
+  connection_ = network_interface_->ConnectByIPAddress(server_address, 2, opts);
+  if (connection_ == k_HSteamNetConnection_Invalid) {
+    std::cout << "Server connection parameters were invalid!" << std::endl;
+    lost_connection = true;
+  }
+}
+
+void Client::runCallbacks() { SteamNetworkingSockets()->RunCallbacks(); }
+
+void Client::connectionStatusCallback(
+    SteamNetConnectionStatusChangedCallback_t *info) {
+  Client *client = reinterpret_cast<Client *>(info->m_info.m_nUserData);
+  if (client != nullptr) {
+    client->onConnectionStatusChanged(info);
+  }
+}
+
+void Client::onConnectionStatusChanged(
+    SteamNetConnectionStatusChangedCallback_t *info) {
+  switch (info->m_info.m_eState) {
+  case k_ESteamNetworkingConnectionState_Connected:
+    connected = true;
+    break;
+  case k_ESteamNetworkingConnectionState_ClosedByPeer:
+  case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
+    connected = false;
+    lost_connection = true;
+    if (verbose) {
+      std::cout << "We lost connection the server" << std::endl;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void Client::processIncomingMessages() {
+  TRACE_SPAN("processIncomingMessages");
+  // go through all messages one at a time
+  while (true) {
+    ISteamNetworkingMessage *incoming_msg = nullptr;
+    int num_msgs = network_interface_->ReceiveMessagesOnConnection(
+        connection_, &incoming_msg, 1);
+
+    if (num_msgs == 0) {
+      break;
+    }
+
+    if (num_msgs < 0) {
+      std::cout << "WARNING: we failed to get a message from the poll group"
+                << std::endl;
+      break;
+    }
+    receive_stats.bytes += incoming_msg->m_cbSize;
+
+    // deserialize the server request straight out of the message buffer
+    MessageTag msg_tag;
+    WireReader dearchive(incoming_msg->m_pData, incoming_msg->m_cbSize);
+    dearchive(msg_tag);
+    if (!dearchive.ok()) {
+      std::cout << "WARN: we got a malformed message from the server"
+                << std::endl;
+    } else if (msg_tag.type == MSG_LOBBY_STATE) {
+      LobbyState lobby_state_msg;
+      dearchive(lobby_state_msg);
+      if (dearchive.ok()) {
+        rooms = std::move(lobby_state_msg.available_rooms);
+      }
+    } else if (msg_tag.type == MSG_ROOM_STATE) {
+      RoomState room_state_msg;
+      dearchive(room_state_msg);
+      if (dearchive.ok()) {
+        // detect match start to reset game state
+        if (room_state_msg.state == RS_PLAYING &&
+            (!room_state || room_state->state != room_state_msg.state)) {
+          onMatchStart();
+        }
+
+        room_state = room_state_msg;
+      }
+    } else if (msg_tag.type == MSG_PING) {
+      // just send it right back
+      PingMessage ping_msg;
+      dearchive(ping_msg);
+      if (dearchive.ok()) {
+        sendPing(ping_msg);
+      }
+    } else if (msg_tag.type == MSG_INPUT_TIMING) {
+      InputTiming input_timing_msg;
+      dearchive(input_timing_msg);
+      if (dearchive.ok()) {
+        input_timing = input_timing_msg;
+      }
+    } else if (msg_tag.type == MSG_GAME_STATE) {
+      GameState game_state_msg;
+      InputAcks input_acks;
+      SnapshotDecodeResult result = decodeSnapshot(
+          dearchive, received_snapshots_, game_state_msg, input_acks);
+      if (result != SNAPSHOT_MALFORMED) {
+        onInputAck(input_acks);
+      }
+      if (result == SNAPSHOT_OK) {
+        onSnapshot(game_state_msg);
+      } else if (result == SNAPSHOT_MISSING_BASELINE) {
+        // we can't rebuild this one, ask for full snapshots again
+        need_full_snapshot_ = true;
+      }
+    } else if (msg_tag.type == MSG_STATE_HASH) {
+      StateHashPacket state_hash;
+      dearchive(state_hash);
+      if (dearchive.ok()) {
+        onInputAck(state_hash.input_acks);
+        onStateHash(state_hash);
+      }
+    } else if (msg_tag.type == MSG_REMOTE_INPUTS) {
+      RemoteInputs remote_inputs;
+      dearchive(remote_inputs);
+      if (dearchive.ok()) {
+        onRemoteInputs(remote_inputs);
+      }
+    } else {
+      std::cout << "WARN: we got an unexpected message type from the server: "
+                << msg_tag.type << std::endl;
+    }
+
+    incoming_msg->Release();
+  }
+
+  reconcile();
+  sendSnapshotAck();
+}
+
+// a new match, nothing from the last one carries over
+void Client::onMatchStart() {
+  resetGameState(game_state);
+  prediction_history_.clear();
+  pending_snapshot_ = std::nullopt;
+  playout_buffer.clear();
+  received_snapshots_.clear();
+  newest_snapshot_tick_ = std::nullopt;
+  acked_snapshot_tick_ = std::nullopt;
+  pending_state_hash_ = std::nullopt;
+  in_sync_ = false;
+  acked_in_sync_ = std::nullopt;
+  check_next_snapshot_ = false;
+  sync_stats = {};
+  receive_stats = {};
+  unacked_inputs_.clear();
+  input_timing = std::nullopt;
+}
+
+// let the server know what it can delta encode against
+// and whether it can send us hashes instead
+void Client::sendSnapshotAck() {
+  SnapshotAck ack;
+  ack.in_sync = in_sync_;
+  if (need_full_snapshot_) {
+    ack.reset = true;
+    need_full_snapshot_ = false;
+  } else if (newest_snapshot_tick_ &&
+             (newest_snapshot_tick_ != acked_snapshot_tick_ ||
+              in_sync_ != acked_in_sync_)) {
+    ack.tick = *newest_snapshot_tick_;
+    acked_snapshot_tick_ = newest_snapshot_tick_;
+  } else {
+    return;
+  }
+  acked_in_sync_ = in_sync_;
+  sendMessage(network_interface_, connection_, MSG_SNAPSHOT_ACK, ack,
+              k_nSteamNetworkingSend_Unreliable);
+}
+
+void Client::onSnapshot(const GameState &game_state_msg) {
+  receive_stats.snapshots++;
+  receivedTick(game_state_msg.tick);
+  received_snapshots_.store(game_state_msg);
+  if (room_state && room_state->state == RS_PLAYING) {
+    playout_buffer.push(game_state_msg);
+  }
+  // snapshots can arrive out of order, only the newest is worth
+  // reconciling with
+  if (newest_snapshot_tick_ && game_state_msg.tick <= *newest_snapshot_tick_) {
+    return;
+  }
+  newest_snapshot_tick_ = game_state_msg.tick;
+  if (room_state && room_state->state == RS_PLAYING) {
+    pending_snapshot_ = game_state_msg;
+  }
+}
+
+void Client::onStateHash(const StateHashPacket &state_hash) {
+  receive_stats.state_hashes++;
+  receivedTick(state_hash.tick);
+  if (!room_state || room_state->state != RS_PLAYING ||
+      (pending_state_hash_ && state_hash.tick <= pending_state_hash_->tick)) {
+    return;
+  }
+  pending_state_hash_ = state_hash;
+}
+
+void Client::receivedTick(uint32_t tick) {
+  if (!receive_stats.newest_tick || tick > *receive_stats.newest_tick) {
+    receive_stats.newest_tick = tick;
+  }
+}
+
+// another player's inputs, the ones the server is going to simulate
+void Client::onRemoteInputs(const RemoteInputs &remote_inputs) {
+  if (!room_state || room_state->state != RS_PLAYING ||
+      remote_inputs.player >= PLAYERS_PER_ROOM ||
+      remote_inputs.player == room_state->player_index) {
+    return;
+  }
+  for (size_t i = 0; i < remote_inputs.packet.count; i++) {
+    prediction_history_.confirmInput(remote_inputs.player,
+                                     remote_inputs.packet.inputs[i]);
+  }
+}
+
+// reconcile our prediction with the newest snapshot that came in this
+// frame. if it disagrees with what we predicted for its tick we roll back
+// to it and simulate our newer ticks again. then catch up on remote inputs
+// that turned out different from our guess, and check the newest state
+// hash against what we have now
+void Client::reconcile() {
+  TRACE_SPAN("rollback");
+  prediction_history_.beginFrame();
+  if (pending_snapshot_) {
+    GameState snapshot = *pending_snapshot_;
+    pending_snapshot_ = std::nullopt;
+    checkSnapshot(snapshot);
+    if (prediction_history_.reconcile(snapshot, game_state) ==
+        RECONCILE_MISSING) {
+      hardSnap(snapshot);
+    }
+  }
+  prediction_history_.resimulate(game_state);
+  if (pending_state_hash_) {
+    checkStateHash(*pending_state_hash_);
+    pending_state_hash_ = std::nullopt;
+  }
+}
+
+// we're in sync for as long as what we predict hashes the same as the
+// server's state, the hash is all the server has to send us until then
+void Client::checkSnapshot(const GameState &snapshot) {
+  const GameState *predicted = prediction_history_.stateAt(snapshot.tick);
+  in_sync_ = predicted != nullptr &&
+             hashGameState(*predicted) == hashGameState(snapshot);
+  if (!in_sync_ && predicted != nullptr && check_next_snapshot_) {
+    reportDesync(*predicted, snapshot);
+  }
+  check_next_snapshot_ = false;
+}
+
+void Client::checkStateHash(const StateHashPacket &state_hash) {
+  const GameState *predicted = prediction_history_.stateAt(state_hash.tick);
+  sync_stats.hashes++;
+  if (predicted != nullptr && hashGameState(*predicted) == state_hash.hash) {
+    // the server is drawing from the same state we are, so that's what
+    // goes into the playout buffer now that snapshots stopped
+    in_sync_ = true;
+    playout_buffer.push(*predicted);
+    return;
+  }
+  // back to snapshots until we match again, the next one shows where we
+  // went wrong. ack again even if we already said so, it may have been lost
+  sync_stats.mismatches++;
+  in_sync_ = false;
+  acked_in_sync_ = std::nullopt;
+  check_next_snapshot_ = true;
+}
+
+void Client::reportDesync(const GameState &predicted, const GameState &server) {
+  sync_stats.desyncs++;
+  const GameStateField *field = firstDivergingField(predicted, server);
+  if (field == nullptr) {
+    return; // a hash collision, nothing to see on the wire
+  }
+  if (!verbose) {
+    return;
+  }
+  std::cout << "WARN: we desynced from the server on tick " << server.tick
+            << ", first at " << field->name << ": we have "
+            << fieldValue(*field, predicted) << ", the server has "
+            << fieldValue(*field, server) << std::endl;
+  if (!write_desync_dumps || desync_dumps_ >= MAX_DESYNC_DUMPS) {
+    return;
+  }
+  desync_dumps_++;
+  std::string prefix = "desync_" + std::to_string(server.tick);
+  if (writeStateDump(prefix + "_client.state", predicted) &&
+      writeStateDump(prefix + "_server.state", server)) {
+    std::cout << "wrote " << prefix << "_client.state and " << prefix
+              << "_server.state, compare them with svb_statediff"
+              << std::endl;
+  }
+}
+
+// we have nothing to roll back to, either the server got ahead of us or
+// we got further ahead of it than we keep history for. take its state as
+// is and predict forward from there
+void Client::hardSnap(const GameState &snapshot) {
+  if (verbose) {
+    std::cout << "WARN: no prediction for tick " << snapshot.tick
+              << ", we're on tick " << game_state.tick
+              << ". snapping to the server's state" << std::endl;
+  }
+  game_state = snapshot;
+  prediction_history_.restart(snapshot);
+  in_sync_ = false;
+  snapped_tick = snapshot.tick;
+  // they're for ticks we're not going to send from now on, and a packet
+  // only carries a run of consecutive ticks
+  unacked_inputs_.clear();
+  has_new_input_ = false;
+}
+
+double Client::tickLength() const {
+  if (!input_timing) {
+    return DESIRED_TICK_LENGTH;
+  }
+  return adjustedTickLength(input_timing->lead, input_timing->target_lead);
+}
+
+void Client::updateRoomList() {
+  RoomRequest msg;
+  msg.command = RR_LIST_ROOMS;
+  sendRoomRequest(msg);
+}
+
+void Client::joinRoom(uint16_t desired_room) {
+  RoomRequest msg;
+  msg.command = RR_JOIN_ROOM;
+  msg.desired_room = desired_room;
+  msg.nickname = nickname;
+  sendRoomRequest(msg);
+}
+
+void Client::makeRoom() {
+  RoomRequest msg;
+  msg.command = RR_MAKE_ROOM;
+  msg.nickname = nickname;
+  sendRoomRequest(msg);
+}
+
+void Client::predictTick(const InputMessage &input) {
+  uint8_t local_player = room_state->player_index;
+  TickInputs inputs = prediction_history_.predictInputs(input, local_player);
+  for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    updatePlayerState(game_state, inputs[player], DESIRED_TICK_LENGTH,
+                      player);
+  }
+  updateGameState(game_state, DESIRED_TICK_LENGTH);
+  game_state.tick = input.tick;
+  prediction_history_.save(inputs, game_state);
+}
+
+void Client::queueInput(const InputMessage &input) {
+  // a packet numbers its inputs from the first one's tick, so anything not
+  // right before this one can't go in the same packet
+  if (!unacked_inputs_.empty() &&
+      input.tick != unacked_inputs_.back().tick + 1) {
+    unacked_inputs_.clear();
+  }
+  unacked_inputs_.push_back(input);
+  if (unacked_inputs_.size() > MAX_INPUTS_PER_PACKET) {
+    unacked_inputs_.pop_front();
+  }
+  has_new_input_ = true;
+}
+
+void Client::sendInputs() {
+  if (!has_new_input_ || unacked_inputs_.empty()) {
+    return;
+  }
+  has_new_input_ = false;
+  InputPacket packet;
+  packet.count = unacked_inputs_.size();
+  std::copy(unacked_inputs_.begin(), unacked_inputs_.end(),
+            packet.inputs.begin());
+  sendMessage(network_interface_, connection_, MSG_CLIENT_INPUT, packet,
+              k_nSteamNetworkingSend_Unreliable);
+}
+
+void Client::onInputAck(const InputAcks &input_acks) {
+  if (!room_state || room_state->player_index < 0 ||
+      room_state->player_index >= PLAYERS_PER_ROOM) {
+    return;
+  }
+  uint32_t tag = input_acks[room_state->player_index];
+  while (!unacked_inputs_.empty() && unacked_inputs_.front().tick < tag) {
+    unacked_inputs_.pop_front();
+  }
+}
+
+void Client::sendPing(const PingMessage &ping) {
+  sendMessage(network_interface_, connection_, MSG_PING, ping,
+              k_nSteamNetworkingSend_Reliable);
+}
+
+void Client::sendRoomRequest(RoomRequest &room_request) {
+  sendMessage(network_interface_, connection_, MSG_ROOM_REQUEST, room_request,
+              k_nSteamNetworkingSend_Reliable);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <deque>
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <steam/isteamnetworkingutils.h>
+#include <steam/steamnetworkingsockets.h>
+
+#include "game_state.hpp"
+#include "net_message.hpp"
+#include "playout_buffer.hpp"
+#include "prediction_history.hpp"
+#include "snapshot_delta.hpp"
+
+// how often the server's state hashes agreed with us, for the debug overlay
+struct SyncStats {
+  uint64_t hashes = 0;
+  uint64_t mismatches = 0;
+  // snapshots after a mismatch that still disagreed with our prediction
+  uint64_t desyncs = 0;
+};
+
+// what the server has been sending us during the current match
+struct ReceiveStats {
+  uint64_t snapshots = 0;
+  uint64_t state_hashes = 0;
+  uint64_t bytes = 0;
+  // newest tick a snapshot or a state hash was for
+  std::optional<uint32_t> newest_tick;
+};
+
+// once per process, before any client starts
+bool initNetworking();
+
+// A connection to the server and everything we predict on top of it: the
+// rooms, our inputs, rollback against snapshots and state hashes. Draws
+// nothing, the game and the load testing bot both drive it once per frame.
+// Any number of them can share a process.
+class Client {
+public:
+  Client() = default;
+  ~Client();
+  // the connection points back at us
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  void start(const SteamNetworkingIPAddr &server_address);
+
+  // status changes of every client in the process
+  static void runCallbacks();
+
+  void processIncomingMessages();
+
+  // run our ticks a little fast or slow so our inputs reach the server as far
+  // ahead as it asked for
+  double tickLength() const;
+
+  void updateRoomList();
+  void joinRoom(uint16_t desired_room);
+  void makeRoom();
+
+  // run one tick of our prediction. our own input is known, the others are
+  // whatever we know or guess about theirs
+  void predictTick(const InputMessage &input);
+
+  // inputs are held until the server acks them, and every packet repeats the
+  // newest ones that are still unacked. if one is lost the next carries it
+  void queueInput(const InputMessage &input);
+  // one packet per frame that ran a tick, no matter how many it ran
+  void sendInputs();
+
+  const RollbackStats &rollbackStats() const {
+    return prediction_history_.stats();
+  }
+
+  std::vector<int> rooms;
+  bool connected = false;
+  // set once the server closed on us or we couldn't reach it
+  bool lost_connection = false;
+  std::optional<RoomState> room_state;
+  std::optional<InputTiming> input_timing;
+  GameState game_state;
+  std::string nickname; // FIXME why are there two of these... this is dumb
+  // snapshots to draw the other players from
+  PlayoutBuffer playout_buffer;
+  // set when we had to throw our prediction away, prediction carries on from
+  // the tick after this one
+  std::optional<uint32_t> snapped_tick;
+  SyncStats sync_stats;
+  ReceiveStats receive_stats;
+  // write our prediction and the server's state out when we desync
+  bool write_desync_dumps = false;
+  // say so when something goes wrong, a thousand bots would drown the log
+  bool verbose = true;
+
+private:
+  static void
+  connectionStatusCallback(SteamNetConnectionStatusChangedCallback_t *info);
+  void
+  onConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t *info);
+
+  void sendSnapshotAck();
+  void onSnapshot(const GameState &game_state_msg);
+  void onStateHash(const StateHashPacket &state_hash);
+  void receivedTick(uint32_t tick);
+  void onRemoteInputs(const RemoteInputs &remote_inputs);
+  void onInputAck(const InputAcks &input_acks);
+  void onMatchStart();
+  void reconcile();
+  void checkSnapshot(const GameState &snapshot);
+  void checkStateHash(const StateHashPacket &state_hash);
+  void reportDesync(const GameState &predicted, const GameState &server);
+  void hardSnap(const GameState &snapshot);
+  void sendPing(const PingMessage &ping);
+  void sendRoomRequest(RoomRequest &room_request);
+
+  ISteamNetworkingSockets *network_interface_ = nullptr;
+  HSteamNetConnection connection_ = k_HSteamNetConnection_Invalid;
+
+  // authoritative snapshots, kept around as delta baselines
+  SnapshotHistory received_snapshots_;
+  std::optional<uint32_t> newest_snapshot_tick_;
+  std::optional<uint32_t> acked_snapshot_tick_;
+  bool need_full_snapshot_ = false;
+
+  // our inputs and what we predicted from them, to roll back into
+  PredictionHistory prediction_history_;
+  std::optional<GameState> pending_snapshot_; // newest one this frame
+
+  // state hashes the server sends instead of snapshots while we keep up
+  std::optional<StateHashPacket> pending_state_hash_; // newest this frame
+  bool in_sync_ = false;
+  std::optional<bool> acked_in_sync_;
+  // a hash disagreed, compare the next snapshot field by field
+  bool check_next_snapshot_ = false;
+  int desync_dumps_ = 0;
+
+  // newest inputs the server hasn't acked, oldest first, always for
+  // consecutive ticks
+  std::deque<InputMessage> unacked_inputs_;
+  bool has_new_input_ = false;
+};
@@ -1,9 +1,45 @@
 #include "game_state.hpp"
+#include "match_rng.hpp"
+#include "trace.hpp"
 #include <algorithm>
 #include <math.h>
-#include <random>
 
-Vec3 interpolate(Vec3 &previous, Vec3 &next, double a) {
+#define GAME_STATE_FIELD(field, kind)                                          \
+  GameStateField {                                                             \
+    offsetof(GameState, field), sizeof(GameState::field), kind, #field         \
+  }
+#define PHYSICS_STATE_FIELDS(physics)                                          \
+  GAME_STATE_FIELD(physics.pos.x, FIELD_POS_X),                                \
+      GAME_STATE_FIELD(physics.pos.y, FIELD_POS_Y),                            \
+      GAME_STATE_FIELD(physics.pos.z, FIELD_POS_Z),                            \
+      GAME_STATE_FIELD(physics.vel.x, FIELD_VEL),                              \
+      GAME_STATE_FIELD(physics.vel.y, FIELD_VEL),                              \
+      GAME_STATE_FIELD(physics.vel.z, FIELD_VEL),                              \
+      GAME_STATE_FIELD(physics.jump_cooldown, FIELD_TIME)
+
+const std::array<GameStateField, NUM_GAME_STATE_FIELDS> GAME_STATE_FIELDS = {
+    PHYSICS_STATE_FIELDS(p1),
+    PHYSICS_STATE_FIELDS(p2),
+    PHYSICS_STATE_FIELDS(p3),
+    PHYSICS_STATE_FIELDS(p4),
+    PHYSICS_STATE_FIELDS(ball),
+    PHYSICS_STATE_FIELDS(target),
+    PHYSICS_STATE_FIELDS(landing_zone),
+    GAME_STATE_FIELD(team1_score, FIELD_SCORE),
+    GAME_STATE_FIELD(team2_score, FIELD_SCORE),
+    GAME_STATE_FIELD(team1_points_to_give, FIELD_SCORE),
+    GAME_STATE_FIELD(team2_points_to_give, FIELD_SCORE),
+    GAME_STATE_FIELD(tick, FIELD_TICK),
+    GAME_STATE_FIELD(ball_state, FIELD_BALL_STATE),
+    GAME_STATE_FIELD(last_server, FIELD_PLAYER_SLOT),
+    GAME_STATE_FIELD(ball_owner, FIELD_BALL_OWNER),
+    GAME_STATE_FIELD(can_owner_move, FIELD_FLAG),
+    GAME_STATE_FIELD(is_blocking_allowed, FIELD_FLAG),
+    GAME_STATE_FIELD(timer, FIELD_TIME),
+    GAME_STATE_FIELD(rng_seed, FIELD_SEED),
+};
+
+Vec3 interpolate(const Vec3 &previous, const Vec3 &next, double a) {
   Vec3 ret;
   ret.x = next.x * a + previous.x * (1.0 - a);
   ret.y = next.y * a + previous.y * (1.0 - a);
@@ -11,14 +47,18 @@ Vec3 interpolate(Vec3 &previous, Vec3 &next, double a) {
   return ret;
 }
 
-PhysicsState interpolate(PhysicsState &previous, PhysicsState &next, double a) {
+PhysicsState interpolate(const PhysicsState &previous,
+                         const PhysicsState &next, double a) {
   PhysicsState ret;
   ret.vel = interpolate(previous.vel, next.vel, a);
   ret.pos = interpolate(previous.pos, next.pos, a);
+  ret.jump_cooldown =
+      next.jump_cooldown * a + previous.jump_cooldown * (1.0 - a);
   return ret;
 }
 
-GameState interpolate(GameState &previous, GameState &next, double a) {
+GameState interpolate(const GameState &previous, const GameState &next,
+                      double a) {
   GameState ret;
   ret.p1 = interpolate(previous.p1, next.p1, a);
   ret.p2 = interpolate(previous.p2, next.p2, a);
@@ -30,18 +70,38 @@ GameState interpolate(GameState &previous, GameState &next, double a) {
 
   ret.timer = next.timer * a + previous.timer * (1.0 - a);
 
-  // things that should just snap to previous
-  ret.team1_score = previous.team1_score;
-  ret.team2_score = previous.team2_score;
-  ret.team1_points_to_give = previous.team1_points_to_give;
-  ret.team2_points_to_give = previous.team2_points_to_give;
-  ret.tick = previous.tick;
-
-  ret.ball_state = previous.ball_state;
-  ret.last_server = previous.last_server;
-  ret.ball_owner = previous.ball_owner;
-  ret.can_owner_move = previous.can_owner_move;
-  ret.is_blocking_allowed = previous.is_blocking_allowed;
+  // things that can't be blended snap to whichever state is closer, so they
+  // change halfway through like everything else does
+  const GameState &nearest = a < 0.5 ? previous : next;
+  ret.team1_score = nearest.team1_score;
+  ret.team2_score = nearest.team2_score;
+  ret.team1_points_to_give = nearest.team1_points_to_give;
+  ret.team2_points_to_give = nearest.team2_points_to_give;
+  ret.tick = nearest.tick;
+
+  ret.ball_state = nearest.ball_state;
+  ret.last_server = nearest.last_server;
+  ret.ball_owner = nearest.ball_owner;
+  ret.can_owner_move = nearest.can_owner_move;
+  ret.is_blocking_allowed = nearest.is_blocking_allowed;
+  ret.rng_seed = nearest.rng_seed;
+  return ret;
+}
+
+PhysicsState extrapolate(const PhysicsState &state, double seconds) {
+  PhysicsState ret = state;
+  ret.pos = state.pos + state.vel * seconds;
+  return ret;
+}
+
+GameState extrapolate(const GameState &state, double seconds) {
+  GameState ret = state;
+  ret.p1 = extrapolate(state.p1, seconds);
+  ret.p2 = extrapolate(state.p2, seconds);
+  ret.p3 = extrapolate(state.p3, seconds);
+  ret.p4 = extrapolate(state.p4, seconds);
+  ret.ball = extrapolate(state.ball, seconds);
+  ret.target = extrapolate(state.target, seconds);
   return ret;
 }
 
@@ -69,9 +129,9 @@ PhysicsState *playerFromIndex(GameState &state, int idx) {
 // desired_time = xy_distance / xy_speed
 // speed = state.ball_state.z / (xy_distance / xy_speed)
 void sendBallDownToTarget(GameState &state, const Vec3 &target,
-                          const float speed) {
+                          const Scalar speed) {
   Vec3 to_target = state.ball.pos - target;
-  float magnitude = to_target.magnitude2D();
+  Scalar magnitude = to_target.magnitude2D();
   if (magnitude > 0.01) {
     to_target.x /= magnitude;
     to_target.y /= magnitude;
@@ -83,13 +143,14 @@ void sendBallDownToTarget(GameState &state, const Vec3 &target,
 
 void passBallToTarget(GameState &state, const Vec3 &target) {
   Vec3 to_target = state.ball.pos - target;
-  float magnitude = to_target.magnitude2D();
+  Scalar magnitude = to_target.magnitude2D();
   if (magnitude > 0.01) {
     to_target.x /= magnitude;
     to_target.y /= magnitude;
   }
-  float desired_xy_speed = magnitude / ball_passing_time;
-  float desired_z_speed = (ball_max_passing_height / ball_passing_time) * 2.0;
+  Scalar desired_xy_speed = magnitude / ball_passing_time;
+  Scalar desired_z_speed =
+      (Scalar(ball_max_passing_height) / ball_passing_time) * 2.0;
   to_target.x *= desired_xy_speed;
   to_target.y *= desired_xy_speed;
   to_target.z = desired_z_speed;
@@ -98,9 +159,9 @@ void passBallToTarget(GameState &state, const Vec3 &target) {
 }
 
 void sendBallUpToTarget(GameState &state, const Vec3 &target,
-                        const float speed) {
+                        const Scalar speed) {
   Vec3 to_target = state.ball.pos - target;
-  float magnitude = to_target.magnitude2D();
+  Scalar magnitude = to_target.magnitude2D();
   if (magnitude > 0.01) {
     to_target.x /= magnitude;
     to_target.y /= magnitude;
@@ -159,28 +220,30 @@ void givePlayerPoints(GameState &state, int points, int player_idx) {
   }
 }
 
-Vec3 movePositionRandomly(const Vec3 &pos, float min, float max, uint32_t tick,
+Vec3 movePositionRandomly(const Vec3 &pos, float min, float max,
+                          const GameState &state, RandomSite site,
                           int player_idx) {
-  auto rand = std::mt19937_64();
-  rand.seed(tick);
-  float dx = (std::generate_canonical<float, 128>(rand) *
-              (passing_max_dist - passing_min_dist)) +
-             passing_min_dist;
-  float dy = std::generate_canonical<float, 128>(rand) * passing_max_dist;
+  Scalar dx =
+      (randomUnit(matchRandom(state.rng_seed, state.tick, site, 0)) *
+       (passing_max_dist - passing_min_dist)) +
+      passing_min_dist;
+  Scalar dy = randomUnit(matchRandom(state.rng_seed, state.tick, site, 1)) *
+              passing_max_dist;
   Vec3 pass_target = pos;
   pass_target.x += dx;
   pass_target.y += dy;
 
   if (player_idx == 0 || player_idx == 1 || player_idx == -2 ||
       player_idx == -3) {
-    pass_target.x =
-        std::clamp(pass_target.x, 0.0f, arena_width / 2.0f - paddle_width);
+    pass_target.x = std::clamp<Scalar>(pass_target.x, 0.0f,
+                                       arena_width / 2.0f - paddle_width);
   } else {
-    pass_target.x =
-        std::clamp(pass_target.x, (arena_width / 2.0f) + center_line_width,
-                   arena_width - paddle_width);
+    pass_target.x = std::clamp<Scalar>(
+        pass_target.x, (arena_width / 2.0f) + center_line_width,
+        arena_width - paddle_width);
   }
-  pass_target.y = std::clamp(pass_target.y, 0.0f, arena_height - paddle_height);
+  pass_target.y =
+      std::clamp<Scalar>(pass_target.y, 0.0f, arena_height - paddle_height);
   return pass_target;
 }
 
@@ -191,7 +254,7 @@ bool playerBallInCollision(const Vec3 &ball_pos, const Vec3 &player_pos) {
 }
 
 bool playerCanReachUpToBall(const Vec3 &ball_pos, const Vec3 &player_pos) {
-  return std::abs(ball_pos.z - player_pos.z) < hitting_max_z_dist;
+  return scalarAbs(ball_pos.z - player_pos.z) < hitting_max_z_dist;
 }
 
 void resetGameState(GameState &state) {
@@ -338,6 +401,7 @@ void resetRound(GameState &state) {
 
 void updatePlayerState(GameState &state, const InputMessage &input,
                        const double delta_time, uint8_t player) {
+  TRACE_SPAN("updatePlayerState");
   PhysicsState *paddle = playerFromIndex(state, player);
   bool is_owner = state.ball_owner == player + 1;
 
@@ -366,7 +430,7 @@ void updatePlayerState(GameState &state, const InputMessage &input,
     }
 
     paddle->jump_cooldown -= delta_time;
-    paddle->jump_cooldown = std::max(paddle->jump_cooldown, 0.0f);
+    paddle->jump_cooldown = std::max<Scalar>(paddle->jump_cooldown, 0.0f);
 
     if (paddle->pos.z >= jump_height) {
       paddle->vel.z = -jump_speed / 1.5;
@@ -378,7 +442,7 @@ void updatePlayerState(GameState &state, const InputMessage &input,
     }
 
     // normalize velocity
-    float magnitude = paddle->vel.magnitude2D();
+    Scalar magnitude = paddle->vel.magnitude2D();
     if (magnitude > 0.01) {
       paddle->vel.x = (paddle->vel.x / magnitude) * paddle_speed;
       paddle->vel.y = (paddle->vel.y / magnitude) * paddle_speed;
@@ -389,8 +453,8 @@ void updatePlayerState(GameState &state, const InputMessage &input,
       paddle->pos.y += paddle->vel.y * delta_time;
     }
 
-    paddle->pos.y =
-        std::clamp(paddle->pos.y, 0.0f, arena_height - paddle_height);
+    paddle->pos.y = std::clamp<Scalar>(paddle->pos.y, 0.0f,
+                                       arena_height - paddle_height);
   }
 
   // target movement code
@@ -420,8 +484,7 @@ void updatePlayerState(GameState &state, const InputMessage &input,
     }
 
     // normalize velocity
-    float magnitude = std::sqrt((state.target.vel.x * state.target.vel.x) +
-                                (state.target.vel.y * state.target.vel.y));
+    Scalar magnitude = length2D(state.target.vel.x, state.target.vel.y);
     if (magnitude > 0.01) {
       state.target.vel.x = (state.target.vel.x / magnitude) * target_speed;
       state.target.vel.y = (state.target.vel.y / magnitude) * target_speed;
@@ -431,16 +494,16 @@ void updatePlayerState(GameState &state, const InputMessage &input,
     state.target.pos.y += state.target.vel.y * delta_time;
 
     if (player == 0 || player == 1) {
-      state.target.pos.x = std::clamp(state.target.pos.x,
-                                      (arena_width / 2.0f) + center_line_width,
-                                      arena_width - paddle_width);
+      state.target.pos.x = std::clamp<Scalar>(
+          state.target.pos.x, (arena_width / 2.0f) + center_line_width,
+          arena_width - paddle_width);
     } else {
-      state.target.pos.x = std::clamp(state.target.pos.x, 0.0f,
-                                      arena_width / 2.0f - paddle_width);
+      state.target.pos.x = std::clamp<Scalar>(
+          state.target.pos.x, 0.0f, arena_width / 2.0f - paddle_width);
     }
-    state.target.pos.y =
-        std::clamp(state.target.pos.y, 0.0f, arena_height - target_radius);
-    state.target.pos.z = std::max(0.0f, state.target.pos.z);
+    state.target.pos.y = std::clamp<Scalar>(state.target.pos.y, 0.0f,
+                                            arena_height - target_radius);
+    state.target.pos.z = std::max<Scalar>(0.0f, state.target.pos.z);
   }
 
   // ball_owner is 1 indexed and 0 is N/A; player is 0  indexed
@@ -483,9 +546,9 @@ void updatePlayerState(GameState &state, const InputMessage &input,
         state.ball_state = BALL_STATE_SECOND_PASS;
         state.ball_owner = teammate_idx + 1; // ball_owner is 1 indexed
         // add randomness to the pass
-        Vec3 pass_target =
-            movePositionRandomly(teammate->pos, passing_min_dist,
-                                 passing_max_dist, state.tick, player);
+        Vec3 pass_target = movePositionRandomly(
+            teammate->pos, passing_min_dist, passing_max_dist, state,
+            RANDOM_SECOND_PASS, player);
         passBallToTarget(state, pass_target);
         state.landing_zone.pos = pass_target;
 
@@ -509,7 +572,8 @@ void updatePlayerState(GameState &state, const InputMessage &input,
           int tmp_player = player == 0 ? -1 : -player;
           state.target.pos =
               movePositionRandomly(state.target.pos, bumping_xy_penalty,
-                                   -bumping_xy_penalty, state.tick, tmp_player);
+                                   -bumping_xy_penalty, state, RANDOM_BUMP,
+                                   tmp_player);
           state.ball_state = BALL_STATE_TRAVELLING;
           state.ball_owner = -player; // negative values denote prev owner
           state.landing_zone.pos = state.target.pos;
@@ -531,14 +595,14 @@ void updatePlayerState(GameState &state, const InputMessage &input,
       if (state.is_blocking_allowed &&
           (state.ball.pos - paddle->pos).magnitude2D() <
               ball_radius + paddle_width &&
-          std::abs(paddle->pos.x - (arena_width / 2.0f)) <
+          scalarAbs(paddle->pos.x - (arena_width / 2.0f)) <
               blocking_max_dist_from_center &&
           paddle->pos.z >= blocking_min_height && state.ball_owner != -player &&
           state.ball_owner != -getTeammateIdx(player)) {
         state.target.pos = centerOfOpposingCourt(player);
         Vec3 down_target = movePositionRandomly(
-            state.target.pos, passing_min_dist, passing_max_dist, state.tick,
-            -state.ball_owner);
+            state.target.pos, passing_min_dist, passing_max_dist, state,
+            RANDOM_BLOCK, -state.ball_owner);
         sendBallDownToTarget(state, down_target, ball_blocked_speed);
         state.target.pos = down_target;
         state.landing_zone.pos = down_target;
@@ -554,31 +618,32 @@ void updatePlayerState(GameState &state, const InputMessage &input,
 
         PhysicsState *teammate = playerFromIndex(state, teammate_idx);
         // add some randomness to this pass
-        Vec3 pass_target =
-            movePositionRandomly(teammate->pos, passing_min_dist,
-                                 passing_max_dist, state.tick, player);
+        Vec3 pass_target = movePositionRandomly(
+            teammate->pos, passing_min_dist, passing_max_dist, state,
+            RANDOM_FIRST_PASS, player);
         passBallToTarget(state, pass_target);
         state.landing_zone.pos = pass_target;
       }
     }
   } // END NON-OWNER LOGIC
   paddle->pos.z += paddle->vel.z * delta_time;
-  paddle->pos.z = std::max(0.0f, paddle->pos.z);
+  paddle->pos.z = std::max<Scalar>(0.0f, paddle->pos.z);
 }
 
 void updateGameState(GameState &state, double delta_time) {
+  TRACE_SPAN("updateGameState");
 
   // clamp x direction
-  state.p1.pos.x =
-      std::clamp(state.p1.pos.x, 0.0f, arena_width / 2.0f - paddle_width);
-  state.p2.pos.x =
-      std::clamp(state.p2.pos.x, 0.0f, arena_width / 2.0f - paddle_width);
-  state.p3.pos.x =
-      std::clamp(state.p3.pos.x, (arena_width / 2.0f) + center_line_width,
-                 arena_width - paddle_width);
-  state.p4.pos.x =
-      std::clamp(state.p4.pos.x, (arena_width / 2.0f) + center_line_width,
-                 arena_width - paddle_width);
+  state.p1.pos.x = std::clamp<Scalar>(state.p1.pos.x, 0.0f,
+                                      arena_width / 2.0f - paddle_width);
+  state.p2.pos.x = std::clamp<Scalar>(state.p2.pos.x, 0.0f,
+                                      arena_width / 2.0f - paddle_width);
+  state.p3.pos.x = std::clamp<Scalar>(
+      state.p3.pos.x, (arena_width / 2.0f) + center_line_width,
+      arena_width - paddle_width);
+  state.p4.pos.x = std::clamp<Scalar>(
+      state.p4.pos.x, (arena_width / 2.0f) + center_line_width,
+      arena_width - paddle_width);
 
   // BALL STATE MACHINE
   if (state.ball_state == BALL_STATE_IN_SERVICE) {
@@ -633,5 +698,5 @@ void updateGameState(GameState &state, double delta_time) {
   state.ball.pos.x += state.ball.vel.x * delta_time;
   state.ball.pos.y += state.ball.vel.y * delta_time;
   state.ball.pos.z += state.ball.vel.z * delta_time;
-  state.ball.pos.z = std::max(state.ball.pos.z, 0.0f);
+  state.ball.pos.z = std::max<Scalar>(state.ball.pos.z, 0.0f);
 }
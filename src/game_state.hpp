@@ -1,9 +1,12 @@
 #pragma once
 #include "network_signals.hpp"
-#include <cereal/archives/binary.hpp>
+#include "scalar.hpp"
+#include <array>
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// rooms a server has unless started with --max-rooms
 constexpr size_t MAX_ROOMS = 16;
 constexpr double TICK_RATE = 64.0;
 constexpr double DESIRED_TICK_LENGTH = 1.0 / TICK_RATE;
@@ -48,18 +51,24 @@ constexpr double EPSILON = 0.8;
 
 constexpr float Z_TO_SIZE_RATIO = 0.3;
 
+// with fixed point both ends compute exactly the same numbers, so anything
+// but an exact match is a real desync
+#ifdef SVB_FIXED_POINT
+inline bool fcmp(Scalar a, Scalar b) { return a == b; }
+#else
 inline bool fcmp(float a, float b) { return std::abs(a - b) < EPSILON; }
+#endif
 
 struct Vec3 {
-  float x = 0.0;
-  float y = 0.0;
-  float z = 0.0;
+  Scalar x = 0.0;
+  Scalar y = 0.0;
+  Scalar z = 0.0;
 
   template <class Archive> void serialize(Archive &archive) {
     archive(x, y, z);
   }
 
-  float magnitude2D() { return std::sqrt((x * x) + (y * y)); }
+  Scalar magnitude2D() { return length2D(x, y); }
 
   bool operator==(const Vec3 &c) {
     return fcmp(x, c.x) && fcmp(y, c.y) && fcmp(z, c.z);
@@ -81,7 +90,7 @@ struct Vec3 {
     return ret;
   }
 
-  Vec3 operator*(const float c) const {
+  Vec3 operator*(const Scalar c) const {
     Vec3 ret = *this;
     ret.x *= c;
     ret.y *= c;
@@ -89,7 +98,7 @@ struct Vec3 {
     return ret;
   }
 
-  void operator*=(const float c) {
+  void operator*=(const Scalar c) {
     x *= c;
     y *= c;
     z *= c;
@@ -99,7 +108,7 @@ struct Vec3 {
 struct PhysicsState {
   Vec3 pos;
   Vec3 vel;
-  float jump_cooldown;
+  Scalar jump_cooldown = 0.0;
 
   template <class Archive> void serialize(Archive &archive) {
     archive(pos, vel, jump_cooldown);
@@ -137,13 +146,16 @@ struct GameState {
   int16_t ball_owner = 1; // who is serving the ball right now 1-4; 0 -> no-one
   bool can_owner_move = false;
   bool is_blocking_allowed = false;
-  float timer = 0.0;
+  Scalar timer = 0.0;
+  // picked by the server for each match so that rooms play out differently,
+  // see match_rng.hpp. resetGameState() leaves it alone
+  uint32_t rng_seed = 0;
 
   template <class Archive> void serialize(Archive &archive) {
     archive(p1, p2, p3, p4, ball, target, landing_zone, team1_score,
             team2_score, team1_points_to_give, team2_points_to_give, tick,
             ball_state, last_server, ball_owner, can_owner_move,
-            is_blocking_allowed, timer);
+            is_blocking_allowed, timer, rng_seed);
   }
 
   bool operator==(const GameState &c) {
@@ -155,15 +167,53 @@ struct GameState {
            team2_points_to_give == c.team2_points_to_give && tick == c.tick &&
            ball_state == c.ball_state && last_server == c.last_server &&
            ball_owner == c.ball_owner && can_owner_move == c.can_owner_move &&
-           is_blocking_allowed == c.is_blocking_allowed && fcmp(timer, c.timer);
+           is_blocking_allowed == c.is_blocking_allowed &&
+           fcmp(timer, c.timer) && rng_seed == c.rng_seed;
   }
 
   bool operator!=(const GameState &c) { return !(*this == c); }
 };
 
-Vec3 interpolate(Vec3 &previous, Vec3 &next, double a);
-PhysicsState interpolate(PhysicsState &previous, PhysicsState &next, double a);
-GameState interpolate(GameState &previous, GameState &next, double a);
+// how a field is represented on the wire, see wire_format.hpp
+enum FieldKind : uint8_t {
+  FIELD_POS_X,
+  FIELD_POS_Y,
+  FIELD_POS_Z,
+  FIELD_VEL,
+  FIELD_TIME,
+  FIELD_SCORE,
+  FIELD_TICK,
+  FIELD_BALL_STATE,
+  FIELD_PLAYER_SLOT,
+  FIELD_BALL_OWNER,
+  FIELD_FLAG,
+  FIELD_SEED,
+};
+
+// every field of a GameState that goes over the wire, in serialization order.
+// lets us diff states field by field without caring about struct padding
+struct GameStateField {
+  size_t offset;
+  size_t size;
+  FieldKind kind;
+  const char *name;
+};
+constexpr size_t NUM_GAME_STATE_FIELDS = 61;
+extern const std::array<GameStateField, NUM_GAME_STATE_FIELDS>
+    GAME_STATE_FIELDS;
+
+Vec3 interpolate(const Vec3 &previous, const Vec3 &next, double a);
+PhysicsState interpolate(const PhysicsState &previous,
+                         const PhysicsState &next, double a);
+GameState interpolate(const GameState &previous, const GameState &next,
+                      double a);
+
+// dead reckoning, where everything would be if it kept moving like it is
+PhysicsState extrapolate(const PhysicsState &state, double seconds);
+GameState extrapolate(const GameState &state, double seconds);
+
+// the paddle of player 0-3
+PhysicsState *playerFromIndex(GameState &state, int idx);
 
 void updatePlayerState(GameState &state, const InputMessage &input,
                        const double delta_time, uint8_t player);
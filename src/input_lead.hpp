@@ -0,0 +1,61 @@
+#pragma once
+#include "game_state.hpp"
+#include <algorithm>
+#include <math.h>
+
+// how far ahead of the simulation, in ticks, a player's inputs should arrive
+constexpr float INITIAL_INPUT_LEAD = 2.0;
+constexpr float MIN_INPUT_LEAD = 1.0;
+constexpr float MAX_INPUT_LEAD = 16.0;
+// how many mean deviations of jitter to leave room for
+constexpr float INPUT_JITTER_MARGIN = 3.0;
+// weight of a new sample in the running averages, ~1s of history at 64hz
+constexpr float INPUT_LEAD_SMOOTHING = 1.0 / 64.0;
+
+// clients speed up or slow down by at most this much to hold their lead
+constexpr double MAX_TICK_RATE_ADJUST = 0.05;
+// and by this much per tick of lead they are off by
+constexpr double TICK_RATE_ADJUST_PER_TICK = 0.01;
+
+// Adaptive jitter buffer for one player's inputs. Once per simulated tick we
+// sample how far ahead their newest input is, and keep a running mean and
+// mean deviation of it like TCP does for round trip times. The lead we ask
+// for is enough to cover that deviation, so a jittery connection gets a
+// deeper buffer and a steady one a shallow, low latency one.
+class InputLeadTracker {
+public:
+  void sample(int lead) {
+    if (!has_samples_) {
+      mean_ = lead;
+      has_samples_ = true;
+    }
+    float error = lead - mean_;
+    mean_ += INPUT_LEAD_SMOOTHING * error;
+    deviation_ += INPUT_LEAD_SMOOTHING * (std::abs(error) - deviation_);
+  }
+
+  float lead() const { return has_samples_ ? mean_ : 0.0f; }
+
+  float targetLead() const {
+    if (!has_samples_) {
+      return INITIAL_INPUT_LEAD;
+    }
+    return std::clamp(MIN_INPUT_LEAD + INPUT_JITTER_MARGIN * deviation_,
+                      MIN_INPUT_LEAD, MAX_INPUT_LEAD);
+  }
+
+  void reset() { *this = InputLeadTracker(); }
+
+private:
+  bool has_samples_ = false;
+  float mean_ = 0.0;
+  float deviation_ = 0.0;
+};
+
+// the client side of it, how long to make our ticks to drift towards the
+// lead the server asked for. being behind makes the ticks shorter
+inline double adjustedTickLength(float lead, float target_lead) {
+  double adjust = std::clamp((lead - target_lead) * TICK_RATE_ADJUST_PER_TICK,
+                             -MAX_TICK_RATE_ADJUST, MAX_TICK_RATE_ADJUST);
+  return DESIRED_TICK_LENGTH * (1.0 + adjust);
+}
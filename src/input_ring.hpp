@@ -0,0 +1,125 @@
+#pragma once
+#include "network_signals.hpp"
+#include <array>
+#include <atomic>
+#include <stdint.h>
+
+// how far ahead of the simulation a client's input may arrive (1s at 64hz)
+constexpr uint32_t INPUT_RING_CAPACITY = 64;
+
+// Bounded single-producer/single-consumer buffer of one player's inputs,
+// slotted by tick. The network thread pushes, the tick thread consumes in
+// tick order and neither side ever blocks on the other.
+class InputRing {
+public:
+  // producer side. returns false if the input was dropped because it is for a
+  // tick that was already simulated, is too far ahead, or is a duplicate.
+  // clients repeat inputs until they're acked, so duplicates are normal
+  bool push(const InputMessage &input) {
+    // tags are tick + 1 so that 0 can mean empty
+    Slot &slot = slots_[input.tick % INPUT_RING_CAPACITY];
+    uint32_t tag = input.tick + 1;
+    uint32_t next_tick = next_tick_.load(std::memory_order_acquire);
+    if (input.tick < next_tick) {
+      // a repeat of one we already had isn't late, just redundant
+      if (slot.tag.load(std::memory_order_relaxed) != tag) {
+        dropped_late_.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        duplicates_.fetch_add(1, std::memory_order_relaxed);
+      }
+      return false;
+    }
+    if (input.tick - next_tick >= INPUT_RING_CAPACITY) {
+      dropped_early_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (slot.tag.load(std::memory_order_relaxed) == tag) {
+      duplicates_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    slot.input = input;
+    slot.tag.store(tag, std::memory_order_release);
+
+    if (tag > newest_tag_.load(std::memory_order_relaxed)) {
+      newest_tag_.store(tag, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // consumer side. fetch the input for this tick, if it arrived, and release
+  // every slot up to it back to the producer
+  bool consume(uint32_t tick, InputMessage &out) {
+    const Slot &slot = slots_[tick % INPUT_RING_CAPACITY];
+    bool found = slot.tag.load(std::memory_order_acquire) == tick + 1;
+    if (found) {
+      out = slot.input;
+      consumed_tag_ = tick + 1;
+      on_time_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      missed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    next_tick_.store(tick + 1, std::memory_order_release);
+    return found;
+  }
+
+  // has the client sent us anything for this tick or later?
+  bool hasReached(uint32_t tick) const {
+    return newest_tag_.load(std::memory_order_acquire) > tick;
+  }
+
+  // how many ticks ahead of this one the newest input we got is, negative if
+  // the client is behind
+  int leadOver(uint32_t tick) const {
+    return static_cast<int>(newest_tag_.load(std::memory_order_acquire) -
+                            (tick + 1));
+  }
+
+  // consumer side. newest tick + 1 we actually had an input for, 0 if none
+  uint32_t consumedTag() const { return consumed_tag_; }
+
+  // inputs that were there when their tick was simulated
+  uint64_t onTime() const { return on_time_.load(std::memory_order_relaxed); }
+  // ticks simulated without an input from this player
+  uint64_t missed() const { return missed_.load(std::memory_order_relaxed); }
+  uint64_t droppedLate() const {
+    return dropped_late_.load(std::memory_order_relaxed);
+  }
+  uint64_t droppedEarly() const {
+    return dropped_early_.load(std::memory_order_relaxed);
+  }
+  // repeats of inputs we already had, dropped without harm
+  uint64_t duplicates() const {
+    return duplicates_.load(std::memory_order_relaxed);
+  }
+
+  // only safe while neither the producer nor the consumer is running
+  void reset() {
+    for (Slot &slot : slots_) {
+      slot.tag.store(0, std::memory_order_relaxed);
+    }
+    next_tick_.store(0, std::memory_order_relaxed);
+    newest_tag_.store(0, std::memory_order_relaxed);
+    consumed_tag_ = 0;
+    on_time_.store(0, std::memory_order_relaxed);
+    missed_.store(0, std::memory_order_relaxed);
+    dropped_late_.store(0, std::memory_order_relaxed);
+    dropped_early_.store(0, std::memory_order_relaxed);
+    duplicates_.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> tag{0};
+    InputMessage input;
+  };
+
+  std::array<Slot, INPUT_RING_CAPACITY> slots_;
+  std::atomic<uint32_t> next_tick_{0};
+  std::atomic<uint32_t> newest_tag_{0};
+  uint32_t consumed_tag_ = 0; // only touched by the consumer
+  std::atomic<uint64_t> on_time_{0};
+  std::atomic<uint64_t> missed_{0};
+  std::atomic<uint64_t> dropped_late_{0};
+  std::atomic<uint64_t> dropped_early_{0};
+  std::atomic<uint64_t> duplicates_{0};
+};
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
+
+#include "bot_player.hpp"
+#include "client_net.hpp"
+#include "game_state.hpp"
+#include "net_impairment.hpp"
+
+// End to end input latency on loopback. Starts a server, or uses one that's
+// already running, puts four scripted players in a room and times every
+// input from the frame it's sent to the frame the first snapshot or state
+// hash at or past its tick arrives, the server's answer to it. Alongside
+// that it counts how many ticks each client frame rolled back and simulated
+// again, which is the other half of what a player feels.
+//
+// Both ends of an input are stamped with the start of the frame they happen
+// in, so the numbers are good to about a frame, a millisecond here.
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+constexpr const char *DEFAULT_SERVER_BINARY = "./svb_server";
+constexpr const char *LOOPBACK_SERVER = "127.0.0.1:25565";
+constexpr const char *DEFAULT_JSON_PATH = "latency.json";
+constexpr double DEFAULT_SECONDS = 30.0;
+// input leads and snapshot acks settle before we measure
+constexpr double WARMUP_SECONDS = 2.0;
+// how long a server we started gets to fail before we trust it's up
+constexpr double SERVER_START_SECONDS = 0.5;
+constexpr double ROOM_START_TIMEOUT = 10.0;
+constexpr int LATENCY_JSON_VERSION = 1;
+
+static double secondsSince(steady_clock::time_point start) {
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+static double percentile(std::vector<double> &values, double fraction) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  size_t i = std::min(values.size() - 1,
+                      static_cast<size_t>(fraction * values.size()));
+  std::nth_element(values.begin(), values.begin() + i, values.end());
+  return values[i];
+}
+
+// a server of our own on this machine, stopped again when we're done
+class ServerProcess {
+public:
+  ServerProcess() = default;
+  ~ServerProcess() { stop(); }
+  ServerProcess(const ServerProcess &) = delete;
+  ServerProcess &operator=(const ServerProcess &) = delete;
+
+#ifdef _WIN32
+  bool start(const std::string &) {
+    std::cout << "ERROR: starting a server isn't supported on Windows, run "
+                 "one and pass --server"
+              << std::endl;
+    return false;
+  }
+  void stop() {}
+#else
+  bool start(const std::string &binary) {
+    char *argv[] = {const_cast<char *>(binary.c_str()), nullptr};
+    if (posix_spawn(&pid_, binary.c_str(), nullptr, nullptr, argv,
+                    environ) != 0) {
+      std::cout << "ERROR: couldn't start " << binary << std::endl;
+      pid_ = -1;
+      return false;
+    }
+    std::this_thread::sleep_for(duration<double>(SERVER_START_SECONDS));
+    if (waitpid(pid_, nullptr, WNOHANG) == pid_) {
+      std::cout << "ERROR: " << binary << " exited right away, is another "
+                << "server already on the port?" << std::endl;
+      pid_ = -1;
+      return false;
+    }
+    return true;
+  }
+
+  void stop() {
+    if (pid_ > 0) {
+      kill(pid_, SIGTERM);
+      waitpid(pid_, nullptr, 0);
+      pid_ = -1;
+    }
+  }
+
+private:
+  pid_t pid_ = -1;
+#endif
+};
+
+struct LatencyOptions {
+  std::string server_binary = DEFAULT_SERVER_BINARY;
+  // use this server instead of starting one
+  std::string server;
+  double seconds = DEFAULT_SECONDS;
+  uint64_t seed = 1;
+  const ImpairmentProfile *net_profile = nullptr;
+  std::string json_path = DEFAULT_JSON_PATH;
+};
+
+struct LatencyResult {
+  double seconds = 0.0;
+  uint64_t inputs = 0;
+  // sent after the server had already simulated their tick, so never timed
+  uint64_t late = 0;
+  std::vector<double> latency_ms;
+  uint64_t frames = 0;
+  // ticks rolled back and simulated again by one frame -> how many frames
+  std::map<uint32_t, uint64_t> rollback_depths;
+};
+
+// one player's inputs on their way to the server and back
+class TimedBot {
+public:
+  TimedBot(const SteamNetworkingIPAddr &server, uint64_t seed)
+      : bot_(server, seed) {}
+
+  Bot &bot() { return bot_; }
+
+  void frame(double frame_time, double now, LatencyResult *result) {
+    bot_.frame(frame_time);
+    const Client &client = bot_.client();
+    std::optional<uint32_t> newest = client.receive_stats.newest_tick;
+    if (!bot_.playing() || (newest && newest_ && *newest < *newest_)) {
+      in_flight_.clear(); // the match is over, those won't be answered
+    }
+    newest_ = newest;
+
+    while (newest && !in_flight_.empty() &&
+           in_flight_.front().tick <= *newest) {
+      if (result && in_flight_.front().sent_at >= measure_from_) {
+        result->latency_ms.push_back(
+            (now - in_flight_.front().sent_at) * 1000.0);
+      }
+      in_flight_.pop_front();
+    }
+    if (result) {
+      result->frames++;
+      result->rollback_depths[client.rollbackStats().resimulated_ticks]++;
+    }
+
+    for (uint32_t tick : bot_.ticksSent()) {
+      // we snapped back to an older tick, the inputs after it are sent again
+      while (!in_flight_.empty() && in_flight_.back().tick >= tick) {
+        in_flight_.pop_back();
+      }
+      if (result) {
+        result->inputs++;
+      }
+      if (newest && tick <= *newest) {
+        if (result) {
+          result->late++;
+        }
+        continue;
+      }
+      in_flight_.push_back({tick, now});
+    }
+  }
+
+  // only time inputs sent from here on
+  void measureFrom(double now) { measure_from_ = now; }
+
+private:
+  struct InFlight {
+    uint32_t tick;
+    double sent_at;
+  };
+
+  Bot bot_;
+  // sent and not answered yet, oldest first
+  std::deque<InFlight> in_flight_;
+  std::optional<uint32_t> newest_;
+  double measure_from_ = 0.0;
+};
+
+void writeJson(std::ostream &out, LatencyResult &result,
+               const LatencyOptions &options) {
+  std::vector<double> &latency = result.latency_ms;
+  double mean = 0.0;
+  for (double ms : latency) {
+    mean += ms / latency.size();
+  }
+  out << std::fixed << std::setprecision(3);
+  out << "{\n";
+  out << "  \"version\": " << LATENCY_JSON_VERSION << ",\n";
+  out << "  \"seed\": " << options.seed << ",\n";
+  out << "  \"net_profile\": \""
+      << (options.net_profile ? options.net_profile->name : "none")
+      << "\",\n";
+  out << "  \"seconds\": " << result.seconds << ",\n";
+  out << "  \"inputs\": " << result.inputs << ",\n";
+  out << "  \"confirmed\": " << latency.size() << ",\n";
+  out << "  \"late\": " << result.late << ",\n";
+  out << "  \"latency_ms\": {\n";
+  out << "    \"mean\": " << mean << ",\n";
+  out << "    \"p50\": " << percentile(latency, 0.5) << ",\n";
+  out << "    \"p90\": " << percentile(latency, 0.9) << ",\n";
+  out << "    \"p99\": " << percentile(latency, 0.99) << ",\n";
+  out << "    \"max\": "
+      << (latency.empty() ? 0.0
+                          : *std::max_element(latency.begin(), latency.end()))
+      << "\n";
+  out << "  },\n";
+  out << "  \"frames\": " << result.frames << ",\n";
+  out << "  \"rollback_depth\": {";
+  bool first = true;
+  for (const auto &[depth, frames] : result.rollback_depths) {
+    out << (first ? "" : ", ") << "\"" << depth << "\": " << frames;
+    first = false;
+  }
+  out << "}\n";
+  out << "}\n";
+}
+
+void printUsage() {
+  std::cerr << "usage: svb_latency [--server-binary PATH | --server "
+               "ADDRESS:PORT] [--seconds S] [--seed N] [--net-profile NAME] "
+               "[--json FILE]"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  LatencyOptions options;
+  int curr_arg = 0;
+  while (++curr_arg != argc) {
+    const char *arg = argv[curr_arg];
+    bool has_value = curr_arg + 1 != argc;
+    if (strcmp(arg, "--server-binary") == 0 && has_value) {
+      options.server_binary = argv[++curr_arg];
+    } else if (strcmp(arg, "--server") == 0 && has_value) {
+      options.server = argv[++curr_arg];
+    } else if (strcmp(arg, "--seconds") == 0 && has_value) {
+      options.seconds = atof(argv[++curr_arg]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      options.seed = strtoull(argv[++curr_arg], nullptr, 10);
+    } else if (strcmp(arg, "--net-profile") == 0 && has_value) {
+      options.net_profile = findImpairmentProfile(argv[++curr_arg]);
+      if (!options.net_profile) {
+        std::cerr << "error: network profile must be one of "
+                  << impairmentProfileNames() << std::endl;
+        return 2;
+      }
+    } else if (strcmp(arg, "--json") == 0 && has_value) {
+      options.json_path = argv[++curr_arg];
+    } else {
+      printUsage();
+      return 2;
+    }
+  }
+
+  ServerProcess server_process;
+  std::string address = options.server;
+  if (address.empty()) {
+    if (!server_process.start(options.server_binary)) {
+      return 2;
+    }
+    address = LOOPBACK_SERVER;
+  }
+  SteamNetworkingIPAddr server;
+  if (!server.ParseString(address.c_str())) {
+    std::cerr << "error: can't parse server address " << address << std::endl;
+    return 2;
+  }
+  if (!initNetworking()) {
+    return 2;
+  }
+  // only the clients are impaired, the server sees the same network
+  if (options.net_profile && !applyImpairment(*options.net_profile)) {
+    return 2;
+  }
+  std::cout << "measuring against " << address << " for " << options.seconds
+            << "s, seed " << options.seed << std::endl;
+
+  // the first player makes the room, the others join once it's there
+  std::vector<std::unique_ptr<TimedBot>> bots;
+  bots.push_back(std::make_unique<TimedBot>(server, options.seed));
+  bots[0]->bot().client().makeRoom();
+
+  auto start = steady_clock::now();
+  LatencyResult result;
+  std::optional<double> measure_from;
+  double last_frame = 0.0;
+  while (true) {
+    double now = secondsSince(start);
+    double frame_time = now - last_frame;
+    last_frame = now;
+    bool measuring = measure_from && now >= *measure_from;
+
+    Client::runCallbacks();
+    for (std::unique_ptr<TimedBot> &bot : bots) {
+      bot->frame(frame_time, now, measuring ? &result : nullptr);
+      if (bot->bot().client().lost_connection) {
+        std::cout << "ERROR: lost the connection to the server" << std::endl;
+        return 1;
+      }
+    }
+
+    const Client &host = bots[0]->bot().client();
+    if (bots.size() == 1 && host.room_state &&
+        host.room_state->current_room != -1) {
+      for (int player = 1; player < PLAYERS_PER_ROOM; player++) {
+        bots.push_back(
+            std::make_unique<TimedBot>(server, options.seed + player));
+        bots.back()->bot().client().joinRoom(host.room_state->current_room);
+      }
+    }
+
+    if (!measure_from) {
+      bool all_playing =
+          bots.size() == PLAYERS_PER_ROOM &&
+          std::all_of(bots.begin(), bots.end(),
+                      [](const std::unique_ptr<TimedBot> &bot) {
+                        return bot->bot().playing();
+                      });
+      if (all_playing) {
+        measure_from = now + WARMUP_SECONDS;
+        for (std::unique_ptr<TimedBot> &bot : bots) {
+          bot->measureFrom(*measure_from);
+        }
+      } else if (now > ROOM_START_TIMEOUT) {
+        std::cout << "ERROR: the match didn't start in " << ROOM_START_TIMEOUT
+                  << "s" << std::endl;
+        return 1;
+      }
+    } else if (now - *measure_from >= options.seconds) {
+      result.seconds = now - *measure_from;
+      break;
+    }
+
+    // frames at about a millisecond, like a fast client
+    if (secondsSince(start) - now < 0.001) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  server_process.stop();
+
+  std::ofstream json_file(options.json_path);
+  writeJson(json_file, result, options);
+  if (!json_file.good()) {
+    std::cout << "ERROR: couldn't write " << options.json_path << std::endl;
+    return 1;
+  }
+  std::vector<double> &latency = result.latency_ms;
+  std::cout << std::fixed << std::setprecision(2)
+            << "inputs: " << latency.size() << " confirmed, " << result.late
+            << " late. latency p50: " << percentile(latency, 0.5)
+            << " ms p99: " << percentile(latency, 0.99)
+            << " ms. results in " << options.json_path << std::endl;
+  return 0;
+}
@@ -0,0 +1,34 @@
+#include "match_log.hpp"
+
+size_t keyframeSize() {
+  size_t size = 0;
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    size += field.size;
+  }
+  return size;
+}
+
+void writeKeyframe(WireWriter &archive, uint32_t tick,
+                   const GameState &state) {
+  archive(RECORD_KEYFRAME, tick);
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    archive.writeBytes(reinterpret_cast<const uint8_t *>(&state) + field.offset,
+                       field.size);
+  }
+}
+
+bool readKeyframe(WireReader &archive, uint32_t &tick, GameState &state) {
+  archive(tick);
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    archive.readBytes(reinterpret_cast<uint8_t *>(&state) + field.offset,
+                      field.size);
+  }
+  return archive.ok();
+}
+
+bool isCompatible(const MatchLogHeader &header) {
+  return header.magic == MATCH_LOG_MAGIC &&
+         header.version == MATCH_LOG_VERSION &&
+         header.scalar_is_fixed == SCALAR_IS_FIXED &&
+         header.keyframe_size == keyframeSize();
+}
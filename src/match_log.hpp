@@ -0,0 +1,61 @@
+#pragma once
+#include "game_state.hpp"
+#include "wire_archive.hpp"
+#include <array>
+#include <stdint.h>
+
+// Everything a room's simulation consumed during a match, so it can be
+// simulated again offline. A MatchLogHeader, then records back to back:
+//
+//   RECORD_TICK | players  one tick. players is a bit per player that had an
+//                          input for it, each followed by its buttons as a
+//                          uint16, in player order
+//   RECORD_KEYFRAME        the tick the state is from as a uint32, then every
+//                          GAME_STATE_FIELDS entry as its raw bytes
+//   RECORD_END             the number of ticks recorded as a uint32, then a
+//                          byte that is 1 if the recorder fell behind and
+//                          dropped the rest of the match
+//
+// Ticks are consecutive from 0, the first keyframe is the state before tick
+// 0 and the others follow the tick they're from. A log the server never got
+// to finish simply has no RECORD_END.
+constexpr std::array<char, 4> MATCH_LOG_MAGIC = {'S', 'V', 'B', 'M'};
+// bump whenever the layout of the log changes
+constexpr uint16_t MATCH_LOG_VERSION = 1;
+// a keyframe every 4s at 64hz
+constexpr uint32_t KEYFRAME_INTERVAL = 256;
+// the first keyframe has no tick before it
+constexpr uint32_t KEYFRAME_BEFORE_START = UINT32_MAX;
+
+constexpr uint8_t RECORD_TICK = 0x10;
+constexpr uint8_t RECORD_KEYFRAME = 0x20;
+constexpr uint8_t RECORD_END = 0x30;
+constexpr uint8_t RECORD_TYPE_MASK = 0xf0;
+
+struct MatchLogHeader {
+  std::array<char, 4> magic = MATCH_LOG_MAGIC;
+  uint16_t version = MATCH_LOG_VERSION;
+  // keyframes hold raw scalars, so the replay needs the same build
+  uint8_t scalar_is_fixed = SCALAR_IS_FIXED;
+  uint16_t keyframe_size = 0;
+  uint32_t keyframe_interval = KEYFRAME_INTERVAL;
+  uint32_t room = 0;
+  uint64_t start_time_ms = 0; // since the unix epoch
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(magic, version, scalar_is_fixed, keyframe_size, keyframe_interval,
+            room, start_time_ms);
+  }
+};
+
+// bytes of state in a keyframe
+size_t keyframeSize();
+
+// a keyframe record, bit exact so a replay can start from it
+void writeKeyframe(WireWriter &archive, uint32_t tick,
+                   const GameState &state);
+// the rest of a keyframe record after its type byte
+bool readKeyframe(WireReader &archive, uint32_t &tick, GameState &state);
+
+// is this a log the running build can replay?
+bool isCompatible(const MatchLogHeader &header);
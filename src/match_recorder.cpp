@@ -0,0 +1,236 @@
+#include "match_recorder.hpp"
+#include "wire_format.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+
+constexpr uint8_t CHUNK_OPEN = 0; // the path of the next match's log
+constexpr uint8_t CHUNK_DATA = 1;
+constexpr uint8_t CHUNK_CLOSE = 2;
+
+// stdio buffer per open log, so the disk sees a few big writes
+constexpr size_t WRITE_BUFFER_SIZE = 1 << 16;
+// how often open logs are flushed, a crash loses at most this much
+constexpr auto FLUSH_INTERVAL = std::chrono::seconds(1);
+
+bool RecordRing::push(uint8_t kind, const void *data, uint32_t size) {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  uint64_t tail = tail_.load(std::memory_order_acquire);
+  if (RECORD_RING_CAPACITY - (head - tail) < CHUNK_HEADER_SIZE + size) {
+    return false;
+  }
+  uint8_t header[CHUNK_HEADER_SIZE];
+  header[0] = kind;
+  memcpy(header + 1, &size, sizeof(size));
+  copyIn(head, header, CHUNK_HEADER_SIZE);
+  copyIn(head + CHUNK_HEADER_SIZE, data, size);
+  head_.store(head + CHUNK_HEADER_SIZE + size, std::memory_order_release);
+  return true;
+}
+
+bool RecordRing::pop(uint8_t &kind, std::vector<uint8_t> &data) {
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  uint64_t head = head_.load(std::memory_order_acquire);
+  if (head == tail) {
+    return false;
+  }
+  uint8_t header[CHUNK_HEADER_SIZE];
+  copyOut(tail, header, CHUNK_HEADER_SIZE);
+  uint32_t size = 0;
+  kind = header[0];
+  memcpy(&size, header + 1, sizeof(size));
+  data.resize(size);
+  copyOut(tail + CHUNK_HEADER_SIZE, data.data(), size);
+  tail_.store(tail + CHUNK_HEADER_SIZE + size, std::memory_order_release);
+  return true;
+}
+
+void RecordRing::copyIn(uint64_t position, const void *data, size_t size) {
+  size_t offset = position % RECORD_RING_CAPACITY;
+  size_t first = std::min(size, RECORD_RING_CAPACITY - offset);
+  memcpy(bytes_.data() + offset, data, first);
+  memcpy(bytes_.data(), static_cast<const uint8_t *>(data) + first,
+         size - first);
+}
+
+void RecordRing::copyOut(uint64_t position, void *data, size_t size) const {
+  size_t offset = position % RECORD_RING_CAPACITY;
+  size_t first = std::min(size, RECORD_RING_CAPACITY - offset);
+  memcpy(data, bytes_.data() + offset, first);
+  memcpy(static_cast<uint8_t *>(data) + first, bytes_.data(), size - first);
+}
+
+void MatchRecorder::begin(uint32_t room, const GameState &start) {
+  uint64_t now_ms =
+      duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+          .count();
+  std::string path = directory_ + "/match_" + std::to_string(now_ms) +
+                     "_room" + std::to_string(room) + ".svbm";
+  pushWaiting(CHUNK_OPEN, path.data(), path.size());
+
+  MatchLogHeader header;
+  header.keyframe_size = keyframeSize();
+  header.room = room;
+  header.start_time_ms = now_ms;
+  WireWriter archive(pending_.data(), PENDING_CAPACITY);
+  archive(header);
+  writeKeyframe(archive, KEYFRAME_BEFORE_START, start);
+  pushWaiting(CHUNK_DATA, pending_.data(), archive.size());
+
+  pending_size_ = 0;
+  pending_ticks_ = 0;
+  ticks_ = 0;
+  room_ = room;
+  recording_ = true;
+  dropped_ = false;
+}
+
+void MatchRecorder::recordTick(
+    uint8_t players, const std::array<InputMessage, PLAYERS_PER_ROOM> &inputs,
+    const GameState &state) {
+  if (!recording_ || dropped_) {
+    return;
+  }
+  uint8_t *out = pending_.data() + pending_size_;
+  *out++ = RECORD_TICK | players;
+  for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    if (players & (1 << player)) {
+      uint16_t buttons = packButtons(inputs[player]);
+      memcpy(out, &buttons, sizeof(buttons));
+      out += sizeof(buttons);
+    }
+  }
+  pending_size_ = out - pending_.data();
+  pending_ticks_++;
+
+  if ((state.tick + 1) % KEYFRAME_INTERVAL == 0) {
+    WireWriter archive(pending_.data() + pending_size_,
+                       PENDING_CAPACITY - pending_size_);
+    writeKeyframe(archive, state.tick, state);
+    pending_size_ += archive.size();
+  }
+
+  // ticks go to the writer a batch at a time, as soon as there may not be
+  // room for another tick and a keyframe after it
+  static const size_t largest_tick = 1 + 2 * PLAYERS_PER_ROOM +
+                                     sizeof(RECORD_KEYFRAME) +
+                                     sizeof(uint32_t) + keyframeSize();
+  if (PENDING_CAPACITY - pending_size_ < largest_tick) {
+    handOff();
+  }
+}
+
+void MatchRecorder::handOff() {
+  if (pending_size_ == 0) {
+    return;
+  }
+  if (ring_.push(CHUNK_DATA, pending_.data(), pending_size_)) {
+    ticks_ += pending_ticks_;
+  } else {
+    // a log with a hole in it is no use, stop here
+    dropped_ = true;
+  }
+  pending_size_ = 0;
+  pending_ticks_ = 0;
+}
+
+void MatchRecorder::end() {
+  if (!recording_) {
+    return;
+  }
+  handOff();
+  uint8_t end[16];
+  WireWriter archive(end, sizeof(end));
+  archive(RECORD_END, ticks_, dropped_);
+  pushWaiting(CHUNK_DATA, end, archive.size());
+  pushWaiting(CHUNK_CLOSE, nullptr, 0);
+  if (dropped_) {
+    std::cout << "WARN: the match log writer fell behind, room " << room_
+              << "'s log stops after tick " << ticks_ << std::endl;
+  }
+  recording_ = false;
+}
+
+void MatchRecorder::pushWaiting(uint8_t kind, const void *data,
+                                uint32_t size) {
+  while (!ring_.push(kind, data, size)) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+}
+
+void MatchLogWriter::start(std::vector<MatchRecorder *> recorders) {
+  recorders_ = std::move(recorders);
+  outputs_.resize(recorders_.size());
+  should_stop_ = false;
+  thread_ = std::thread(&MatchLogWriter::writerThread, this);
+}
+
+void MatchLogWriter::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  should_stop_ = true;
+  thread_.join();
+  for (size_t i = 0; i < recorders_.size(); i++) {
+    drain(*recorders_[i], outputs_[i]);
+    close(outputs_[i]);
+  }
+}
+
+void MatchLogWriter::writerThread() {
+  auto last_flush = steady_clock::now();
+  while (!should_stop_) {
+    bool wrote = false;
+    for (size_t i = 0; i < recorders_.size(); i++) {
+      wrote |= drain(*recorders_[i], outputs_[i]);
+    }
+    if (steady_clock::now() - last_flush > FLUSH_INTERVAL) {
+      for (Output &output : outputs_) {
+        if (output.file != nullptr) {
+          std::fflush(output.file);
+        }
+      }
+      last_flush = steady_clock::now();
+    }
+    if (!wrote) {
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+  }
+}
+
+bool MatchLogWriter::drain(MatchRecorder &recorder, Output &output) {
+  bool wrote = false;
+  uint8_t kind = 0;
+  while (recorder.ring().pop(kind, chunk_)) {
+    wrote = true;
+    if (kind == CHUNK_OPEN) {
+      close(output);
+      output.path.assign(chunk_.begin(), chunk_.end());
+      output.file = std::fopen(output.path.c_str(), "wb");
+      if (output.file == nullptr) {
+        std::cout << "ERROR: can't open " << output.path
+                  << " to record the match in" << std::endl;
+        continue;
+      }
+      std::setvbuf(output.file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+    } else if (kind == CHUNK_DATA && output.file != nullptr) {
+      std::fwrite(chunk_.data(), 1, chunk_.size(), output.file);
+    } else if (kind == CHUNK_CLOSE) {
+      close(output);
+    }
+  }
+  return wrote;
+}
+
+void MatchLogWriter::close(Output &output) {
+  if (output.file != nullptr) {
+    std::fclose(output.file);
+    output.file = nullptr;
+  }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "game_state.hpp"
+#include "match_log.hpp"
+#include "network_signals.hpp"
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// bytes a room can have waiting for the writer thread, many seconds of a match
+// even if the disk stalls for a while
+constexpr size_t RECORD_RING_CAPACITY = 1 << 16;
+
+// Bounded single-producer/single-consumer queue of byte chunks. Whoever is
+// running the room pushes, the writer thread pops, and neither side ever
+// blocks on the other.
+class RecordRing {
+public:
+  // producer side. all or nothing, false if there isn't room for it
+  bool push(uint8_t kind, const void *data, uint32_t size);
+  // consumer side. copies out the oldest chunk, false if there is none
+  bool pop(uint8_t &kind, std::vector<uint8_t> &data);
+
+private:
+  // a kind byte and a uint32 size in front of every chunk
+  static constexpr size_t CHUNK_HEADER_SIZE = 5;
+
+  void copyIn(uint64_t position, const void *data, size_t size);
+  void copyOut(uint64_t position, void *data, size_t size) const;
+
+  std::array<uint8_t, RECORD_RING_CAPACITY> bytes_;
+  std::atomic<uint64_t> head_{0}; // bytes ever pushed
+  std::atomic<uint64_t> tail_{0}; // bytes ever popped
+};
+
+// The producer side of a match log. The room's simulation feeds it every
+// tick it steps and it hands them to the MatchLogWriter through a RecordRing
+// in batches of a few dozen, so the tick path never touches the disk. If the
+// writer falls so far behind that the ring fills up the rest of the match is
+// dropped, the log ends where it stopped and says so.
+class MatchRecorder {
+public:
+  explicit MatchRecorder(std::string directory)
+      : directory_(std::move(directory)) {}
+
+  // before the first tick of a match, start is the state tick 0 runs on
+  void begin(uint32_t room, const GameState &start);
+  // after simulating state.tick. players has a bit set for every player that
+  // had an input for it
+  void recordTick(uint8_t players,
+                  const std::array<InputMessage, PLAYERS_PER_ROOM> &inputs,
+                  const GameState &state);
+  // after the last tick of a match
+  void end();
+
+  // only for the writer thread
+  RecordRing &ring() { return ring_; }
+
+private:
+  // ticks recorded but not handed off yet, about a second of them
+  static constexpr size_t PENDING_CAPACITY = 1024;
+
+  // hands the ticks recorded so far to the writer
+  void handOff();
+  // for begin() and end(), which don't run on the tick path and may wait for
+  // the writer thread to make room
+  void pushWaiting(uint8_t kind, const void *data, uint32_t size);
+
+  std::string directory_;
+  RecordRing ring_;
+  std::array<uint8_t, PENDING_CAPACITY> pending_;
+  size_t pending_size_ = 0;
+  uint32_t pending_ticks_ = 0;
+  uint32_t ticks_ = 0; // made it into the ring
+  uint32_t room_ = 0;
+  bool recording_ = false;
+  bool dropped_ = false;
+};
+
+// Drains every room's MatchRecorder into its own file on a thread of its
+// own, through buffered stdio.
+class MatchLogWriter {
+public:
+  ~MatchLogWriter() { stop(); }
+
+  void start(std::vector<MatchRecorder *> recorders);
+  // writes out whatever is still queued and closes every file
+  void stop();
+
+private:
+  struct Output {
+    std::FILE *file = nullptr;
+    std::string path;
+  };
+
+  void writerThread();
+  // true if anything was written
+  bool drain(MatchRecorder &recorder, Output &output);
+  void close(Output &output);
+
+  std::vector<MatchRecorder *> recorders_;
+  std::vector<Output> outputs_;
+  std::vector<uint8_t> chunk_;
+  std::thread thread_;
+  std::atomic<bool> should_stop_{false};
+};
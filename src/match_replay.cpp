@@ -0,0 +1,209 @@
+#include "match_replay.hpp"
+#include "wire_format.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the first field whose bits differ, nullptr if none do
+static const char *firstRawDifference(const GameState &a, const GameState &b) {
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    if (memcmp(reinterpret_cast<const uint8_t *>(&a) + field.offset,
+               reinterpret_cast<const uint8_t *>(&b) + field.offset,
+               field.size) != 0) {
+      return field.name;
+    }
+  }
+  return nullptr;
+}
+
+static int countPlayers(uint8_t record) {
+  int players = 0;
+  for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    players += (record >> player) & 1;
+  }
+  return players;
+}
+
+MatchLog::~MatchLog() {
+#ifndef _WIN32
+  if (mapped_) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+#endif
+}
+
+bool MatchLog::open(const std::string &path) {
+#ifdef _WIN32
+  std::ifstream file(path, std::ios::binary);
+  if (!file.good()) {
+    error_ = "can't open it";
+    return false;
+  }
+  read_data_.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+  data_ = read_data_.data();
+  size_ = read_data_.size();
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error_ = "can't open it";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    error_ = "it's empty";
+    return false;
+  }
+  size_ = info.st_size;
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    error_ = "can't map it";
+    return false;
+  }
+  // we read it front to back
+  madvise(data, size_, MADV_SEQUENTIAL);
+  data_ = static_cast<const uint8_t *>(data);
+  mapped_ = true;
+#endif
+
+  WireReader archive(data_, size_);
+  archive(header_);
+  if (!archive.ok() || header_.magic != MATCH_LOG_MAGIC) {
+    error_ = "not a match log";
+    return false;
+  }
+  if (header_.version != MATCH_LOG_VERSION) {
+    error_ = "match log version " + std::to_string(header_.version) +
+             ", we read version " + std::to_string(MATCH_LOG_VERSION);
+    return false;
+  }
+  if (!isCompatible(header_)) {
+    error_ = header_.scalar_is_fixed ? "recorded by a fixed point server"
+                                     : "recorded by a float server";
+    return false;
+  }
+  records_offset_ = size_ - archive.remaining();
+  return index();
+}
+
+bool MatchLog::index() {
+  WireReader archive(data_ + records_offset_, size_ - records_offset_);
+  GameState keyframe_state;
+  while (archive.remaining() > 0) {
+    size_t offset = size_ - archive.remaining();
+    uint8_t record = 0;
+    archive(record);
+    if ((record & RECORD_TYPE_MASK) == RECORD_TICK) {
+      uint8_t buttons[2 * PLAYERS_PER_ROOM];
+      archive.readBytes(buttons, 2 * countPlayers(record));
+      if (archive.ok()) {
+        num_ticks_++;
+      }
+    } else if (record == RECORD_KEYFRAME) {
+      uint32_t tick = 0;
+      readKeyframe(archive, tick, keyframe_state);
+      uint32_t next_tick = keyframes_.empty() ? 0 : tick + 1;
+      if (archive.ok() && next_tick == num_ticks_) {
+        keyframes_.push_back({next_tick, offset});
+      } else if (archive.ok()) {
+        error_ = "keyframe for tick " + std::to_string(tick) + " after tick " +
+                 std::to_string(num_ticks_);
+        return false;
+      }
+    } else if (record == RECORD_END) {
+      uint32_t ticks = 0;
+      archive(ticks, dropped_);
+      finished_ = archive.ok();
+      break;
+    } else {
+      error_ = "unknown record at byte " + std::to_string(offset);
+      return false;
+    }
+    // a log the server didn't get to finish can stop halfway through a
+    // record, everything before it is still good
+    if (!archive.ok()) {
+      break;
+    }
+  }
+  if (keyframes_.empty()) {
+    error_ = "no starting keyframe";
+    return false;
+  }
+  return true;
+}
+
+ReplayResult MatchLog::replay() const {
+  return simulate(keyframes_.front(), num_ticks_, true);
+}
+
+bool MatchLog::seek(uint32_t tick, ReplayResult &result) const {
+  if (tick >= num_ticks_) {
+    return false;
+  }
+  // the newest keyframe we can start from
+  auto after = std::upper_bound(
+      keyframes_.begin(), keyframes_.end(), tick,
+      [](uint32_t tick, const Keyframe &k) { return tick < k.next_tick; });
+  result = simulate(*std::prev(after), tick + 1, false);
+  return true;
+}
+
+ReplayResult MatchLog::simulate(const Keyframe &keyframe, uint32_t end,
+                                bool verify) const {
+  ReplayResult result;
+  WireReader archive(data_ + keyframe.offset, size_ - keyframe.offset);
+  uint8_t record = 0;
+  uint32_t tick = 0;
+  archive(record);
+  readKeyframe(archive, tick, result.state);
+
+  // the same steps the room took, see Room::step()
+  GameState recorded;
+  uint32_t next_tick = keyframe.next_tick;
+  while (archive.remaining() > 0) {
+    archive(record);
+    if ((record & RECORD_TYPE_MASK) == RECORD_TICK) {
+      // carry on past the last tick only to check the keyframe after it
+      if (next_tick == end) {
+        break;
+      }
+      for (size_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+        if (record & (1 << player)) {
+          uint16_t buttons = 0;
+          archive(buttons);
+          InputMessage input;
+          unpackButtons(buttons, input);
+          input.tick = next_tick;
+          updatePlayerState(result.state, input, DESIRED_TICK_LENGTH, player);
+        }
+      }
+      updateGameState(result.state, DESIRED_TICK_LENGTH);
+      result.state.tick = next_tick++;
+      result.ticks++;
+    } else if (record == RECORD_KEYFRAME) {
+      readKeyframe(archive, tick, recorded);
+      if (!verify || result.diverged) {
+        continue;
+      }
+      result.keyframes++;
+      if (const char *field = firstRawDifference(recorded, result.state)) {
+        result.diverged = true;
+        result.diverged_tick = tick;
+        result.diverged_field = field;
+      }
+    } else {
+      break;
+    }
+  }
+  return result;
+}
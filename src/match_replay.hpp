@@ -0,0 +1,70 @@
+#pragma once
+#include "game_state.hpp"
+#include "match_log.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// what simulating a recorded match again came to
+struct ReplayResult {
+  uint32_t ticks = 0;     // simulated
+  uint32_t keyframes = 0; // compared with the simulation
+  // the first keyframe the simulation disagreed with, and where
+  bool diverged = false;
+  uint32_t diverged_tick = 0;
+  const char *diverged_field = nullptr;
+  GameState state; // after the last tick simulated
+};
+
+// A match log mapped into memory. Opening it walks the records once to index
+// the keyframes, so any tick can be reached by simulating from the newest
+// keyframe before it instead of from the start.
+class MatchLog {
+public:
+  MatchLog() = default;
+  MatchLog(const MatchLog &) = delete;
+  MatchLog &operator=(const MatchLog &) = delete;
+  ~MatchLog();
+
+  // false, with error() saying why, if it's not a log this build can replay
+  bool open(const std::string &path);
+  const std::string &error() const { return error_; }
+
+  const MatchLogHeader &header() const { return header_; }
+  uint32_t numTicks() const { return num_ticks_; }
+  size_t numKeyframes() const { return keyframes_.size(); }
+  // the server got to write the end of the match
+  bool finished() const { return finished_; }
+  // the server's recorder fell behind and gave up before the end
+  bool dropped() const { return dropped_; }
+
+  // simulate the whole match, comparing every keyframe on the way
+  ReplayResult replay() const;
+  // the state after tick in result.state, simulated from the newest keyframe
+  // before it. false if the log doesn't go that far
+  bool seek(uint32_t tick, ReplayResult &result) const;
+
+private:
+  struct Keyframe {
+    uint32_t next_tick; // the first tick after it
+    size_t offset;      // of its record
+  };
+
+  bool index();
+  // simulate from keyframe up to but not including tick end. keyframes on
+  // the way are compared with the simulation when verify is set
+  ReplayResult simulate(const Keyframe &keyframe, uint32_t end,
+                        bool verify) const;
+
+  std::string error_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<uint8_t> read_data_; // where mmap isn't available
+  bool mapped_ = false;
+  MatchLogHeader header_;
+  size_t records_offset_ = 0;
+  std::vector<Keyframe> keyframes_;
+  uint32_t num_ticks_ = 0;
+  bool finished_ = false;
+  bool dropped_ = false;
+};
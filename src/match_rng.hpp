@@ -0,0 +1,44 @@
+#pragma once
+#include "scalar.hpp"
+#include <stdint.h>
+
+// Randomness for the simulation. Client and server both have to come up with
+// the same numbers when they simulate the same tick, including when the
+// client rolls back and replays it, so there is no generator state to carry
+// around. Every number is a pure function of the match's seed, the tick, and
+// which draw it is, computed like the nth output of SplitMix64.
+
+// where in the simulation a draw comes from, so two draws on the same tick
+// don't get the same number
+enum RandomSite : uint32_t {
+  RANDOM_FIRST_PASS,
+  RANDOM_SECOND_PASS,
+  RANDOM_BUMP,
+  RANDOM_BLOCK,
+};
+
+// the SplitMix64 output function, a bijection that mixes every input bit
+// into every output bit
+constexpr uint64_t mix64(uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+// 64 random bits. draw picks which of the numbers for this seed, tick and site
+constexpr uint64_t matchRandom(uint32_t seed, uint32_t tick, RandomSite site,
+                               uint32_t draw) {
+  uint64_t stream = mix64((uint64_t(seed) << 32) | tick);
+  uint64_t counter = (uint64_t(site) << 32) | draw;
+  return mix64(stream + (counter + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+// uniform in [0, 1), made from the top bits only so it's exact either way
+inline Scalar randomUnit(uint64_t bits) {
+#ifdef SVB_FIXED_POINT
+  return Fixed::fromRaw(
+      static_cast<int32_t>(bits >> (64 - Fixed::FRACTION_BITS)));
+#else
+  return static_cast<float>(bits >> 40) * (1.0f / (1 << 24));
+#endif
+}
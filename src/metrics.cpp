@@ -0,0 +1,114 @@
+#include "metrics.hpp"
+#include <iomanip>
+#include <sstream>
+
+Counter &MetricsRegistry::counter(const std::string &name,
+                                  const std::string &help,
+                                  const std::string &labels) {
+  return *add(name, help, TYPE_COUNTER, labels).counter;
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name,
+                              const std::string &help,
+                              const std::string &labels) {
+  return *add(name, help, TYPE_GAUGE, labels).gauge;
+}
+
+LatencyHistogram &MetricsRegistry::histogram(const std::string &name,
+                                             const std::string &help,
+                                             const std::string &labels) {
+  return *add(name, help, TYPE_HISTOGRAM, labels).histogram;
+}
+
+// the same name and labels twice hands back the same metric. the metric is
+// made under the lock too, a scrape may already be walking the families
+MetricsRegistry::Series &MetricsRegistry::add(const std::string &name,
+                                              const std::string &help,
+                                              Type type,
+                                              const std::string &labels) {
+  std::scoped_lock l(lock_);
+  Family *family = nullptr;
+  for (Family &existing : families_) {
+    if (existing.name == name) {
+      family = &existing;
+    }
+  }
+  if (family == nullptr) {
+    families_.push_back({name, help, type, {}});
+    family = &families_.back();
+  }
+  for (Series &series : family->series) {
+    if (series.labels == labels) {
+      return series;
+    }
+  }
+  Series &series = family->series.emplace_back();
+  series.labels = labels;
+  if (type == TYPE_COUNTER) {
+    series.counter = std::make_unique<Counter>();
+  } else if (type == TYPE_GAUGE) {
+    series.gauge = std::make_unique<Gauge>();
+  } else {
+    series.histogram = std::make_unique<LatencyHistogram>();
+  }
+  return series;
+}
+
+// name{labels} or name{labels,extra}, leaving out what's empty
+static std::string seriesName(const std::string &name,
+                              const std::string &labels,
+                              const std::string &extra = "") {
+  if (labels.empty() && extra.empty()) {
+    return name;
+  }
+  std::string separator = labels.empty() || extra.empty() ? "" : ",";
+  return name + "{" + labels + separator + extra + "}";
+}
+
+std::string MetricsRegistry::render() const {
+  static const char *TYPE_NAMES[] = {"counter", "gauge", "histogram"};
+  static const std::array<std::string, NUM_LATENCY_BUCKETS> bucket_labels =
+      [] {
+        std::array<std::string, NUM_LATENCY_BUCKETS> labels;
+        for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+          std::ostringstream bound;
+          if (i < LATENCY_BUCKET_BOUNDS_NS.size()) {
+            bound << LATENCY_BUCKET_BOUNDS_NS[i] / 1e9;
+          } else {
+            bound << "+Inf";
+          }
+          labels[i] = "le=\"" + bound.str() + "\"";
+        }
+        return labels;
+      }();
+  std::ostringstream out;
+  std::scoped_lock l(lock_);
+  for (const Family &family : families_) {
+    out << "# HELP " << family.name << " " << family.help << "\n";
+    out << "# TYPE " << family.name << " " << TYPE_NAMES[family.type] << "\n";
+    for (const Series &series : family.series) {
+      if (series.counter) {
+        out << seriesName(family.name, series.labels) << " "
+            << series.counter->value() << "\n";
+      } else if (series.gauge) {
+        out << seriesName(family.name, series.labels) << " "
+            << series.gauge->value() << "\n";
+      } else if (series.histogram) {
+        // buckets are cumulative, and in seconds
+        const LatencyHistogram &histogram = *series.histogram;
+        uint64_t count = 0;
+        for (size_t i = 0; i < NUM_LATENCY_BUCKETS; i++) {
+          count += histogram.bucket(i);
+          out << seriesName(family.name + "_bucket", series.labels,
+                            bucket_labels[i])
+              << " " << count << "\n";
+        }
+        out << seriesName(family.name + "_sum", series.labels) << " "
+            << std::setprecision(9) << histogram.sumNs() / 1e9 << "\n";
+        out << seriesName(family.name + "_count", series.labels) << " "
+            << count << "\n";
+      }
+    }
+  }
+  return out.str();
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// upper bounds of the latency histogram buckets, 10us to 100ms. everything
+// slower lands in the +Inf bucket
+constexpr std::array<int64_t, 12> LATENCY_BUCKET_BOUNDS_NS = {
+    10000,   25000,   50000,    100000,   250000,   500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 100000000};
+constexpr size_t NUM_LATENCY_BUCKETS = LATENCY_BUCKET_BOUNDS_NS.size() + 1;
+// rooms only update their step metrics every 8th step, reading the clock
+// costs more than the simulation on a quiet step and the rest are shared
+// cache lines. the tick counter catches up with the steps in between
+constexpr uint32_t STEP_TIME_SAMPLE_INTERVAL = 8;
+
+// Every metric is updated with relaxed atomics only, from whichever thread
+// has something to count, and read whenever the registry is rendered. They
+// get a cache line each so rooms stepped on different workers don't fight
+// over them.
+class alignas(64) Counter {
+public:
+  void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class alignas(64) Gauge {
+public:
+  void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> value_{0};
+};
+
+// how long something took, in LATENCY_BUCKET_BOUNDS_NS buckets
+class alignas(64) LatencyHistogram {
+public:
+  void observe(int64_t ns) {
+    size_t bucket = 0;
+    while (bucket < LATENCY_BUCKET_BOUNDS_NS.size() &&
+           ns > LATENCY_BUCKET_BOUNDS_NS[bucket]) {
+      bucket++;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  uint64_t bucket(size_t i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+  int64_t sumNs() const { return sum_ns_.load(std::memory_order_relaxed); }
+
+private:
+  std::array<std::atomic<uint64_t>, NUM_LATENCY_BUCKETS> buckets_ = {};
+  std::atomic<int64_t> sum_ns_{0};
+};
+
+// Where metrics are registered, once at startup, and rendered as Prometheus
+// text. Registering takes a lock, updating a metric never does. labels are
+// Prometheus label pairs like room="3", use label() to make them.
+class MetricsRegistry {
+public:
+  Counter &counter(const std::string &name, const std::string &help,
+                   const std::string &labels = "");
+  Gauge &gauge(const std::string &name, const std::string &help,
+               const std::string &labels = "");
+  LatencyHistogram &histogram(const std::string &name,
+                              const std::string &help,
+                              const std::string &labels = "");
+
+  // the text exposition format, version 0.0.4
+  std::string render() const;
+
+private:
+  enum Type { TYPE_COUNTER, TYPE_GAUGE, TYPE_HISTOGRAM };
+
+  struct Series {
+    std::string labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<LatencyHistogram> histogram;
+  };
+
+  struct Family {
+    std::string name;
+    std::string help;
+    Type type;
+    std::vector<Series> series;
+  };
+
+  Series &add(const std::string &name, const std::string &help, Type type,
+              const std::string &labels);
+
+  mutable std::mutex lock_;
+  std::vector<Family> families_;
+};
+
+inline std::string label(const char *name, int value) {
+  return std::string(name) + "=\"" + std::to_string(value) + "\"";
+}
@@ -0,0 +1,153 @@
+#include "metrics_server.hpp"
+#include <iostream>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// how long the serving thread waits before checking whether to stop
+constexpr int ACCEPT_POLL_MS = 200;
+// a scraper that doesn't send its request in time gets nothing
+constexpr int REQUEST_TIMEOUT_MS = 1000;
+
+#ifdef _WIN32
+bool MetricsServer::listenOnPort(uint16_t port) {
+  std::cout << "ERROR: the metrics endpoint isn't supported on Windows"
+            << std::endl;
+  return false;
+}
+
+bool MetricsServer::listenOnSocket(const std::string &path) {
+  return listenOnPort(0);
+}
+
+void MetricsServer::stop() {}
+void MetricsServer::serveThread() {}
+void MetricsServer::serve(int connection) {}
+#else
+static bool alreadyListening(int socket) {
+  if (socket >= 0) {
+    std::cout << "ERROR: already serving metrics" << std::endl;
+  }
+  return socket >= 0;
+}
+
+bool MetricsServer::listenOnPort(uint16_t port) {
+  if (alreadyListening(socket_)) {
+    return false;
+  }
+  socket_ = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (socket_ < 0 ||
+      bind(socket_, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(socket_, 8) != 0) {
+    std::cout << "ERROR: can't serve metrics on port " << port << std::endl;
+    stop();
+    return false;
+  }
+  thread_ = std::thread(&MetricsServer::serveThread, this);
+  return true;
+}
+
+bool MetricsServer::listenOnSocket(const std::string &path) {
+  if (alreadyListening(socket_)) {
+    return false;
+  }
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    std::cout << "ERROR: metrics socket path too long: " << path << std::endl;
+    return false;
+  }
+  path.copy(address.sun_path, path.size());
+  // a socket left behind by a server that didn't shut down cleanly
+  unlink(path.c_str());
+  socket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_ < 0 ||
+      bind(socket_, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(socket_, 8) != 0) {
+    std::cout << "ERROR: can't serve metrics on " << path << std::endl;
+    stop();
+    return false;
+  }
+  socket_path_ = path;
+  thread_ = std::thread(&MetricsServer::serveThread, this);
+  return true;
+}
+
+void MetricsServer::stop() {
+  should_stop_ = true;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  if (socket_ >= 0) {
+    close(socket_);
+    socket_ = -1;
+  }
+  if (!socket_path_.empty()) {
+    unlink(socket_path_.c_str());
+    socket_path_.clear();
+  }
+}
+
+void MetricsServer::serveThread() {
+  while (!should_stop_) {
+    pollfd listening = {socket_, POLLIN, 0};
+    if (poll(&listening, 1, ACCEPT_POLL_MS) <= 0) {
+      continue;
+    }
+    int connection = accept(socket_, nullptr, nullptr);
+    if (connection >= 0) {
+      serve(connection);
+      close(connection);
+    }
+  }
+}
+
+void MetricsServer::serve(int connection) {
+  // whatever they asked for they get the metrics, but wait for the end of
+  // the request so the client doesn't see the connection reset
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < 8192) {
+    pollfd readable = {connection, POLLIN, 0};
+    if (poll(&readable, 1, REQUEST_TIMEOUT_MS) <= 0) {
+      return;
+    }
+    ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+      return;
+    }
+    request.append(buffer, received);
+  }
+
+  std::string body = registry_.render();
+  std::string response =
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: " +
+      std::to_string(body.size()) + "\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < response.size()) {
+    ssize_t n = send(connection, response.data() + sent,
+                     response.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+#include "metrics.hpp"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <thread>
+
+// Answers every connection with the registry rendered as Prometheus text
+// over HTTP/1.0, on a thread of its own. It listens on localhost or a UNIX
+// socket only, there's nothing here anyone outside the machine should see.
+class MetricsServer {
+public:
+  explicit MetricsServer(const MetricsRegistry &registry)
+      : registry_(registry) {}
+  ~MetricsServer() { stop(); }
+
+  // false, after saying why, if we can't listen there. one endpoint per
+  // server
+  bool listenOnPort(uint16_t port);
+  bool listenOnSocket(const std::string &path);
+  void stop();
+
+private:
+  void serveThread();
+  void serve(int connection);
+
+  const MetricsRegistry &registry_;
+  int socket_ = -1;
+  std::string socket_path_;
+  std::thread thread_;
+  std::atomic<bool> should_stop_{false};
+};
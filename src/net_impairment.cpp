@@ -0,0 +1,77 @@
+#include "net_impairment.hpp"
+#include <array>
+#include <iostream>
+#include <steam/isteamnetworkingutils.h>
+#include <steam/steamnetworkingsockets.h>
+
+// one way numbers, a round trip sees twice the lag
+constexpr std::array<ImpairmentProfile, 5> IMPAIRMENT_PROFILES = {{
+    // name, lag, loss, reorder, by, duplicate, within
+    {"lan", 1, 0.0f, 0.0f, 0, 0.0f, 0},
+    {"wifi", 5, 1.0f, 2.0f, 10, 0.5f, 10},
+    {"mobile", 40, 3.0f, 5.0f, 40, 1.0f, 20},
+    {"transatlantic", 45, 0.5f, 1.0f, 5, 0.0f, 0},
+    {"bad", 100, 10.0f, 10.0f, 50, 2.0f, 50},
+}};
+
+const ImpairmentProfile *findImpairmentProfile(const std::string &name) {
+  for (const ImpairmentProfile &profile : IMPAIRMENT_PROFILES) {
+    if (name == profile.name) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+std::string impairmentProfileNames() {
+  std::string names;
+  for (const ImpairmentProfile &profile : IMPAIRMENT_PROFILES) {
+    names += (names.empty() ? "" : ", ") + std::string(profile.name);
+  }
+  return names;
+}
+
+bool applyImpairment(const ImpairmentProfile &profile) {
+  ISteamNetworkingUtils *utils = SteamNetworkingUtils();
+  bool ok = true;
+  for (ESteamNetworkingConfigValue lag :
+       {k_ESteamNetworkingConfig_FakePacketLag_Send,
+        k_ESteamNetworkingConfig_FakePacketLag_Recv}) {
+    ok &= utils->SetGlobalConfigValueInt32(lag, profile.lag_ms);
+  }
+  for (ESteamNetworkingConfigValue loss :
+       {k_ESteamNetworkingConfig_FakePacketLoss_Send,
+        k_ESteamNetworkingConfig_FakePacketLoss_Recv}) {
+    ok &= utils->SetGlobalConfigValueFloat(loss, profile.loss_percent);
+  }
+  for (ESteamNetworkingConfigValue reorder :
+       {k_ESteamNetworkingConfig_FakePacketReorder_Send,
+        k_ESteamNetworkingConfig_FakePacketReorder_Recv}) {
+    ok &= utils->SetGlobalConfigValueFloat(reorder, profile.reorder_percent);
+  }
+  ok &= utils->SetGlobalConfigValueInt32(
+      k_ESteamNetworkingConfig_FakePacketReorder_Time, profile.reorder_ms);
+  for (ESteamNetworkingConfigValue duplicate :
+       {k_ESteamNetworkingConfig_FakePacketDup_Send,
+        k_ESteamNetworkingConfig_FakePacketDup_Recv}) {
+    ok &= utils->SetGlobalConfigValueFloat(duplicate,
+                                           profile.duplicate_percent);
+  }
+  ok &= utils->SetGlobalConfigValueInt32(
+      k_ESteamNetworkingConfig_FakePacketDup_TimeMax, profile.duplicate_ms);
+  if (!ok) {
+    std::cout << "ERROR: couldn't apply network profile " << profile.name
+              << std::endl;
+    return false;
+  }
+
+  // the library rolls its own dice for which packets it hits, there's no
+  // seed to log. the same profile gives the same rates, not the same packets
+  std::cout << "network profile " << profile.name << ": " << profile.lag_ms
+            << " ms lag, " << profile.loss_percent << "% loss, "
+            << profile.reorder_percent << "% reordered by "
+            << profile.reorder_ms << " ms, " << profile.duplicate_percent
+            << "% duplicated within " << profile.duplicate_ms
+            << " ms, each way" << std::endl;
+  return true;
+}
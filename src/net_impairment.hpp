@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// Network conditions GameNetworkingSockets fakes for us, by name, so soak and
+// latency runs can be repeated under the same conditions. Every value is for
+// one direction and applies to packets both sent and received, so impairing
+// one end of a connection is enough.
+struct ImpairmentProfile {
+  const char *name;
+  int32_t lag_ms;
+  float loss_percent;
+  // packets held back this much longer than the rest, which is how jitter
+  // shows up to us
+  float reorder_percent;
+  int32_t reorder_ms;
+  // packets delivered a second time up to this much later
+  float duplicate_percent;
+  int32_t duplicate_ms;
+};
+
+// "lan", "wifi", "mobile", "transatlantic" or "bad", nullptr for anything
+// else
+const ImpairmentProfile *findImpairmentProfile(const std::string &name);
+// their names, for usage messages
+std::string impairmentProfileNames();
+
+// apply it to every connection this process makes from now on, after the
+// networking library is initialized. logs the settings so the run can be
+// repeated
+bool applyImpairment(const ImpairmentProfile &profile);
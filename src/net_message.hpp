@@ -0,0 +1,96 @@
+#pragma once
+#include "network_signals.hpp"
+#include "wire_archive.hpp"
+#include <atomic>
+#include <steam/isteamnetworkingutils.h>
+#include <steam/steamnetworkingsockets.h>
+
+// big enough for any message we send, and small enough to not fragment
+constexpr int MAX_MESSAGE_SIZE = 1200;
+
+// Serialize a tagged message straight into a GNS allocated message, ready to
+// be handed to SendMessages(). Returns nullptr if it didn't fit.
+template <class T>
+ISteamNetworkingMessage *encodeMessage(uint16_t type, const T &msg,
+                                       HSteamNetConnection connection,
+                                       int send_flags) {
+  ISteamNetworkingMessage *out =
+      SteamNetworkingUtils()->AllocateMessage(MAX_MESSAGE_SIZE);
+  WireWriter archive(out->m_pData, MAX_MESSAGE_SIZE);
+  MessageTag msg_tag;
+  msg_tag.type = type;
+  archive(msg_tag, msg);
+  if (!archive.ok()) {
+    out->Release();
+    return nullptr;
+  }
+  out->m_cbSize = archive.size();
+  out->m_conn = connection;
+  out->m_nFlags = send_flags;
+  return out;
+}
+
+// encode and send a single message, GNS takes ownership of the buffer
+template <class T>
+bool sendMessage(ISteamNetworkingSockets *network_interface,
+                 HSteamNetConnection connection, uint16_t type, const T &msg,
+                 int send_flags) {
+  ISteamNetworkingMessage *out =
+      encodeMessage(type, msg, connection, send_flags);
+  if (out == nullptr) {
+    return false;
+  }
+  int64 result;
+  network_interface->SendMessages(1, &out, &result);
+  return result >= 0;
+}
+
+// An encoded message that several outgoing GNS messages point at, so a
+// broadcast is serialized once no matter how many recipients it has. Every
+// message holds a reference, and so does whoever encoded it until they call
+// releaseSharedPayload().
+struct SharedPayload {
+  std::atomic<int> refs{1};
+  int size = 0;
+  uint8_t data[MAX_MESSAGE_SIZE];
+};
+
+inline void releaseSharedPayload(SharedPayload *payload) {
+  if (payload->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete payload;
+  }
+}
+
+// returns nullptr if it didn't fit
+template <class T>
+SharedPayload *encodeSharedPayload(uint16_t type, const T &msg) {
+  SharedPayload *payload = new SharedPayload();
+  WireWriter archive(payload->data, MAX_MESSAGE_SIZE);
+  MessageTag msg_tag;
+  msg_tag.type = type;
+  archive(msg_tag, msg);
+  if (!archive.ok()) {
+    releaseSharedPayload(payload);
+    return nullptr;
+  }
+  payload->size = archive.size();
+  return payload;
+}
+
+// wrap the payload in a message for one recipient without copying it
+inline ISteamNetworkingMessage *shareMessage(SharedPayload *payload,
+                                             HSteamNetConnection connection,
+                                             int send_flags) {
+  ISteamNetworkingMessage *out = SteamNetworkingUtils()->AllocateMessage(0);
+  payload->refs.fetch_add(1, std::memory_order_relaxed);
+  out->m_pData = payload->data;
+  out->m_cbSize = payload->size;
+  out->m_nUserData = reinterpret_cast<int64>(payload);
+  // GNS may free it from its own thread once it's been sent
+  out->m_pfnFreeData = [](ISteamNetworkingMessage *msg) {
+    releaseSharedPayload(reinterpret_cast<SharedPayload *>(msg->m_nUserData));
+  };
+  out->m_conn = connection;
+  out->m_nFlags = send_flags;
+  return out;
+}
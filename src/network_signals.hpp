@@ -1,9 +1,7 @@
 #pragma once
-#include <cereal/archives/binary.hpp>
-#include <cereal/types/array.hpp>
-#include <cereal/types/string.hpp>
-#include <cereal/types/vector.hpp>
+#include <array>
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 constexpr uint16_t MSG_LOBBY_STATE = 0;
@@ -12,6 +10,11 @@ constexpr uint16_t MSG_CLIENT_INPUT = 2;
 constexpr uint16_t MSG_ROOM_STATE = 3;
 constexpr uint16_t MSG_GAME_STATE = 4;
 constexpr uint16_t MSG_PING = 5;
+constexpr uint16_t MSG_SNAPSHOT_ACK = 6;
+constexpr uint16_t MSG_INPUT_TIMING = 7;
+constexpr uint16_t MSG_REMOTE_INPUTS = 8;
+constexpr uint16_t MSG_STATE_HASH = 9;
+constexpr size_t NUM_MESSAGE_TYPES = 10;
 
 constexpr size_t PLAYERS_PER_ROOM = 4;
 
@@ -88,3 +91,32 @@ struct PingMessage {
     archive(server_send_time);
   }
 };
+
+// tells the server the newest snapshot we have, so it can delta against it.
+// reset asks for full snapshots because we lost our baseline. in_sync says
+// our prediction matched the last snapshot or state hash, so a hash of each
+// tick is enough until it doesn't
+struct SnapshotAck {
+  uint32_t tick = 0;
+  bool reset = false;
+  bool in_sync = false;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(tick, reset, in_sync);
+  }
+};
+
+// how far ahead of the server a player's inputs arrive, in ticks, and how far
+// ahead the server would like them to be given how jittery they are. the
+// client nudges its tick rate to close the gap
+struct InputTiming {
+  float lead = 0.0;
+  float target_lead = 0.0;
+  uint32_t on_time = 0;
+  uint32_t late = 0;
+  uint32_t dropped = 0;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(lead, target_lead, on_time, late, dropped);
+  }
+};
@@ -0,0 +1,101 @@
+#include "playout_buffer.hpp"
+#include <algorithm>
+#include <math.h>
+
+// further than this from the delay we jump instead of drifting (0.25s)
+constexpr double RESYNC_TICKS = 16.0;
+// how much of the distance to the delay we make up per second
+constexpr double DRIFT_RATE = 2.0;
+
+void PlayoutBuffer::push(const GameState &snapshot) {
+  if (newest_tick_ &&
+      snapshot.tick + PLAYOUT_BUFFER_CAPACITY <= *newest_tick_) {
+    return; // too old to ever draw
+  }
+  Slot &slot = slots_[snapshot.tick % PLAYOUT_BUFFER_CAPACITY];
+  slot.state = snapshot;
+  slot.valid = true;
+  if (!newest_tick_ || snapshot.tick > *newest_tick_) {
+    newest_tick_ = snapshot.tick;
+  }
+}
+
+bool PlayoutBuffer::sample(double frame_time, GameState &out) {
+  if (!newest_tick_) {
+    return false;
+  }
+  double target = *newest_tick_ - delay_ticks_;
+  if (!render_tick_) {
+    render_tick_ = target;
+  } else {
+    *render_tick_ += frame_time / DESIRED_TICK_LENGTH;
+    double error = target - *render_tick_;
+    if (std::abs(error) > RESYNC_TICKS) {
+      render_tick_ = target;
+      stats_.resyncs++;
+    } else {
+      *render_tick_ += error * std::min(1.0, frame_time * DRIFT_RATE);
+    }
+  }
+  double render_tick = *render_tick_;
+  stats_.frames++;
+  stats_.depth = *newest_tick_ - render_tick;
+
+  if (render_tick >= *newest_tick_) {
+    // the next snapshot is late, keep everything moving for a little while
+    double ahead = render_tick - *newest_tick_;
+    if (ahead > 0.0) {
+      stats_.underruns++;
+    }
+    if (ahead > MAX_EXTRAPOLATION_TICKS) {
+      ahead = MAX_EXTRAPOLATION_TICKS;
+      stats_.holds++;
+    }
+    out = extrapolate(*find(*newest_tick_), ahead * DESIRED_TICK_LENGTH);
+    return true;
+  }
+
+  // the snapshots on either side, stepping over any that got lost
+  const GameState *before = nullptr;
+  const GameState *after = nullptr;
+  uint32_t first_after = 0;
+  if (render_tick >= 0.0) {
+    uint32_t tick = static_cast<uint32_t>(render_tick);
+    first_after = tick + 1;
+    while (before == nullptr &&
+           *newest_tick_ - tick < PLAYOUT_BUFFER_CAPACITY) {
+      before = find(tick);
+      if (tick-- == 0) {
+        break;
+      }
+    }
+  }
+  for (uint32_t tick = first_after; after == nullptr && tick <= *newest_tick_;
+       tick++) {
+    after = find(tick);
+  }
+  if (before == nullptr) {
+    out = *after; // nothing older, wait on the oldest we have
+    return true;
+  }
+  double a = (render_tick - before->tick) / (after->tick - before->tick);
+  out = interpolate(*before, *after, a);
+  return true;
+}
+
+void PlayoutBuffer::clear() {
+  for (Slot &slot : slots_) {
+    slot.valid = false;
+  }
+  newest_tick_ = std::nullopt;
+  render_tick_ = std::nullopt;
+  stats_ = {};
+}
+
+const GameState *PlayoutBuffer::find(uint32_t tick) const {
+  const Slot &slot = slots_[tick % PLAYOUT_BUFFER_CAPACITY];
+  if (!slot.valid || slot.state.tick != tick) {
+    return nullptr;
+  }
+  return &slot.state;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "game_state.hpp"
+#include <array>
+#include <optional>
+#include <stdint.h>
+
+// snapshots we keep around to draw from (1s at 64hz)
+constexpr uint32_t PLAYOUT_BUFFER_CAPACITY = 64;
+// how far behind the newest snapshot we draw by default, enough to ride out
+// a late snapshot or two
+constexpr double DEFAULT_PLAYOUT_DELAY = 0.05;
+// how long we keep things moving on their own when snapshots stop coming,
+// after that they stand still until the next one (0.1s at 64hz)
+constexpr double MAX_EXTRAPOLATION_TICKS = 6.0;
+
+// how the buffer is holding up, to tune the delay against the connection
+struct PlayoutStats {
+  // ticks between the state we drew and the newest snapshot, negative while
+  // extrapolating
+  double depth = 0.0;
+  uint64_t frames = 0;
+  uint64_t underruns = 0; // frames drawn past the newest snapshot
+  uint64_t holds = 0;     // frames that also ran out of extrapolation
+  uint64_t resyncs = 0;   // times we jumped to catch up with the delay
+};
+
+// Authoritative snapshots slotted by tick, drawn a fixed delay behind the
+// newest one so there is usually a snapshot on either side to interpolate
+// between. The time we draw advances with the frame time and drifts towards
+// the delay, so it stays smooth while snapshots arrive unevenly.
+class PlayoutBuffer {
+public:
+  explicit PlayoutBuffer(double delay = DEFAULT_PLAYOUT_DELAY)
+      : delay_ticks_(delay / DESIRED_TICK_LENGTH) {}
+
+  double delay() const { return delay_ticks_ * DESIRED_TICK_LENGTH; }
+  void setDelay(double seconds) {
+    delay_ticks_ = seconds / DESIRED_TICK_LENGTH;
+  }
+
+  void push(const GameState &snapshot);
+
+  // move on by a frame and work out the state to draw. false until the
+  // first snapshot arrives
+  bool sample(double frame_time, GameState &out);
+
+  void clear();
+  const PlayoutStats &stats() const { return stats_; }
+
+private:
+  struct Slot {
+    GameState state;
+    bool valid = false;
+  };
+
+  const GameState *find(uint32_t tick) const;
+
+  std::array<Slot, PLAYOUT_BUFFER_CAPACITY> slots_;
+  std::optional<uint32_t> newest_tick_;
+  std::optional<double> render_tick_;
+  double delay_ticks_;
+  PlayoutStats stats_;
+};
@@ -0,0 +1,238 @@
+#include "prediction_history.hpp"
+#include <algorithm>
+
+static bool sameButtons(const InputMessage &a, const InputMessage &b) {
+  return a.up == b.up && a.down == b.down && a.left == b.left &&
+         a.right == b.right && a.target_up == b.target_up &&
+         a.target_down == b.target_down && a.target_left == b.target_left &&
+         a.target_right == b.target_right && a.jump == b.jump &&
+         a.hit == b.hit;
+}
+
+// how far the paddles and the ball moved when we got corrected
+static float correctionBetween(const GameState &a, const GameState &b) {
+  return toFloat((a.p1.pos - b.p1.pos).magnitude2D()) +
+         toFloat((a.p2.pos - b.p2.pos).magnitude2D()) +
+         toFloat((a.p3.pos - b.p3.pos).magnitude2D()) +
+         toFloat((a.p4.pos - b.p4.pos).magnitude2D()) +
+         toFloat((a.ball.pos - b.ball.pos).magnitude2D());
+}
+
+TickInputs PredictionHistory::predictInputs(const InputMessage &input,
+                                            uint8_t local_player) {
+  TickInputs inputs;
+  for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+    inputs[player] =
+        player == local_player ? input : guessInput(player, input.tick);
+  }
+  return inputs;
+}
+
+void PredictionHistory::save(const TickInputs &inputs,
+                             const GameState &state) {
+  Slot &slot = slots_[state.tick % PREDICTION_HISTORY_CAPACITY];
+  slot.tick = state.tick;
+  slot.inputs = inputs;
+  slot.state = state;
+  slot.valid = true;
+  newest_tick_ = state.tick;
+}
+
+void PredictionHistory::confirmInput(uint8_t player,
+                                     const InputMessage &input) {
+  std::optional<uint32_t> &newest_confirmed = newest_confirmed_[player];
+  if (newest_confirmed &&
+      input.tick + PREDICTION_HISTORY_CAPACITY <= *newest_confirmed) {
+    return; // too old to keep
+  }
+  ConfirmedInput &confirmed =
+      confirmed_[player][input.tick % PREDICTION_HISTORY_CAPACITY];
+  if (confirmed.valid && confirmed.input.tick == input.tick) {
+    return; // the server relays repeats too
+  }
+  confirmed.input = input;
+  confirmed.valid = true;
+  if (!newest_confirmed || input.tick > *newest_confirmed) {
+    newest_confirmed = input.tick;
+  }
+  if (!newest_tick_) {
+    return;
+  }
+
+  // we guessed this input for its own tick and every tick after it up to
+  // the next one we know, fix up the guesses we already simulated
+  bool guessed_wrong = false;
+  for (uint32_t tick = input.tick; tick <= *newest_tick_; tick++) {
+    if (tick != input.tick && findConfirmed(player, tick) != nullptr) {
+      break;
+    }
+    Slot *slot = find(tick);
+    if (slot == nullptr || sameButtons(slot->inputs[player], input)) {
+      continue;
+    }
+    slot->inputs[player] = input;
+    slot->inputs[player].tick = tick;
+    markChanged(tick);
+    guessed_wrong = true;
+  }
+  if (guessed_wrong) {
+    stats_.input_corrections++;
+  }
+}
+
+ReconcileResult PredictionHistory::reconcile(const GameState &snapshot,
+                                             GameState &current) {
+  Slot *slot = find(snapshot.tick);
+  if (slot == nullptr || !newest_tick_ || *newest_tick_ < snapshot.tick) {
+    stats_.hard_snaps++;
+    return RECONCILE_MISSING;
+  }
+  uint32_t depth = *newest_tick_ - snapshot.tick;
+  stats_.depth = depth;
+  stats_.max_depth = std::max(stats_.max_depth, depth);
+
+  if (slot->state == snapshot) {
+    // this tick is settled now, only input changes after it still matter
+    if (changed_tick_ && *changed_tick_ <= snapshot.tick) {
+      changed_tick_ = snapshot.tick + 1;
+    }
+    return RECONCILE_MATCHED;
+  }
+
+  stats_.rollbacks++;
+  stats_.correction = correctionBetween(slot->state, snapshot);
+  stats_.max_correction = std::max(stats_.max_correction, stats_.correction);
+  slot->state = snapshot;
+  // the ticks we simulate again pick up every changed input on the way
+  changed_tick_ = std::nullopt;
+  simulateFrom(snapshot, current);
+  return RECONCILE_ROLLED_BACK;
+}
+
+void PredictionHistory::resimulate(GameState &current) {
+  if (!changed_tick_) {
+    return;
+  }
+  uint32_t tick = *changed_tick_;
+  changed_tick_ = std::nullopt;
+  const Slot *before = tick == 0 ? nullptr : find(tick - 1);
+  if (before == nullptr || !newest_tick_ || tick > *newest_tick_) {
+    return; // nothing to start from, the next snapshot will sort it out
+  }
+  simulateFrom(before->state, current);
+}
+
+const GameState *PredictionHistory::stateAt(uint32_t tick) const {
+  const Slot *slot = find(tick);
+  return slot == nullptr ? nullptr : &slot->state;
+}
+
+void PredictionHistory::restart(const GameState &state) {
+  for (Slot &slot : slots_) {
+    slot.valid = false;
+  }
+  Slot &slot = slots_[state.tick % PREDICTION_HISTORY_CAPACITY];
+  slot.tick = state.tick;
+  slot.inputs = {};
+  slot.state = state;
+  slot.valid = true;
+  newest_tick_ = state.tick;
+  changed_tick_ = std::nullopt;
+}
+
+void PredictionHistory::clear() {
+  for (Slot &slot : slots_) {
+    slot.valid = false;
+  }
+  for (auto &player : confirmed_) {
+    for (ConfirmedInput &confirmed : player) {
+      confirmed.valid = false;
+    }
+  }
+  newest_tick_ = std::nullopt;
+  newest_confirmed_ = {};
+  changed_tick_ = std::nullopt;
+  stats_ = {};
+}
+
+PredictionHistory::Slot *PredictionHistory::find(uint32_t tick) {
+  Slot &slot = slots_[tick % PREDICTION_HISTORY_CAPACITY];
+  if (!slot.valid || slot.tick != tick) {
+    return nullptr;
+  }
+  return &slot;
+}
+
+const PredictionHistory::Slot *PredictionHistory::find(uint32_t tick) const {
+  const Slot &slot = slots_[tick % PREDICTION_HISTORY_CAPACITY];
+  if (!slot.valid || slot.tick != tick) {
+    return nullptr;
+  }
+  return &slot;
+}
+
+const InputMessage *PredictionHistory::findConfirmed(uint8_t player,
+                                                     uint32_t tick) const {
+  const ConfirmedInput &confirmed =
+      confirmed_[player][tick % PREDICTION_HISTORY_CAPACITY];
+  if (!confirmed.valid || confirmed.input.tick != tick) {
+    return nullptr;
+  }
+  return &confirmed.input;
+}
+
+// the player's input for this tick if we have it, otherwise the last one we
+// have from before it, otherwise nothing pressed
+InputMessage PredictionHistory::guessInput(uint8_t player,
+                                           uint32_t tick) const {
+  InputMessage guess;
+  if (const InputMessage *exact = findConfirmed(player, tick)) {
+    guess = *exact;
+  } else if (newest_confirmed_[player]) {
+    // usually the newest we have is from before this tick, if the player is
+    // further ahead than us we have to look back for one
+    uint32_t newest = *newest_confirmed_[player];
+    uint32_t last = newest < tick ? newest : tick - 1;
+    while (tick != 0 && tick - last <= PREDICTION_HISTORY_CAPACITY) {
+      if (const InputMessage *previous = findConfirmed(player, last)) {
+        guess = *previous;
+        break;
+      }
+      if (last == 0) {
+        break;
+      }
+      last--;
+    }
+  }
+  guess.tick = tick;
+  return guess;
+}
+
+void PredictionHistory::markChanged(uint32_t tick) {
+  if (!changed_tick_ || tick < *changed_tick_) {
+    changed_tick_ = tick;
+  }
+}
+
+// simulate every tick after state's up to our newest again
+uint32_t PredictionHistory::simulateFrom(GameState state, GameState &current) {
+  uint32_t ticks = 0;
+  for (uint32_t tick = state.tick + 1; tick <= *newest_tick_; tick++) {
+    Slot *slot = find(tick);
+    if (slot == nullptr) {
+      break; // can't happen, save() runs every tick
+    }
+    for (uint8_t player = 0; player < PLAYERS_PER_ROOM; player++) {
+      updatePlayerState(state, slot->inputs[player], DESIRED_TICK_LENGTH,
+                        player);
+    }
+    updateGameState(state, DESIRED_TICK_LENGTH);
+    state.tick = tick;
+    slot->state = state;
+    ticks++;
+  }
+  current = state;
+  stats_.resimulated_ticks += ticks;
+  stats_.total_resimulated_ticks += ticks;
+  return ticks;
+}
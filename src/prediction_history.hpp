@@ -0,0 +1,103 @@
+#pragma once
+#include "game_state.hpp"
+#include <array>
+#include <optional>
+#include <stdint.h>
+
+// how far back we can roll our prediction (4s at 64hz)
+constexpr uint32_t PREDICTION_HISTORY_CAPACITY = 256;
+
+using TickInputs = std::array<InputMessage, PLAYERS_PER_ROOM>;
+
+enum ReconcileResult {
+  // the snapshot agrees with what we predicted for its tick
+  RECONCILE_MATCHED,
+  // it didn't, we rolled back to it and simulated every newer tick again
+  RECONCILE_ROLLED_BACK,
+  // we have no prediction for its tick, too old or newer than ours
+  RECONCILE_MISSING,
+};
+
+// what rollback has been costing us, shown in the debug overlay
+struct RollbackStats {
+  uint32_t depth = 0; // how far behind our newest tick the last snapshot was
+  uint32_t resimulated_ticks = 0; // this frame
+  uint32_t max_depth = 0;
+  uint64_t rollbacks = 0; // snapshots that disagreed with our prediction
+  // how far the paddles and the ball were off, summed, on the last rollback
+  float correction = 0.0f;
+  float max_correction = 0.0f;
+  // remote inputs that turned out different from what we guessed
+  uint64_t input_corrections = 0;
+  uint64_t total_resimulated_ticks = 0;
+  uint64_t hard_snaps = 0;
+};
+
+// The inputs of all four players and the states the client predicted from
+// them, slotted by tick so a snapshot finds the tick it was computed for
+// without a search. Our own inputs are known, the other players' come from
+// the server as it receives them. Until they do we guess that each player is
+// still pressing whatever they pressed last, and once the real input shows
+// up and differs we simulate again from that tick.
+class PredictionHistory {
+public:
+  // what all four players are pressing on input.tick, as best we know
+  TickInputs predictInputs(const InputMessage &input, uint8_t local_player);
+  // the state we predicted after simulating inputs
+  void save(const TickInputs &inputs, const GameState &state);
+
+  // another player's input, relayed by the server
+  void confirmInput(uint8_t player, const InputMessage &input);
+
+  // compare a snapshot with our prediction for its tick. if they differ the
+  // snapshot replaces it and every newer tick is simulated again on top,
+  // leaving the newest state in current
+  ReconcileResult reconcile(const GameState &snapshot, GameState &current);
+
+  // simulate again from the oldest tick whose inputs changed since the last
+  // time, if any, leaving the newest state in current
+  void resimulate(GameState &current);
+
+  // what we predicted for tick, nullptr if we have nothing for it
+  const GameState *stateAt(uint32_t tick) const;
+
+  // throw our predictions away and carry on from this state
+  void restart(const GameState &state);
+  // forget everything, for a new match
+  void clear();
+
+  // per frame numbers are reset here
+  void beginFrame() { stats_.resimulated_ticks = 0; }
+  const RollbackStats &stats() const { return stats_; }
+
+private:
+  struct Slot {
+    uint32_t tick = 0;
+    TickInputs inputs;
+    GameState state;
+    bool valid = false;
+  };
+
+  struct ConfirmedInput {
+    InputMessage input;
+    bool valid = false;
+  };
+
+  Slot *find(uint32_t tick);
+  const Slot *find(uint32_t tick) const;
+  const InputMessage *findConfirmed(uint8_t player, uint32_t tick) const;
+  InputMessage guessInput(uint8_t player, uint32_t tick) const;
+  void markChanged(uint32_t tick);
+  uint32_t simulateFrom(GameState state, GameState &current);
+
+  std::array<Slot, PREDICTION_HISTORY_CAPACITY> slots_;
+  std::optional<uint32_t> newest_tick_;
+  // inputs the server relayed, by player then tick
+  std::array<std::array<ConfirmedInput, PREDICTION_HISTORY_CAPACITY>,
+             PLAYERS_PER_ROOM>
+      confirmed_;
+  std::array<std::optional<uint32_t>, PLAYERS_PER_ROOM> newest_confirmed_;
+  // oldest tick whose inputs changed after we simulated it
+  std::optional<uint32_t> changed_tick_;
+  RollbackStats stats_;
+};
@@ -0,0 +1,180 @@
+// svb_replay simulates matches recorded by svb_server --record again,
+// headless and as fast as it can, and checks that every keyframe in the log
+// comes out bit for bit the same. give it log files or directories of them,
+// they're replayed in parallel. exits with 1 if any match diverged and 2 if
+// a log couldn't be read
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "match_replay.hpp"
+#include "state_dump.hpp"
+#include "wire_format.hpp"
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+struct Job {
+  explicit Job(std::string path) : path(std::move(path)) {}
+
+  std::string path;
+  std::string error;
+  uint32_t num_ticks = 0;
+  bool finished = false;
+  ReplayResult result;
+  double seconds = 0.0;
+};
+
+void printUsage() {
+  std::cerr << "usage: svb_replay [--jobs N] LOG|DIR...\n"
+               "       svb_replay --seek TICK [--dump FILE] LOG"
+            << std::endl;
+}
+
+void runJob(Job &job) {
+  MatchLog log;
+  if (!log.open(job.path)) {
+    job.error = log.error();
+    return;
+  }
+  job.num_ticks = log.numTicks();
+  job.finished = log.finished() && !log.dropped();
+  auto start = steady_clock::now();
+  job.result = log.replay();
+  job.seconds = duration<double>(steady_clock::now() - start).count();
+}
+
+// one match, up to one tick, starting from the keyframe before it
+int seekTo(const std::string &path, uint32_t tick,
+           const std::string &dump_path) {
+  MatchLog log;
+  auto start = steady_clock::now();
+  if (!log.open(path)) {
+    std::cerr << path << ": " << log.error() << std::endl;
+    return 2;
+  }
+  double open_seconds = duration<double>(steady_clock::now() - start).count();
+  start = steady_clock::now();
+  ReplayResult result;
+  if (!log.seek(tick, result)) {
+    std::cerr << path << " only has " << log.numTicks() << " ticks"
+              << std::endl;
+    return 2;
+  }
+  double seek_seconds = duration<double>(steady_clock::now() - start).count();
+
+  std::cout << "tick " << tick << " from the keyframe " << result.ticks
+            << " ticks before it in " << std::fixed << std::setprecision(3)
+            << seek_seconds * 1000.0 << " ms (opening and indexing "
+            << log.numKeyframes() << " keyframes took "
+            << open_seconds * 1000.0 << " ms)" << std::endl;
+  std::cout << "score " << result.state.team1_score << " - "
+            << result.state.team2_score << ", state hash " << std::hex
+            << hashGameState(result.state) << std::dec << std::endl;
+  if (!dump_path.empty() && !writeStateDump(dump_path, result.state)) {
+    std::cerr << "couldn't write " << dump_path << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::optional<uint32_t> seek_tick;
+  std::string dump_path;
+  std::vector<std::string> paths;
+
+  int curr_arg = 0;
+  while (++curr_arg != argc) {
+    bool has_value = curr_arg + 1 != argc;
+    if (strcmp(argv[curr_arg], "--jobs") == 0 && has_value) {
+      num_threads = std::max(1, atoi(argv[++curr_arg]));
+    } else if (strcmp(argv[curr_arg], "--seek") == 0 && has_value) {
+      seek_tick = strtoul(argv[++curr_arg], nullptr, 10);
+    } else if (strcmp(argv[curr_arg], "--dump") == 0 && has_value) {
+      dump_path = argv[++curr_arg];
+    } else if (argv[curr_arg][0] == '-') {
+      printUsage();
+      return 2;
+    } else {
+      paths.push_back(argv[curr_arg]);
+    }
+  }
+  if (paths.empty() || (seek_tick && paths.size() != 1) ||
+      (!dump_path.empty() && !seek_tick)) {
+    printUsage();
+    return 2;
+  }
+  if (seek_tick) {
+    return seekTo(paths[0], *seek_tick, dump_path);
+  }
+
+  std::vector<Job> jobs;
+  for (const std::string &path : paths) {
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error)) {
+      jobs.emplace_back(path);
+      continue;
+    }
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      if (entry.path().extension() == ".svbm") {
+        jobs.emplace_back(entry.path().string());
+      }
+    }
+  }
+  std::sort(jobs.begin(), jobs.end(),
+            [](const Job &a, const Job &b) { return a.path < b.path; });
+
+  // every thread takes the next match nobody has taken yet
+  auto start = steady_clock::now();
+  std::atomic<size_t> next_job{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < std::min(num_threads, jobs.size()); i++) {
+    threads.emplace_back([&]() {
+      for (size_t job = next_job++; job < jobs.size(); job = next_job++) {
+        runJob(jobs[job]);
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  double seconds = duration<double>(steady_clock::now() - start).count();
+
+  int exit_code = 0;
+  uint64_t total_ticks = 0;
+  for (const Job &job : jobs) {
+    std::cout << job.path << ": ";
+    if (!job.error.empty()) {
+      std::cout << job.error << std::endl;
+      exit_code = std::max(exit_code, 2);
+      continue;
+    }
+    total_ticks += job.result.ticks;
+    std::cout << job.result.ticks << " ticks"
+              << (job.finished ? "" : " (unfinished)") << ", "
+              << std::fixed << std::setprecision(0)
+              << job.result.ticks / job.seconds << " ticks/s, ";
+    if (job.result.diverged) {
+      std::cout << "DIVERGED at the keyframe for tick "
+                << job.result.diverged_tick << ", first in "
+                << job.result.diverged_field << std::endl;
+      exit_code = std::max(exit_code, 1);
+    } else {
+      std::cout << job.result.keyframes << " keyframes match" << std::endl;
+    }
+  }
+  std::cout << jobs.size() << " matches, " << total_ticks << " ticks in "
+            << std::fixed << std::setprecision(3) << seconds << " s on "
+            << threads.size() << " threads, " << std::setprecision(0)
+            << total_ticks / seconds << " ticks/s" << std::endl;
+  return exit_code;
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+// The number type the simulation runs on. By default that is float, which is
+// fast but can round differently between compilers and platforms. Building
+// with SVB_FIXED_POINT swaps in Fixed, which only does integer math and so
+// gives bit identical results everywhere at some cost per tick.
+
+// Q15.16 fixed point in an int32_t, so a GameState keeps its size and layout.
+// Every intermediate is computed in 64 bits and saturates instead of
+// overflowing, and dividing by zero saturates too, so nothing is undefined.
+// Conversions from float and double round to the nearest step (1/65536), which
+// is exact for the tick length.
+class Fixed {
+public:
+  static constexpr int FRACTION_BITS = 16;
+  static constexpr int64_t ONE = int64_t(1) << FRACTION_BITS;
+
+  constexpr Fixed() = default;
+  constexpr Fixed(double value) : raw_(saturate(roundToRaw(value))) {}
+
+  static constexpr Fixed fromRaw(int32_t raw) {
+    Fixed fixed;
+    fixed.raw_ = raw;
+    return fixed;
+  }
+
+  constexpr int32_t raw() const { return raw_; }
+  constexpr float toFloat() const { return static_cast<float>(toDouble()); }
+  constexpr double toDouble() const { return static_cast<double>(raw_) / ONE; }
+  explicit constexpr operator float() const { return toFloat(); }
+  explicit constexpr operator double() const { return toDouble(); }
+  explicit constexpr operator int() const { return raw_ / ONE; }
+
+  constexpr Fixed operator-() const { return fromRaw64(-int64_t(raw_)); }
+
+  friend constexpr Fixed operator+(Fixed a, Fixed b) {
+    return fromRaw64(int64_t(a.raw_) + b.raw_);
+  }
+  friend constexpr Fixed operator-(Fixed a, Fixed b) {
+    return fromRaw64(int64_t(a.raw_) - b.raw_);
+  }
+  // both round to nearest, halves away from zero
+  friend constexpr Fixed operator*(Fixed a, Fixed b) {
+    return roundedQuotient(int64_t(a.raw_) * b.raw_, ONE);
+  }
+  friend constexpr Fixed operator/(Fixed a, Fixed b) {
+    if (b.raw_ == 0) {
+      return fromRaw64(a.raw_ > 0 ? INT32_MAX : a.raw_ < 0 ? INT32_MIN : 0);
+    }
+    return roundedQuotient(int64_t(a.raw_) * ONE, b.raw_);
+  }
+
+  constexpr Fixed &operator+=(Fixed b) { return *this = *this + b; }
+  constexpr Fixed &operator-=(Fixed b) { return *this = *this - b; }
+  constexpr Fixed &operator*=(Fixed b) { return *this = *this * b; }
+  constexpr Fixed &operator/=(Fixed b) { return *this = *this / b; }
+
+  friend constexpr bool operator==(Fixed a, Fixed b) {
+    return a.raw_ == b.raw_;
+  }
+  friend constexpr bool operator!=(Fixed a, Fixed b) {
+    return a.raw_ != b.raw_;
+  }
+  friend constexpr bool operator<(Fixed a, Fixed b) { return a.raw_ < b.raw_; }
+  friend constexpr bool operator<=(Fixed a, Fixed b) {
+    return a.raw_ <= b.raw_;
+  }
+  friend constexpr bool operator>(Fixed a, Fixed b) { return a.raw_ > b.raw_; }
+  friend constexpr bool operator>=(Fixed a, Fixed b) {
+    return a.raw_ >= b.raw_;
+  }
+
+  // rounded down
+  Fixed sqrt() const {
+    if (raw_ <= 0) {
+      return Fixed();
+    }
+    return fromRaw64(isqrt(static_cast<uint64_t>(raw_) << FRACTION_BITS));
+  }
+
+  // sqrt(x * x + y * y) without x * x overflowing the 16 integer bits
+  static Fixed hypot(Fixed x, Fixed y) {
+    uint64_t xx = static_cast<uint64_t>(int64_t(x.raw_) * x.raw_);
+    uint64_t yy = static_cast<uint64_t>(int64_t(y.raw_) * y.raw_);
+    return fromRaw64(isqrt(xx + yy));
+  }
+
+  template <class Archive> void serialize(Archive &archive) { archive(raw_); }
+
+private:
+  static constexpr int64_t roundToRaw(double value) {
+    double scaled = value * ONE;
+    if (!(scaled < 4.0 * INT32_MAX)) {
+      return scaled > 0 ? INT64_MAX : 0; // and NaN becomes 0
+    }
+    if (!(scaled > 4.0 * INT32_MIN)) {
+      return INT64_MIN;
+    }
+    return static_cast<int64_t>(scaled >= 0 ? scaled + 0.5 : scaled - 0.5);
+  }
+
+  static constexpr int32_t saturate(int64_t raw) {
+    return raw > INT32_MAX   ? INT32_MAX
+           : raw < INT32_MIN ? INT32_MIN
+                             : static_cast<int32_t>(raw);
+  }
+
+  static constexpr Fixed fromRaw64(int64_t raw) {
+    return fromRaw(saturate(raw));
+  }
+
+  static constexpr Fixed roundedQuotient(int64_t numerator,
+                                         int64_t denominator) {
+    bool negative = (numerator < 0) != (denominator < 0);
+    uint64_t n = numerator < 0 ? -uint64_t(numerator) : uint64_t(numerator);
+    uint64_t d =
+        denominator < 0 ? -uint64_t(denominator) : uint64_t(denominator);
+    uint64_t quotient = (n + d / 2) / d;
+    if (quotient > uint64_t(INT32_MAX) + 1) {
+      quotient = uint64_t(INT32_MAX) + 1;
+    }
+    return fromRaw64(negative ? -int64_t(quotient) : int64_t(quotient));
+  }
+
+  // floor(sqrt(value)). IEEE sqrt is correctly rounded, so the estimate is
+  // the same everywhere, and the fix up makes it exact
+  static uint64_t isqrt(uint64_t value) {
+    uint64_t root =
+        static_cast<uint64_t>(std::sqrt(static_cast<double>(value)));
+    while (root * root > value) {
+      root--;
+    }
+    while ((root + 1) * (root + 1) <= value) {
+      root++;
+    }
+    return root;
+  }
+
+  int32_t raw_ = 0;
+};
+
+static_assert(sizeof(Fixed) == sizeof(float), "Fixed must fit where float was");
+static_assert(Fixed(1.0 / 64.0) * 64.0 == 1.0, "tick length must be exact");
+
+#ifdef SVB_FIXED_POINT
+using Scalar = Fixed;
+constexpr bool SCALAR_IS_FIXED = true;
+
+inline Scalar scalarSqrt(Scalar value) { return value.sqrt(); }
+inline Scalar scalarAbs(Scalar value) { return value < 0.0 ? -value : value; }
+inline Scalar length2D(Scalar x, Scalar y) { return Fixed::hypot(x, y); }
+constexpr float toFloat(Scalar value) { return value.toFloat(); }
+#else
+using Scalar = float;
+constexpr bool SCALAR_IS_FIXED = false;
+
+inline Scalar scalarSqrt(Scalar value) { return std::sqrt(value); }
+inline Scalar scalarAbs(Scalar value) { return std::abs(value); }
+inline Scalar length2D(Scalar x, Scalar y) {
+  return std::sqrt((x * x) + (y * y));
+}
+constexpr float toFloat(Scalar value) { return value; }
+#endif
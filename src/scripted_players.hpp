@@ -0,0 +1,111 @@
+#pragma once
+#include "game_state.hpp"
+#include <array>
+#include <random>
+#include <stdint.h>
+
+// Stand ins for the four players of a match, for the benchmark and the load
+// testing bot. Both give an input for one player at a time, the same seed
+// always plays the same way.
+
+// plays like a person would: serve, chase the ball, hit it whenever it's
+// close, and jump to spike on the second pass
+class ScriptedPlayers {
+public:
+  explicit ScriptedPlayers(uint64_t seed) : rng_(seed) {}
+
+  InputMessage input(const GameState &state, uint8_t player) {
+    InputMessage input;
+    const PhysicsState &paddle = paddleOf(state, player);
+    bool is_owner = state.ball_owner == player + 1;
+
+    Vec3 goal = state.ball.pos;
+    if (state.ball_state == BALL_STATE_FIRST_PASS ||
+        state.ball_state == BALL_STATE_SECOND_PASS ||
+        state.ball_state == BALL_STATE_TRAVELLING) {
+      goal = state.landing_zone.pos;
+    }
+    // sometimes wander off so that we also miss and lose points
+    if (rng_() % 512 == 0) {
+      wander_ticks_[player] = TICK_RATE;
+    }
+    if (wander_ticks_[player] > 0) {
+      wander_ticks_[player]--;
+      goal.x = arena_width - goal.x;
+    }
+    input.left = goal.x < paddle.pos.x - paddle_width / 2;
+    input.right = goal.x > paddle.pos.x + paddle_width / 2;
+    input.up = goal.y < paddle.pos.y - paddle_height / 2;
+    input.down = goal.y > paddle.pos.y + paddle_height / 2;
+
+    if (is_owner) {
+      // aim around a bit
+      input.target_up = rng_() % 4 == 0;
+      input.target_left = rng_() % 4 == 0;
+      if (state.ball_state == BALL_STATE_READY_TO_SERVE) {
+        input.jump = rng_() % 32 == 0;
+      } else if (state.ball_state == BALL_STATE_IN_SERVICE) {
+        // now and then hold on too long and fail the serve
+        input.hit = rng_() % 48 == 0;
+      } else if (state.ball_state == BALL_STATE_SECOND_PASS) {
+        input.jump = rng_() % 2 == 0;
+        input.hit = paddle.pos.z > spiking_min_player_z || rng_() % 8 == 0;
+      } else {
+        input.hit = true;
+      }
+    } else {
+      input.hit = true;
+      // try to block near the net
+      input.jump = state.is_blocking_allowed && rng_() % 4 == 0;
+    }
+    return input;
+  }
+
+private:
+  static const PhysicsState &paddleOf(const GameState &state, uint8_t player) {
+    switch (player) {
+    case 0:
+      return state.p1;
+    case 1:
+      return state.p2;
+    case 2:
+      return state.p3;
+    default:
+      return state.p4;
+    }
+  }
+
+  std::mt19937_64 rng_;
+  std::array<uint32_t, PLAYERS_PER_ROOM> wander_ticks_ = {};
+};
+
+// mashes buttons, holding each combination for a few ticks
+class RandomPlayers {
+public:
+  explicit RandomPlayers(uint64_t seed) : rng_(seed) {}
+
+  InputMessage input(const GameState &, uint8_t player) {
+    if (hold_ticks_[player] == 0) {
+      uint64_t bits = rng_();
+      InputMessage &input = held_[player];
+      input.up = bits & (1 << 0);
+      input.down = bits & (1 << 1);
+      input.left = bits & (1 << 2);
+      input.right = bits & (1 << 3);
+      input.target_up = bits & (1 << 4);
+      input.target_down = bits & (1 << 5);
+      input.target_left = bits & (1 << 6);
+      input.target_right = bits & (1 << 7);
+      input.jump = bits & (1 << 8);
+      input.hit = bits & (1 << 9);
+      hold_ticks_[player] = 1 + (bits >> 10) % 16;
+    }
+    hold_ticks_[player]--;
+    return held_[player];
+  }
+
+private:
+  std::mt19937_64 rng_;
+  std::array<InputMessage, PLAYERS_PER_ROOM> held_;
+  std::array<uint32_t, PLAYERS_PER_ROOM> hold_ticks_ = {};
+};
@@ -1,29 +1,99 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstring>
+#include <deque>
 #include <iomanip>
 #include <iostream>
-#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <random>
 #include <steam/isteamnetworkingutils.h>
 #include <steam/steamnetworkingsockets.h>
 #include <string>
-#include <strstream>
 #include <thread>
 #include <unordered_map>
 
 #include "game_state.hpp"
+#include "input_lead.hpp"
+#include "input_ring.hpp"
+#include "match_recorder.hpp"
+#include "metrics_server.hpp"
+#include "net_impairment.hpp"
+#include "net_message.hpp"
+#include "snapshot_delta.hpp"
+#include "tick_scheduler.hpp"
+#include "trace.hpp"
 
 using std::chrono::duration;
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::chrono::system_clock;
 
 constexpr uint16_t PORT = 25565;
-constexpr uint32_t CLIENT_RUNWAY = 2;
+constexpr uint32_t INPUT_TIMING_INTERVAL = TICK_RATE / 4;
+// a room that falls further behind than this skips ticks instead (0.125s)
+constexpr uint32_t MAX_CATCH_UP_TICKS = 8;
+constexpr auto STATS_REPORT_INTERVAL = seconds(10);
+constexpr int MESSAGE_BATCH_SIZE = 64;
+
+// per-connection context, GNS hands a pointer to it back with every message
+struct ClientConnection {
+  HSteamNetConnection connection = k_HSteamNetConnection_Invalid;
+  int room_id = -1;
+  int player_index = -1;
+};
+
+// a room's series in the metrics registry, labelled with its number
+struct RoomMetrics {
+  RoomMetrics(MetricsRegistry &registry, int room)
+      : step_time(registry.histogram("svb_room_step_seconds",
+                                     "Time spent simulating a step, "
+                                     "sampled every 8th step",
+                                     label("room", room))),
+        ticks(registry.counter("svb_room_ticks_total", "Ticks simulated",
+                               label("room", room))),
+        players(registry.gauge("svb_room_players", "Players in the room",
+                               label("room", room))),
+        broadcast_time(registry.histogram(
+            "svb_room_broadcast_seconds",
+            "Time spent encoding and sending a tick's state",
+            label("room", room))),
+        snapshots_sent(registry.counter("svb_room_snapshots_sent_total",
+                                        "Snapshots sent to players",
+                                        label("room", room))),
+        state_hashes_sent(registry.counter(
+            "svb_room_state_hashes_sent_total",
+            "State hashes sent to players in sync", label("room", room))),
+        messages_sent(registry.counter("svb_room_messages_sent_total",
+                                       "Messages sent to the room's players",
+                                       label("room", room))),
+        bytes_sent(registry.counter("svb_room_bytes_sent_total",
+                                    "Bytes sent to the room's players",
+                                    label("room", room))) {
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+      input_queue_depth[i] = &registry.gauge(
+          "svb_room_input_queue_depth",
+          "Ticks of input a player has queued ahead of the simulation, "
+          "sampled every 8th step",
+          label("room", room) + "," + label("player", i));
+    }
+  }
+
+  LatencyHistogram &step_time;
+  Counter &ticks;
+  Gauge &players;
+  std::array<Gauge *, PLAYERS_PER_ROOM> input_queue_depth;
+  LatencyHistogram &broadcast_time;
+  Counter &snapshots_sent;
+  Counter &state_hashes_sent;
+  Counter &messages_sent;
+  Counter &bytes_sent;
+};
 
 class Room {
 public:
@@ -32,7 +102,21 @@ public:
   GameState game_state;
   std::array<std::optional<HSteamNetConnection>, PLAYERS_PER_ROOM> players;
   std::function<void()> propogate_state_callback;
+  TickScheduler *scheduler = nullptr;
+  // set when the server records matches
+  MatchRecorder *recorder = nullptr;
+  RoomMetrics *metrics = nullptr;
   uint32_t should_ping_counter = 0;
+  // snapshots we've broadcast, only touched from the tick thread
+  SnapshotHistory sent_snapshots;
+  // newest snapshot tick + 1 each player acked, 0 if none
+  std::array<std::atomic<uint32_t>, PLAYERS_PER_ROOM> acked_snapshot_tags;
+  // players whose prediction matched what we sent them, they get a hash of
+  // each tick instead of a snapshot
+  std::array<std::atomic<bool>, PLAYERS_PER_ROOM> in_sync;
+  // published alongside game_state
+  InputAcks input_acks = {};
+  std::array<InputTiming, PLAYERS_PER_ROOM> input_timing;
 
   std::optional<size_t> playerIndexOfConnection(HSteamNetConnection conn) {
     for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
@@ -45,126 +129,267 @@ public:
 
   void startMatch() {
     resetGameState(game_state);
+    // a new seed every match, the clients get it with the first snapshot
+    game_state.rng_seed = std::random_device()();
+    sim_state_ = game_state;
+    sent_snapshots.clear();
+    for (std::atomic<uint32_t> &tag : acked_snapshot_tags) {
+      tag = 0;
+    }
+    for (std::atomic<bool> &player_in_sync : in_sync) {
+      player_in_sync = false;
+    }
+    input_acks = {};
+    input_timing = {};
+    for (InputLeadTracker &lead : leads_) {
+      lead.reset();
+    }
     room_state.state = RS_PLAYING;
-    game_tick_thread_ = std::thread(&Room::gameLogicThread, this);
+    waiting_for_clients_ = true;
+    tick_ = 0;
+    if (recorder != nullptr) {
+      recorder->begin(room_state.current_room, sim_state_);
+    }
+    tick_task_ =
+        scheduler->add([this](uint32_t ticks_due) { step(ticks_due); });
   }
 
   void endMatch() {
     {
       std::scoped_lock l(lock);
       room_state.state = RS_WAITING;
-      message_queue_.clear();
     }
-    game_tick_thread_.join();
+    scheduler->remove(tick_task_);
+    if (recorder != nullptr) {
+      recorder->end();
+    }
+    metrics->ticks.add(unreported_ticks_);
+    unreported_ticks_ = 0;
+    // the tick thread is gone and we are the only producer, so this is safe
+    for (InputRing &inputs : inputs_) {
+      inputs.reset();
+    }
   }
 
-  void feedInput(InputMessage input, int player_index) {
-    std::scoped_lock l(lock);
-    message_queue_.push_back(std::make_pair(input, player_index));
+  // called from the network thread, never blocks on the tick thread.
+  // returns false if we already had it or it came too late or too early
+  bool feedInput(const InputMessage &input, int player_index) {
+    return inputs_[player_index].push(input);
   }
 
-private:
-  // game logic thread
-  std::list<std::pair<InputMessage, int>>
-      message_queue_; // pair (input, player_idx)
-  std::thread game_tick_thread_;
+  // repeats of inputs we already had, safe to read from any thread
+  uint64_t inputDuplicates(int player_index) const {
+    return inputs_[player_index].duplicates();
+  }
 
-  bool areClientsAhead(std::array<bool, PLAYERS_PER_ROOM> &ready_list) {
-    {
-      std::scoped_lock l(lock);
-      for (const auto &pair : message_queue_) {
-        if (pair.first.tick >= CLIENT_RUNWAY) {
-          ready_list[pair.second] = true;
-        }
-      }
-    }
+private:
+  // game logic, stepped by the tick scheduler
+  std::array<InputRing, PLAYERS_PER_ROOM> inputs_;
+  std::array<InputLeadTracker, PLAYERS_PER_ROOM> leads_;
+  GameState sim_state_; // only touched by the tick thread while playing
+  TickScheduler::TaskId tick_task_ = 0;
+  bool waiting_for_clients_ = true;
+  uint32_t tick_ = 0;
+  uint32_t steps_ = 0;
+  uint32_t unreported_ticks_ = 0; // ticked since the last sampled step
 
-    return std::all_of(std::begin(ready_list), std::end(ready_list),
-                       [](bool i) { return i; });
+  bool areClientsAhead() {
+    return std::all_of(std::begin(inputs_), std::end(inputs_),
+                       [](const InputRing &i) {
+                         return i.hasReached(
+                             static_cast<uint32_t>(INITIAL_INPUT_LEAD));
+                       });
   }
 
-  void gameLogicThread() {
+  void step(uint32_t ticks_due) {
     // wait for clients to get ahead before starting the game loop
-    std::array<bool, PLAYERS_PER_ROOM> ready; // TODO: bitset
-    ready.fill(false);
-    while (!areClientsAhead(ready)) {
-      std::this_thread::sleep_for(
-          std::chrono::milliseconds((int)(DESIRED_TICK_LENGTH * 1000.0)));
+    if (waiting_for_clients_) {
+      if (!areClientsAhead()) {
+        return;
+      }
+      // the first tick happens as soon as everyone is ready
+      waiting_for_clients_ = false;
+      ticks_due = 1;
     }
 
-    double delta_time = 0.0;
-    double time = 0.0;
-    uint32_t tick = 0;
-
-    auto frame_start = steady_clock::now();
-    double time_accumulator =
-        DESIRED_TICK_LENGTH; // this forces a tick on the first frame
-
-    // game loop
-    while (true) {
-      double delta_time =
-          static_cast<duration<double>>(steady_clock::now() - frame_start)
-              .count();
-      frame_start = steady_clock::now();
-
-      // lock room state
+    // move game logic forward in equally sized ticks
+    TRACE_SPAN("Room::step");
+    bool timed = steps_++ % STEP_TIME_SAMPLE_INTERVAL == 0;
+    steady_clock::time_point step_start;
+    if (timed) {
+      step_start = steady_clock::now();
+    }
+    for (uint32_t i = 0; i < ticks_due; i++) {
+      // consume inputs that correspond to this tick
+      std::array<InputMessage, PLAYERS_PER_ROOM> inputs;
+      uint8_t players_with_input = 0;
       {
-        std::scoped_lock l(lock);
-        // should we exit?
-        if (room_state.state != RS_PLAYING) {
-          break;
+        TRACE_SPAN("consume inputs");
+        for (int player = 0; player < PLAYERS_PER_ROOM; player++) {
+          leads_[player].sample(inputs_[player].leadOver(tick_));
+          if (inputs_[player].consume(tick_, inputs[player])) {
+            players_with_input |= 1 << player;
+          }
         }
+      }
+      for (int player = 0; player < PLAYERS_PER_ROOM; player++) {
+        if (players_with_input & (1 << player)) {
+          updatePlayerState(sim_state_, inputs[player], DESIRED_TICK_LENGTH,
+                            player);
+        }
+      }
 
-        time_accumulator += delta_time;
-
-        // move game logic forward in equally sized ticks
-        while (time_accumulator >= DESIRED_TICK_LENGTH) {
-          time_accumulator -= DESIRED_TICK_LENGTH;
-
-          // consume inputs that correspond to this tick
-          auto input_iterator = message_queue_.begin();
-          while (input_iterator != message_queue_.end()) {
-            if (input_iterator->first.tick == tick) {
-              updatePlayerState(game_state, input_iterator->first,
-                                DESIRED_TICK_LENGTH, input_iterator->second);
-              input_iterator = message_queue_.erase(input_iterator);
-            } else {
-              input_iterator++;
-            }
-          }
+      updateGameState(sim_state_, DESIRED_TICK_LENGTH);
+      sim_state_.tick = tick_;
+      if (recorder != nullptr) {
+        recorder->recordTick(players_with_input, inputs, sim_state_);
+      }
+      tick_++;
+    }
+    unreported_ticks_ += ticks_due;
+    if (timed) {
+      metrics->step_time.observe(
+          duration_cast<nanoseconds>(steady_clock::now() - step_start)
+              .count());
+      metrics->ticks.add(unreported_ticks_);
+      unreported_ticks_ = 0;
+      for (int player = 0; player < PLAYERS_PER_ROOM; player++) {
+        metrics->input_queue_depth[player]->set(
+            std::max(0, inputs_[player].leadOver(tick_)));
+      }
+    }
 
-          updateGameState(game_state, DESIRED_TICK_LENGTH);
-          game_state.tick = tick;
-          tick++;
-        }
+    // only hold the lock long enough to publish the result
+    {
+      std::scoped_lock l(lock);
+      // has the match ended under us?
+      if (room_state.state != RS_PLAYING) {
+        return;
+      }
+      game_state = sim_state_;
+      for (int player = 0; player < PLAYERS_PER_ROOM; player++) {
+        const InputRing &inputs = inputs_[player];
+        input_acks[player] = inputs.consumedTag();
+        InputTiming &timing = input_timing[player];
+        timing.lead = leads_[player].lead();
+        timing.target_lead = leads_[player].targetLead();
+        timing.on_time = inputs.onTime();
+        timing.late = inputs.droppedLate();
+        timing.dropped = inputs.missed() + inputs.droppedEarly();
+      }
+    }
+    propogate_state_callback();
+  }
+};
+
+// the encodings of one snapshot a broadcast needs, so players that acked the
+// same baseline share a buffer
+class SnapshotPayloads {
+public:
+  SharedPayload *forPlayer(Room &room, int player, const GameState &current,
+                           const InputAcks &input_acks) {
+    uint32_t tag = room.acked_snapshot_tags[player];
+    const GameState *baseline =
+        tag == 0 ? nullptr : room.sent_snapshots.find(tag - 1);
+
+    // never acked, or acked too long ago for us to remember
+    if (baseline == nullptr || baseline->tick == current.tick) {
+      if (full_ == nullptr) {
+        SnapshotPacket full{nullptr, &current, &input_acks};
+        full_ = encodeSharedPayload(MSG_GAME_STATE, full);
       }
-      propogate_state_callback();
+      return full_;
+    }
 
-      // sleep s.t we tick at the correct rate
-      // TODO: just record the delta_time in ms to start with...
-      double elapsed_time =
-          static_cast<duration<float>>(steady_clock::now() - frame_start)
-              .count();
-      float sleep_time = DESIRED_TICK_LENGTH - elapsed_time;
-      if (sleep_time > 0.0) {
-        std::this_thread::sleep_for(
-            std::chrono::milliseconds((int)(sleep_time * 1000.0)));
+    for (int i = 0; i < num_deltas_; i++) {
+      if (deltas_[i].first == baseline->tick) {
+        return deltas_[i].second;
       }
     }
+    SnapshotPacket delta{baseline, &current, &input_acks};
+    SharedPayload *payload = encodeSharedPayload(MSG_GAME_STATE, delta);
+    if (payload != nullptr) {
+      deltas_[num_deltas_++] = std::make_pair(baseline->tick, payload);
+    }
+    return payload;
   }
+
+  void release() {
+    if (full_ != nullptr) {
+      releaseSharedPayload(full_);
+    }
+    for (int i = 0; i < num_deltas_; i++) {
+      releaseSharedPayload(deltas_[i].second);
+    }
+  }
+
+private:
+  SharedPayload *full_ = nullptr;
+  std::array<std::pair<uint32_t, SharedPayload *>, PLAYERS_PER_ROOM> deltas_;
+  int num_deltas_ = 0;
+};
+
+struct ServerOptions {
+  // matches are recorded in here unless it's empty
+  std::string record_directory;
+  // serve metrics on this localhost port, or else on this UNIX socket
+  uint16_t metrics_port = 0;
+  std::string metrics_socket;
+  // a load test wants more than the usual
+  uint16_t max_rooms = MAX_ROOMS;
+  // fake a worse network than we have, for every client
+  const ImpairmentProfile *net_profile = nullptr;
 };
 
 class Server {
 public:
-  Server() = default;
+  // matches are recorded into record_directory unless it's empty
+  explicit Server(const ServerOptions &options)
+      : scheduler_(DESIRED_TICK_LENGTH, MAX_CATCH_UP_TICKS),
+        net_profile_(options.net_profile), metrics_server_(metrics_) {
+    for (int i = 0; i < options.max_rooms; i++) {
+      rooms_.emplace_back();
+      room_metrics_.push_back(std::make_unique<RoomMetrics>(metrics_, i));
+      rooms_[i].metrics = room_metrics_[i].get();
+    }
+    for (uint16_t type = 0; type < NUM_MESSAGE_TYPES; type++) {
+      messages_received_[type] =
+          &metrics_.counter("svb_server_messages_received_total",
+                            "Messages received from clients",
+                            label("type", type));
+    }
+    if (options.metrics_port != 0) {
+      metrics_server_.listenOnPort(options.metrics_port);
+    } else if (!options.metrics_socket.empty()) {
+      metrics_server_.listenOnSocket(options.metrics_socket);
+    }
+
+    if (!options.record_directory.empty()) {
+      std::vector<MatchRecorder *> recorders;
+      for (int i = 0; i < numRooms(); i++) {
+        recorders_.push_back(
+            std::make_unique<MatchRecorder>(options.record_directory));
+        rooms_[i].recorder = recorders_[i].get();
+        recorders.push_back(recorders_[i].get());
+      }
+      log_writer_.start(std::move(recorders));
+    }
+    // messages only the server sends are left as nullptr
+    message_handlers_[MSG_ROOM_REQUEST] = &Server::handleRoomRequest;
+    message_handlers_[MSG_CLIENT_INPUT] = &Server::handleClientInput;
+    message_handlers_[MSG_PING] = &Server::handlePing;
+    message_handlers_[MSG_SNAPSHOT_ACK] = &Server::handleSnapshotAck;
+  }
 
   void start() {
     // init rooms
-    for (int i = 0; i < MAX_ROOMS; i++) {
+    for (int i = 0; i < numRooms(); i++) {
       rooms_[i].room_state.current_room = i;
       rooms_[i].propogate_state_callback =
           std::bind(&Server::propogateGameState, this, i);
+      rooms_[i].scheduler = &scheduler_;
     }
+    scheduler_.start();
 
     // init connection lib
     SteamDatagramErrMsg error_msg;
@@ -174,6 +399,9 @@ public:
       exit(1);
     }
     network_interface_ = SteamNetworkingSockets();
+    if (net_profile_ && !applyImpairment(*net_profile_)) {
+      exit(1);
+    }
 
     // start listening to connections & setup callbacks
     SteamNetworkingIPAddr local_address;
@@ -194,14 +422,34 @@ public:
     }
 
     // loop through callbacks at desired tick rate
+    TRACE_THREAD_NAME("network");
+    requestTraceOnSignal();
+    auto last_stats_report = steady_clock::now();
     while (!should_quit_) {
+      auto loop_start = steady_clock::now();
       handleMessages();
       runCallbacks();
+      loop_time_.observe(
+          duration_cast<nanoseconds>(steady_clock::now() - loop_start)
+              .count());
+      auto since_last_report = steady_clock::now() - last_stats_report;
+      if (since_last_report > STATS_REPORT_INTERVAL) {
+        reportStats(duration<double>(since_last_report).count());
+        last_stats_report = steady_clock::now();
+      }
+      if (traceRequested()) {
+        writeTrace();
+      }
       std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
   }
 
   ~Server() {
+    // stop stepping rooms before we tear down the network
+    scheduler_.stop();
+    log_writer_.stop();
+    metrics_server_.stop();
+
     // loop through all connections and close them cleanly
     for (const auto &it : connected_clients_) {
       network_interface_->CloseConnection(it.first, 0, "Server Shutdown", true);
@@ -219,6 +467,9 @@ private:
   // singleton-ish structure here s.t we can use C API to call callbacks
   // not very cool!
   static Server *current_callback_instance_;
+
+  int numRooms() const { return static_cast<int>(rooms_.size()); }
+
   void runCallbacks() {
     current_callback_instance_ = this;
     network_interface_->RunCallbacks();
@@ -229,12 +480,67 @@ private:
     current_callback_instance_->onConnectionStatusChanged(info);
   }
 
+  void reportStats(double elapsed_seconds) {
+    std::cout << "messages handled/s: " << std::fixed << std::setprecision(1)
+              << messages_handled_ / elapsed_seconds
+              << " connections: " << connected_clients_.size() << std::endl;
+    messages_handled_ = 0;
+
+    for (int i = 0; i < numRooms(); i++) {
+      reportRoomStats(i);
+    }
+
+    TickSchedulerStats stats = scheduler_.collectStats();
+    ticks_skipped_.add(stats.ticks_skipped);
+    if (stats.tasks_run == 0) {
+      return;
+    }
+    std::cout << "ticks: " << stats.ticks << " room steps: " << stats.tasks_run
+              << " steals: " << stats.steals << " tick lateness avg: "
+              << std::fixed << std::setprecision(3) << stats.mean_lateness_ms
+              << " ms max: " << stats.max_lateness_ms << " ms" << std::endl;
+    std::cout << "ticks skipped: " << stats.ticks_skipped
+              << " catch up time: " << stats.catch_up_ms << " ms"
+              << " lateness histogram (us):";
+    for (size_t i = 0; i < NUM_LATENESS_BUCKETS; i++) {
+      if (i < LATENESS_BUCKET_BOUNDS_US.size()) {
+        std::cout << " <" << LATENESS_BUCKET_BOUNDS_US[i] << ": ";
+      } else {
+        std::cout << " more: ";
+      }
+      std::cout << stats.lateness_histogram[i];
+    }
+    std::cout << std::endl;
+  }
+
+  void reportRoomStats(int room_id) {
+    Room &room = rooms_[room_id];
+    std::array<InputTiming, PLAYERS_PER_ROOM> input_timing;
+    {
+      std::scoped_lock lock(room.lock);
+      if (room.room_state.state != RS_PLAYING) {
+        return;
+      }
+      input_timing = room.input_timing;
+    }
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+      const InputTiming &timing = input_timing[i];
+      std::cout << "room " << room_id << " player " << i + 1
+                << " inputs on time: " << timing.on_time
+                << " late: " << timing.late << " dropped: " << timing.dropped
+                << " duplicates: " << room.inputDuplicates(i)
+                << " lead: " << std::setprecision(2) << timing.lead << "/"
+                << timing.target_lead << " ticks" << std::endl;
+    }
+  }
+
   void handleMessages() {
-    // go through all messages one at a time
+    TRACE_SPAN("handleMessages");
+    // pull messages off the poll group in batches
+    std::array<ISteamNetworkingMessage *, MESSAGE_BATCH_SIZE> incoming_msgs;
     while (true) {
-      ISteamNetworkingMessage *incoming_msg = nullptr;
       int num_msgs = network_interface_->ReceiveMessagesOnPollGroup(
-          poll_group_, &incoming_msg, 1);
+          poll_group_, incoming_msgs.data(), incoming_msgs.size());
 
       if (num_msgs == 0) {
         break;
@@ -243,90 +549,183 @@ private:
       if (num_msgs < 0) {
         std::cout << "WARNING: we failed to get a message from the poll group"
                   << std::endl;
+        break;
       }
 
-      // lookup connection and make sure its registered
-      if (connected_clients_.find(incoming_msg->m_conn) !=
-          connected_clients_.end()) {
-        // deserialize the client request
-        MessageTag msg_tag;
-        std::stringstream ss(std::ios::binary | std::ios_base::app |
-                             std::ios_base::in | std::ios_base::out);
-        ss.write((char const *)incoming_msg->m_pData, incoming_msg->m_cbSize);
-        cereal::BinaryInputArchive dearchive(ss);
-        dearchive(msg_tag);
-        if (msg_tag.type == MSG_ROOM_REQUEST) {
-          RoomRequest room_request_msg;
-          dearchive(room_request_msg);
-
-          if (room_request_msg.command == RR_LIST_ROOMS) {
-            LobbyState response;
-            for (int i = 0; i < MAX_ROOMS; i++) {
-              if (rooms_[i].room_state.num_connected > 0) {
-                response.available_rooms.push_back(i);
-              }
-            }
-            sendLobbyState(response, incoming_msg->m_conn);
-          } else if (room_request_msg.command == RR_JOIN_ROOM) {
-            if (!joinRoom(incoming_msg->m_conn, room_request_msg.desired_room,
-                          room_request_msg.nickname)) {
-              // send error
-              std::cout << "error joining a room\n";
-            }
-          } else if (room_request_msg.command == RR_MAKE_ROOM) {
-            int room_id =
-                makeRoom(incoming_msg->m_conn, room_request_msg.nickname);
-            if (room_id == -1) {
-              // send error
-              std::cout << "error making a room\n";
-            }
-          }
-        } else if (msg_tag.type == MSG_CLIENT_INPUT) {
-          InputMessage input_msg;
-          dearchive(input_msg);
-
-          int room_id = connected_clients_[incoming_msg->m_conn];
-          Room &room = rooms_[room_id];
-          std::optional<size_t> maybe_player_index =
-              room.playerIndexOfConnection(incoming_msg->m_conn);
-          if (!maybe_player_index.has_value()) {
-            continue;
-          }
-          size_t player_index = maybe_player_index.value();
-          if (room.room_state.state == RS_WAITING) {
-            // do nothing
-          } else {
-            // if not, feed player inputs
-            room.feedInput(input_msg, player_index);
-          }
-        } else if (msg_tag.type == MSG_PING) {
-          // get current time
-          uint32_t current_time = duration_cast<milliseconds>(
-                                      system_clock::now().time_since_epoch())
-                                      .count();
-          PingMessage ping_msg;
-          dearchive(ping_msg);
-
-          // compute round trip in ms
-          uint32_t ping = current_time - ping_msg.server_send_time;
-
-          // store it in the room
-          int room_id = connected_clients_[incoming_msg->m_conn];
-          Room &room = rooms_[room_id];
-          std::optional<size_t> maybe_player_index =
-              room.playerIndexOfConnection(incoming_msg->m_conn);
-          if (!maybe_player_index.has_value()) {
-            continue;
-          }
-          size_t player_index = maybe_player_index.value();
-          room.room_state.pings[player_index] = ping;
-          propogateRoomState(room_id);
+      for (int i = 0; i < num_msgs; i++) {
+        bytes_received_.add(incoming_msgs[i]->m_cbSize);
+        handleMessage(incoming_msgs[i]);
+        incoming_msgs[i]->Release();
+      }
+      messages_handled_ += num_msgs;
+
+      if (num_msgs < MESSAGE_BATCH_SIZE) {
+        break;
+      }
+    }
+  }
+
+  void handleMessage(ISteamNetworkingMessage *incoming_msg) {
+    // the connection's context rides along with every message, so we don't
+    // have to look it up. anything without one was never registered
+    ClientConnection *client =
+        clientFromUserData(incoming_msg->m_nConnUserData);
+    if (client == nullptr) {
+      return;
+    }
+
+    // deserialize the client request straight out of the message buffer
+    WireReader dearchive(incoming_msg->m_pData, incoming_msg->m_cbSize);
+    MessageTag msg_tag;
+    dearchive(msg_tag);
+    if (!dearchive.ok()) {
+      return;
+    }
+
+    if (msg_tag.type >= message_handlers_.size() ||
+        message_handlers_[msg_tag.type] == nullptr) {
+      std::cout << "WARN: we got an unexpected message type from a client: "
+                << msg_tag.type << std::endl;
+      return;
+    }
+    messages_received_[msg_tag.type]->add();
+    (this->*message_handlers_[msg_tag.type])(*client, dearchive);
+  }
+
+  void handleRoomRequest(ClientConnection &client,
+                         WireReader &dearchive) {
+    RoomRequest room_request_msg;
+    dearchive(room_request_msg);
+    if (!dearchive.ok()) {
+      return;
+    }
+
+    if (room_request_msg.command == RR_LIST_ROOMS) {
+      LobbyState response;
+      for (int i = 0; i < numRooms(); i++) {
+        if (rooms_[i].room_state.num_connected > 0) {
+          response.available_rooms.push_back(i);
         }
       }
-      incoming_msg->Release();
+      sendLobbyState(response, client.connection);
+    } else if (room_request_msg.command == RR_JOIN_ROOM) {
+      if (!joinRoom(client, room_request_msg.desired_room,
+                    room_request_msg.nickname)) {
+        // send error
+        std::cout << "error joining a room\n";
+      }
+    } else if (room_request_msg.command == RR_MAKE_ROOM) {
+      int room_id = makeRoom(client, room_request_msg.nickname);
+      if (room_id == -1) {
+        // send error
+        std::cout << "error making a room\n";
+      }
     }
   }
 
+  void handleClientInput(ClientConnection &client,
+                         WireReader &dearchive) {
+    InputPacket input_packet;
+    dearchive(input_packet);
+    if (!dearchive.ok()) {
+      return;
+    }
+
+    if (client.room_id == -1) {
+      return;
+    }
+    Room &room = rooms_[client.room_id];
+    if (room.room_state.state == RS_WAITING) {
+      // do nothing
+    } else {
+      // if not, feed player inputs. most of them are repeats we already have
+      InputPacket accepted;
+      for (size_t i = 0; i < input_packet.count; i++) {
+        if (room.feedInput(input_packet.inputs[i], client.player_index)) {
+          accepted.inputs[accepted.count++] = input_packet.inputs[i];
+        }
+      }
+      if (accepted.count > 0) {
+        relayInputs(room, client.player_index, accepted);
+      }
+    }
+  }
+
+  // pass a player's inputs on to everyone else in the room right away, so
+  // they can predict that player instead of waiting for snapshots. only
+  // inputs we'll simulate, the others take them as confirmed. a lost relay
+  // is made up for by the next snapshot
+  void relayInputs(Room &room, int player_index, const InputPacket &packet) {
+    RemoteInputs relay;
+    relay.player = player_index;
+    relay.packet = packet;
+    SharedPayload *payload = encodeSharedPayload(MSG_REMOTE_INPUTS, relay);
+    if (payload == nullptr) {
+      return;
+    }
+    std::array<ISteamNetworkingMessage *, PLAYERS_PER_ROOM> batch;
+    int batch_size = 0;
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+      if (i != player_index && room.players[i]) {
+        batch[batch_size++] =
+            shareMessage(payload, room.players[i].value(),
+                         k_nSteamNetworkingSend_Unreliable);
+      }
+    }
+    countSent(room, batch.data(), batch_size);
+    network_interface_->SendMessages(batch_size, batch.data(), nullptr);
+    releaseSharedPayload(payload);
+  }
+
+  // before they're sent, after that they belong to GNS
+  void countSent(Room &room, ISteamNetworkingMessage *const *messages,
+                 int count) {
+    uint64_t bytes = 0;
+    for (int i = 0; i < count; i++) {
+      bytes += messages[i]->m_cbSize;
+    }
+    room.metrics->messages_sent.add(count);
+    room.metrics->bytes_sent.add(bytes);
+  }
+
+  void handlePing(ClientConnection &client,
+                  WireReader &dearchive) {
+    // get current time
+    uint32_t current_time =
+        duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+            .count();
+    PingMessage ping_msg;
+    dearchive(ping_msg);
+    if (!dearchive.ok()) {
+      return;
+    }
+
+    // compute round trip in ms
+    uint32_t ping = current_time - ping_msg.server_send_time;
+
+    // store it in the room
+    if (client.room_id == -1) {
+      return;
+    }
+    rooms_[client.room_id].room_state.pings[client.player_index] = ping;
+    propogateRoomState(client.room_id);
+  }
+
+  void handleSnapshotAck(ClientConnection &client, WireReader &dearchive) {
+    SnapshotAck ack;
+    dearchive(ack);
+    if (!dearchive.ok() || client.room_id == -1) {
+      return;
+    }
+
+    // take the newest ack as is, even if it went backwards. a reordered ack
+    // only costs a bigger delta, and acks from an old match heal themselves
+    Room &room = rooms_[client.room_id];
+    room.acked_snapshot_tags[client.player_index] =
+        ack.reset ? 0 : ack.tick + 1;
+    room.in_sync[client.player_index] = ack.in_sync && !ack.reset;
+  }
+
   void
   onConnectionStatusChanged(SteamNetConnectionStatusChangedCallback_t *info) {
     switch (info->m_info.m_eState) {
@@ -362,8 +761,14 @@ private:
       return;
     }
 
-    // store the connection somewhere we can use it
-    connected_clients_.emplace(info->m_hConn, -1);
+    // store the connection somewhere we can use it, and hand GNS a pointer
+    // to it so every message we receive carries it
+    auto client = std::make_unique<ClientConnection>();
+    client->connection = info->m_hConn;
+    network_interface_->SetConnectionUserData(
+        info->m_hConn, reinterpret_cast<int64>(client.get()));
+    connected_clients_.emplace(info->m_hConn, std::move(client));
+    connections_.set(connected_clients_.size());
     std::cout << "we got a new connection!" << std::endl;
   }
 
@@ -372,10 +777,14 @@ private:
     if (info->m_eOldState == k_ESteamNetworkingConnectionState_Connected) {
 
       // delete connection from storage
-      if (connected_clients_[info->m_hConn] != -1) {
-        leaveRoom(info->m_hConn, connected_clients_[info->m_hConn]);
+      auto it = connected_clients_.find(info->m_hConn);
+      if (it != connected_clients_.end()) {
+        if (it->second->room_id != -1) {
+          leaveRoom(*it->second);
+        }
+        connected_clients_.erase(it);
+        connections_.set(connected_clients_.size());
       }
-      connected_clients_.erase(info->m_hConn);
 
       // close out connection
       network_interface_->CloseConnection(info->m_hConn, 0, nullptr, false);
@@ -383,83 +792,46 @@ private:
     }
   }
 
-  void sendLobbyState(LobbyState &lobby_state, HSteamNetConnection connection) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_LOBBY_STATE;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(lobby_state);
+  static ClientConnection *clientFromUserData(int64 user_data) {
+    // GNS defaults user data to -1
+    if (user_data == -1 || user_data == 0) {
+      return nullptr;
     }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Reliable, nullptr);
+    return reinterpret_cast<ClientConnection *>(user_data);
+  }
+
+  void sendLobbyState(LobbyState &lobby_state, HSteamNetConnection connection) {
+    sendMessage(network_interface_, connection, MSG_LOBBY_STATE, lobby_state,
+                k_nSteamNetworkingSend_Reliable);
   }
 
   void sendRoomState(RoomState &room_state, HSteamNetConnection connection) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_ROOM_STATE;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(room_state);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Reliable, nullptr);
+    sendMessage(network_interface_, connection, MSG_ROOM_STATE, room_state,
+                k_nSteamNetworkingSend_Reliable);
   }
 
   void sendPing(HSteamNetConnection connection) {
-    MessageTag msg_tag;
     PingMessage msg;
     msg.server_send_time =
         duration_cast<milliseconds>(system_clock::now().time_since_epoch())
             .count();
-    msg_tag.type = MSG_PING;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(msg);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Reliable, nullptr);
-  }
-
-  void sendGameState(GameState &game_state, HSteamNetConnection connection) {
-    MessageTag msg_tag;
-    msg_tag.type = MSG_GAME_STATE;
-    std::ostringstream response_stream(std::ios::binary | std::ios_base::app |
-                                       std::ios_base::in | std::ios_base::out);
-    {
-      cereal::BinaryOutputArchive archive(response_stream);
-      archive(msg_tag);
-      archive(game_state);
-    }
-    std::string tmp_str = response_stream.str();
-    network_interface_->SendMessageToConnection(
-        connection, tmp_str.c_str(), tmp_str.size(),
-        k_nSteamNetworkingSend_Unreliable, nullptr);
+    sendMessage(network_interface_, connection, MSG_PING, msg,
+                k_nSteamNetworkingSend_Reliable);
   }
 
-  bool joinRoom(HSteamNetConnection player, int room_id,
+  bool joinRoom(ClientConnection &player, int room_id,
                 const std::string &nickname) {
+    if (room_id < 0 || room_id >= numRooms() || player.room_id != -1) {
+      return false;
+    }
     Room &room = rooms_[room_id];
     if (room.room_state.num_connected >= PLAYERS_PER_ROOM) {
       return false;
     }
 
     room.room_state.num_connected++;
-    connected_clients_[player] = room_id;
+    room.metrics->players.set(room.room_state.num_connected);
+    player.room_id = room_id;
 
     if (room.room_state.num_connected == PLAYERS_PER_ROOM) {
       room.startMatch();
@@ -468,19 +840,20 @@ private:
     // emplace player into the first empty slot
     for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
       if (!room.players[i].has_value()) {
-        room.players[i] = player;
+        room.players[i] = player.connection;
         room.room_state.nicknames[i] = nickname;
+        player.player_index = i;
         break;
       }
     }
-    sendPing(player);
+    sendPing(player.connection);
     propogateRoomState(room_id);
     return true;
   }
 
-  int makeRoom(HSteamNetConnection player, const std::string &nickname) {
+  int makeRoom(ClientConnection &player, const std::string &nickname) {
     // find first empty room slot and join it
-    for (int i = 0; i < MAX_ROOMS; i++) {
+    for (int i = 0; i < numRooms(); i++) {
       if (rooms_[i].room_state.num_connected == 0 &&
           joinRoom(player, i, nickname) == true) {
         propogateRoomState(i);
@@ -490,15 +863,18 @@ private:
     return -1;
   }
 
-  bool leaveRoom(HSteamNetConnection player, int room_id) {
+  bool leaveRoom(ClientConnection &player) {
+    int room_id = player.room_id;
     Room &room = rooms_[room_id];
     for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
-      if (room.players[i] == player) {
+      if (room.players[i] == player.connection) {
         room.players[i] = std::nullopt;
-        connected_clients_[player] = -1;
+        player.room_id = -1;
+        player.player_index = -1;
         room.room_state.nicknames[i] = "";
         room.room_state.pings[i] = 0;
         room.room_state.num_connected--;
+        room.metrics->players.set(room.room_state.num_connected);
         if (room.room_state.num_connected != PLAYERS_PER_ROOM &&
             room.room_state.state == RS_PLAYING) {
           room.endMatch();
@@ -527,38 +903,177 @@ private:
   }
 
   void propogateGameState(int room_id) {
+    TRACE_SPAN("propogateGameState");
+    Room &room = rooms_[room_id];
+    auto start = steady_clock::now();
     GameState msg;
+    InputAcks input_acks;
+    std::array<InputTiming, PLAYERS_PER_ROOM> input_timing;
     bool should_ping = false;
     {
-      std::scoped_lock lock(rooms_[room_id].lock);
-      msg = rooms_[room_id].game_state;
-      should_ping = rooms_[room_id].should_ping_counter++ %
+      std::scoped_lock lock(room.lock);
+      msg = room.game_state;
+      input_acks = room.input_acks;
+      input_timing = room.input_timing;
+      should_ping = room.should_ping_counter++ %
                         static_cast<uint32_t>(TICK_RATE * 2) ==
                     0;
     }
+    room.sent_snapshots.store(msg);
+
+    // serialize once per distinct baseline and fan the same buffers out to
+    // everyone in one batch
+    SnapshotPayloads snapshots;
+    SharedPayload *state_hash = nullptr;
+    SharedPayload *ping = nullptr;
+    if (should_ping) {
+      PingMessage ping_msg;
+      ping_msg.server_send_time =
+          duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+              .count();
+      ping = encodeSharedPayload(MSG_PING, ping_msg);
+    }
 
+    bool should_send_timing = msg.tick % INPUT_TIMING_INTERVAL == 0;
+
+    std::array<ISteamNetworkingMessage *, PLAYERS_PER_ROOM * 3> batch;
+    int batch_size = 0;
     for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
-      if (rooms_[room_id].players[i]) {
-        sendGameState(msg, rooms_[room_id].players[i].value());
-        if (should_ping) {
-          sendPing(rooms_[room_id].players[i].value());
+      if (room.players[i]) {
+        HSteamNetConnection connection = room.players[i].value();
+        SharedPayload *snapshot = nullptr;
+        if (room.in_sync[i]) {
+          // they can work the state out themselves, just let them check it
+          if (state_hash == nullptr) {
+            StateHashPacket packet{msg.tick, input_acks, hashGameState(msg)};
+            state_hash = encodeSharedPayload(MSG_STATE_HASH, packet);
+          }
+          snapshot = state_hash;
+          room.metrics->state_hashes_sent.add();
+        } else {
+          snapshot = snapshots.forPlayer(room, i, msg, input_acks);
+          room.metrics->snapshots_sent.add();
+        }
+        if (snapshot != nullptr) {
+          batch[batch_size++] = shareMessage(snapshot, connection,
+                                             k_nSteamNetworkingSend_Unreliable);
+        }
+        if (ping != nullptr) {
+          batch[batch_size++] =
+              shareMessage(ping, connection, k_nSteamNetworkingSend_Reliable);
+        }
+        ISteamNetworkingMessage *timing = nullptr;
+        if (should_send_timing) {
+          timing = encodeMessage(MSG_INPUT_TIMING, input_timing[i], connection,
+                                 k_nSteamNetworkingSend_Unreliable);
+        }
+        if (timing != nullptr) {
+          batch[batch_size++] = timing;
         }
       }
     }
+    countSent(room, batch.data(), batch_size);
+    network_interface_->SendMessages(batch_size, batch.data(), nullptr);
+
+    snapshots.release();
+    if (state_hash != nullptr) {
+      releaseSharedPayload(state_hash);
+    }
+    if (ping != nullptr) {
+      releaseSharedPayload(ping);
+    }
+    room.metrics->broadcast_time.observe(
+        duration_cast<nanoseconds>(steady_clock::now() - start).count());
   }
 
   ISteamNetworkingSockets *network_interface_ = nullptr;
   HSteamListenSocket socket_;
   HSteamNetPollGroup poll_group_;
-  // maping of player network id -> room index
-  std::unordered_map<HSteamNetConnection, int> connected_clients_;
-  std::array<Room, MAX_ROOMS> rooms_;
+  // owns the per-connection context that GNS hands back as user data
+  std::unordered_map<HSteamNetConnection, std::unique_ptr<ClientConnection>>
+      connected_clients_;
+  // never moves a room once it's made, the tick scheduler holds on to them
+  std::deque<Room> rooms_;
+  using MessageHandler = void (Server::*)(ClientConnection &,
+                                          WireReader &);
+  std::array<MessageHandler, NUM_MESSAGE_TYPES> message_handlers_ = {};
+  uint64_t messages_handled_ = 0;
+  TickScheduler scheduler_;
+  const ImpairmentProfile *net_profile_;
+  std::vector<std::unique_ptr<MatchRecorder>> recorders_;
+  MatchLogWriter log_writer_;
+  MetricsRegistry metrics_;
+  std::vector<std::unique_ptr<RoomMetrics>> room_metrics_;
+  std::array<Counter *, NUM_MESSAGE_TYPES> messages_received_;
+  Counter &bytes_received_ = metrics_.counter(
+      "svb_server_bytes_received_total", "Bytes received from clients");
+  Gauge &connections_ = metrics_.gauge("svb_server_connections",
+                                       "Clients connected to the server");
+  LatencyHistogram &loop_time_ = metrics_.histogram(
+      "svb_server_loop_seconds",
+      "Time spent handling messages and callbacks per network loop");
+  Counter &ticks_skipped_ = metrics_.counter(
+      "svb_server_ticks_skipped_total",
+      "Room ticks dropped because a room fell too far behind");
+  MetricsServer metrics_server_;
   bool should_quit_ = false;
 };
 Server *Server::current_callback_instance_ = nullptr;
 
-int main() {
-  Server server;
+int main(int argc, char **argv) {
+  ServerOptions options;
+  int curr_arg = 0;
+  while (++curr_arg != argc) {
+    if (strcmp(argv[curr_arg], "--record") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify a directory to record matches in"
+                  << std::endl;
+        return 1;
+      }
+      options.record_directory = argv[curr_arg];
+    } else if (strcmp(argv[curr_arg], "--metrics-port") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify a port to serve metrics on" << std::endl;
+        return 1;
+      }
+      options.metrics_port = atoi(argv[curr_arg]);
+    } else if (strcmp(argv[curr_arg], "--metrics-socket") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify a socket to serve metrics on"
+                  << std::endl;
+        return 1;
+      }
+      options.metrics_socket = argv[curr_arg];
+    } else if (strcmp(argv[curr_arg], "--max-rooms") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify how many rooms to have" << std::endl;
+        return 1;
+      }
+      int max_rooms = atoi(argv[curr_arg]);
+      if (max_rooms < 1 || max_rooms > UINT16_MAX) {
+        std::cerr << "error: rooms must be between 1 and " << UINT16_MAX
+                  << std::endl;
+        return 1;
+      }
+      options.max_rooms = max_rooms;
+    } else if (strcmp(argv[curr_arg], "--net-profile") == 0) {
+      if (++curr_arg == argc) {
+        std::cerr << "error: specify a network profile" << std::endl;
+        return 1;
+      }
+      options.net_profile = findImpairmentProfile(argv[curr_arg]);
+      if (!options.net_profile) {
+        std::cerr << "error: network profile must be one of "
+                  << impairmentProfileNames() << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "unknown argument: " << argv[curr_arg] << std::endl;
+      return 1;
+    }
+  }
+
+  Server server(options);
   std::cout << "Spinning Server..." << std::endl;
   server.start();
   return 0;
@@ -0,0 +1,121 @@
+#include "snapshot_delta.hpp"
+
+static_assert(NUM_GAME_STATE_FIELDS <= 64,
+              "the changed field mask only has room for 64 fields");
+
+// acks trail the tick by a little, so send how far behind they are. it's
+// shifted up by one so that 0 can still mean no ack
+static void writeInputAcks(WireWriter &archive, uint32_t tick,
+                           const InputAcks &input_acks) {
+  for (uint32_t ack : input_acks) {
+    writeVarint(archive, ack == 0 ? 0 : tick + 2 - ack);
+  }
+}
+
+static bool readInputAcks(WireReader &archive, uint32_t tick,
+                          InputAcks &input_acks) {
+  for (uint32_t &ack : input_acks) {
+    uint32_t distance = 0;
+    readVarint(archive, distance);
+    if (distance > tick + 1) {
+      return false;
+    }
+    ack = distance == 0 ? 0 : tick + 2 - distance;
+  }
+  return archive.ok();
+}
+
+void encodeSnapshot(WireWriter &archive, const GameState *baseline,
+                    const GameState &current, const InputAcks &input_acks) {
+  archive(WIRE_FORMAT_VERSION);
+  writeVarint(archive, current.tick);
+  writeVarint(archive, baseline ? current.tick - baseline->tick : 0);
+  writeInputAcks(archive, current.tick, input_acks);
+
+  BitWriter bits(archive);
+  if (baseline != nullptr) {
+    // compare what the client will see, not the raw floats, so noise below
+    // the quantization step doesn't cost us anything
+    for (const GameStateField &field : GAME_STATE_FIELDS) {
+      if (field.kind != FIELD_TICK) {
+        bits.write(!fieldEqualOnWire(field, *baseline, current), 1);
+      }
+    }
+  }
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    if (field.kind != FIELD_TICK &&
+        (baseline == nullptr || !fieldEqualOnWire(field, *baseline, current))) {
+      packField(bits, field, current);
+    }
+  }
+  bits.finish();
+}
+
+SnapshotDecodeResult decodeSnapshot(WireReader &archive,
+                                    const SnapshotHistory &history,
+                                    GameState &out, InputAcks &input_acks) {
+  uint8_t version = 0;
+  uint32_t tick = 0;
+  uint32_t baseline_age = 0;
+  archive(version);
+  if (!archive.ok() || version != WIRE_FORMAT_VERSION) {
+    return SNAPSHOT_MALFORMED;
+  }
+  readVarint(archive, tick);
+  readVarint(archive, baseline_age);
+  if (!readInputAcks(archive, tick, input_acks) || baseline_age > tick) {
+    return SNAPSHOT_MALFORMED;
+  }
+
+  BitReader bits(archive);
+  if (baseline_age == 0) {
+    out = GameState();
+    for (const GameStateField &field : GAME_STATE_FIELDS) {
+      if (field.kind != FIELD_TICK) {
+        unpackField(bits, field, out);
+      }
+    }
+  } else {
+    const GameState *baseline = history.find(tick - baseline_age);
+    if (baseline == nullptr) {
+      return SNAPSHOT_MISSING_BASELINE;
+    }
+    out = *baseline;
+
+    uint64_t changed = 0;
+    for (size_t i = 0; i < NUM_GAME_STATE_FIELDS; i++) {
+      if (GAME_STATE_FIELDS[i].kind != FIELD_TICK && bits.read(1)) {
+        changed |= uint64_t(1) << i;
+      }
+    }
+    for (size_t i = 0; i < NUM_GAME_STATE_FIELDS; i++) {
+      if (changed & (uint64_t(1) << i)) {
+        unpackField(bits, GAME_STATE_FIELDS[i], out);
+      }
+    }
+  }
+  out.tick = tick;
+  return archive.ok() ? SNAPSHOT_OK : SNAPSHOT_MALFORMED;
+}
+
+void StateHashPacket::serialize(WireWriter &archive) {
+  archive(WIRE_FORMAT_VERSION);
+  writeVarint(archive, tick);
+  writeInputAcks(archive, tick, input_acks);
+  archive(hash);
+}
+
+void StateHashPacket::serialize(WireReader &archive) {
+  uint8_t version = 0;
+  archive(version);
+  if (version != WIRE_FORMAT_VERSION) {
+    archive.fail();
+    return;
+  }
+  readVarint(archive, tick);
+  if (!readInputAcks(archive, tick, input_acks)) {
+    archive.fail();
+    return;
+  }
+  archive(hash);
+}
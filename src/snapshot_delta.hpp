@@ -0,0 +1,83 @@
+#pragma once
+#include "game_state.hpp"
+#include "wire_format.hpp"
+
+// how far back a delta baseline can be (0.5s at 64hz)
+constexpr uint32_t SNAPSHOT_HISTORY_CAPACITY = 32;
+
+// the last few snapshots, slotted by tick
+class SnapshotHistory {
+public:
+  void store(const GameState &state) {
+    Slot &slot = slots_[state.tick % SNAPSHOT_HISTORY_CAPACITY];
+    slot.state = state;
+    slot.valid = true;
+  }
+
+  const GameState *find(uint32_t tick) const {
+    const Slot &slot = slots_[tick % SNAPSHOT_HISTORY_CAPACITY];
+    if (!slot.valid || slot.state.tick != tick) {
+      return nullptr;
+    }
+    return &slot.state;
+  }
+
+  void clear() {
+    for (Slot &slot : slots_) {
+      slot.valid = false;
+    }
+  }
+
+private:
+  struct Slot {
+    GameState state;
+    bool valid = false;
+  };
+  std::array<Slot, SNAPSHOT_HISTORY_CAPACITY> slots_;
+};
+
+// newest input tick + 1 the server consumed from each player, 0 if none yet
+using InputAcks = std::array<uint32_t, PLAYERS_PER_ROOM>;
+
+// A snapshot on the wire: the format version, the tick as a varint, how many
+// ticks back the baseline is as a varint (0 for a full snapshot), how far
+// behind the tick each player's input ack is, then a mask of the fields that
+// changed when it's a delta, then the quantized fields.
+void encodeSnapshot(WireWriter &archive, const GameState *baseline,
+                    const GameState &current, const InputAcks &input_acks);
+
+enum SnapshotDecodeResult {
+  SNAPSHOT_OK,
+  SNAPSHOT_MALFORMED,
+  // a delta against a baseline we no longer have
+  SNAPSHOT_MISSING_BASELINE,
+};
+
+// the input acks are filled in even when the baseline is missing
+SnapshotDecodeResult decodeSnapshot(WireReader &archive,
+                                    const SnapshotHistory &history,
+                                    GameState &out, InputAcks &input_acks);
+
+// body of a MSG_GAME_STATE, so it can go through encodeMessage(). no baseline
+// sends the whole state
+struct SnapshotPacket {
+  const GameState *baseline;
+  const GameState *current;
+  const InputAcks *input_acks;
+
+  void serialize(WireWriter &archive) {
+    encodeSnapshot(archive, baseline, *current, *input_acks);
+  }
+};
+
+// MSG_STATE_HASH body, sent instead of a snapshot to clients that told us
+// their prediction matched the last one. the same header as a snapshot, then
+// hashGameState() of the tick
+struct StateHashPacket {
+  uint32_t tick = 0;
+  InputAcks input_acks = {};
+  uint64_t hash = 0;
+
+  void serialize(WireWriter &archive);
+  void serialize(WireReader &archive);
+};
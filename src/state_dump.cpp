@@ -0,0 +1,57 @@
+#include "state_dump.hpp"
+#include "snapshot_delta.hpp"
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// a full snapshot is a couple of hundred bytes
+constexpr size_t MAX_STATE_DUMP_SIZE = 1024;
+
+bool writeStateDump(const std::string &path, const GameState &state) {
+  uint8_t data[MAX_STATE_DUMP_SIZE];
+  WireWriter archive(data, sizeof(data));
+  encodeSnapshot(archive, nullptr, state, {});
+  if (!archive.ok()) {
+    return false;
+  }
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(data), archive.size());
+  return file.good();
+}
+
+bool readStateDump(const std::string &path, GameState &state) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.good()) {
+    return false;
+  }
+  std::vector<char> data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  WireReader archive(data.data(), data.size());
+  SnapshotHistory no_baselines;
+  InputAcks input_acks;
+  return decodeSnapshot(archive, no_baselines, state, input_acks) ==
+         SNAPSHOT_OK;
+}
+
+const GameStateField *firstDivergingField(const GameState &a,
+                                          const GameState &b) {
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    if (!fieldEqualOnWire(field, a, b)) {
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+size_t printStateDiff(std::ostream &out, const GameState &a,
+                      const GameState &b) {
+  size_t differences = 0;
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    if (!fieldEqualOnWire(field, a, b)) {
+      out << field.name << ": " << fieldValue(field, a) << " vs "
+          << fieldValue(field, b) << std::endl;
+      differences++;
+    }
+  }
+  return differences;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "game_state.hpp"
+#include <ostream>
+#include <string>
+
+// A whole GameState in a file, written as a full snapshot so it keeps exactly
+// what a client and the server can compare. The client dumps its prediction
+// and the server's state when the two disagree, svb_statediff reads them.
+bool writeStateDump(const std::string &path, const GameState &state);
+bool readStateDump(const std::string &path, GameState &state);
+
+// the first field, in GAME_STATE_FIELDS order, where the states differ on the
+// wire, nullptr if they don't
+const GameStateField *firstDivergingField(const GameState &a,
+                                          const GameState &b);
+
+// one line per field that differs on the wire, returns how many did
+size_t printStateDiff(std::ostream &out, const GameState &a,
+                      const GameState &b);
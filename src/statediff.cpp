@@ -0,0 +1,38 @@
+// svb_statediff compares two state dumps, like the ones the client writes
+// when its prediction disagrees with the server, and names the fields that
+// differ. exits with 0 if the states are the same, 1 if they differ and 2 if
+// a dump can't be read
+#include <iostream>
+
+#include "state_dump.hpp"
+#include "wire_format.hpp"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "usage: svb_statediff A.state B.state" << std::endl;
+    return 2;
+  }
+
+  GameState a;
+  GameState b;
+  for (int i = 1; i < 3; i++) {
+    if (!readStateDump(argv[i], i == 1 ? a : b)) {
+      std::cerr << "couldn't read a state from " << argv[i] << std::endl;
+      return 2;
+    }
+  }
+
+  const GameStateField *first = firstDivergingField(a, b);
+  if (first == nullptr) {
+    std::cout << "identical, hash " << std::hex << hashGameState(a)
+              << std::endl;
+    return 0;
+  }
+  std::cout << "first diverging field: " << first->name << " ("
+            << fieldValue(*first, a) << " vs " << fieldValue(*first, b) << ")"
+            << std::endl;
+  size_t differences = printStateDiff(std::cout, a, b);
+  std::cout << differences << " of " << NUM_GAME_STATE_FIELDS
+            << " fields differ" << std::endl;
+  return 1;
+}
@@ -0,0 +1,237 @@
+#include "tick_scheduler.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+// sleep_until() tends to wake up late by a good fraction of a millisecond, so
+// we sleep until just short of the deadline and spin the rest of the way
+constexpr auto SPIN_WINDOW = microseconds(500);
+
+TickScheduler::TickScheduler(double tick_length, uint32_t max_catch_up_ticks)
+    : tick_length_(
+          duration_cast<Clock::duration>(duration<double>(tick_length))),
+      max_catch_up_ticks_(max_catch_up_ticks) {
+  for (std::atomic<uint64_t> &bucket : stat_lateness_hist_) {
+    bucket = 0;
+  }
+}
+
+TickScheduler::~TickScheduler() { stop(); }
+
+void TickScheduler::start(size_t num_workers) {
+  if (running_) {
+    return;
+  }
+  num_workers = std::max<size_t>(num_workers, 1);
+  running_ = true;
+  for (size_t i = 0; i < num_workers; i++) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_.emplace_back(&TickScheduler::workerThread, this, i);
+  }
+  dispatcher_ = std::thread(&TickScheduler::dispatcherThread, this);
+}
+
+void TickScheduler::stop() {
+  if (!running_) {
+    return;
+  }
+  {
+    std::scoped_lock l(wake_lock_);
+    running_ = false;
+  }
+  wake_cv_.notify_all();
+  dispatcher_.join();
+  for (std::thread &worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  queues_.clear();
+}
+
+TickScheduler::TaskId TickScheduler::add(TaskFn fn) {
+  std::scoped_lock l(tasks_lock_);
+  // reuse a slot that is no longer referenced by any queue
+  for (size_t i = 0; i < tasks_.size(); i++) {
+    Task &task = *tasks_[i];
+    if (!task.active && !task.queued) {
+      task.fn = std::move(fn);
+      task.pending_ticks = 0;
+      task.active = true;
+      return i;
+    }
+  }
+  tasks_.push_back(std::make_unique<Task>());
+  tasks_.back()->fn = std::move(fn);
+  tasks_.back()->active = true;
+  return tasks_.size() - 1;
+}
+
+void TickScheduler::remove(TaskId id) {
+  Task *task;
+  {
+    std::scoped_lock l(tasks_lock_);
+    task = tasks_[id].get();
+    task->active = false;
+  }
+  // a worker may still be holding it, wait for that step to finish
+  while (task->queued) {
+    std::this_thread::yield();
+  }
+}
+
+TickSchedulerStats TickScheduler::collectStats() {
+  TickSchedulerStats stats;
+  stats.ticks = stat_ticks_.exchange(0);
+  stats.tasks_run = stat_tasks_run_.exchange(0);
+  stats.steals = stat_steals_.exchange(0);
+  int64_t lateness_sum = stat_lateness_sum_ns_.exchange(0);
+  int64_t lateness_max = stat_lateness_max_ns_.exchange(0);
+  if (stats.tasks_run > 0) {
+    stats.mean_lateness_ms = (lateness_sum / 1e6) / stats.tasks_run;
+  }
+  stats.max_lateness_ms = lateness_max / 1e6;
+  for (size_t i = 0; i < NUM_LATENESS_BUCKETS; i++) {
+    stats.lateness_histogram[i] = stat_lateness_hist_[i].exchange(0);
+  }
+  stats.ticks_skipped = stat_ticks_skipped_.exchange(0);
+  stats.catch_up_ms = stat_catch_up_ns_.exchange(0) / 1e6;
+  return stats;
+}
+
+void TickScheduler::dispatcherThread() {
+  // deadlines are absolute, so time spent dispatching never adds up to drift
+  Clock::time_point next_deadline = Clock::now() + tick_length_;
+  while (running_) {
+    std::this_thread::sleep_until(next_deadline - SPIN_WINDOW);
+    Clock::time_point now = Clock::now();
+    while (now < next_deadline) {
+      std::this_thread::yield();
+      now = Clock::now();
+    }
+
+    // figure out how many deadlines we blew past while sleeping
+    uint32_t ticks_due = 1 + (now - next_deadline) / tick_length_;
+    Clock::time_point deadline = next_deadline;
+    next_deadline += tick_length_ * ticks_due;
+    stat_ticks_ += ticks_due;
+
+    int64_t deadline_ns =
+        duration_cast<nanoseconds>(deadline.time_since_epoch()).count();
+    std::scoped_lock l(tasks_lock_);
+    for (std::unique_ptr<Task> &task : tasks_) {
+      if (!task->active) {
+        continue;
+      }
+      task->pending_ticks += ticks_due;
+      // if it's still queued from an earlier tick it will pick up the extra
+      // ticks when it runs
+      if (!task->queued.exchange(true)) {
+        task->deadline_ns = deadline_ns;
+        enqueue(task.get(), next_worker_++ % queues_.size());
+      }
+    }
+  }
+}
+
+void TickScheduler::enqueue(Task *task, size_t worker_idx) {
+  {
+    WorkerQueue &queue = *queues_[worker_idx];
+    std::scoped_lock l(queue.lock);
+    queue.jobs.push_back(task);
+  }
+  {
+    std::scoped_lock l(wake_lock_);
+    queued_jobs_++;
+  }
+  wake_cv_.notify_one();
+}
+
+TickScheduler::Task *TickScheduler::popJob(size_t worker_idx) {
+  // newest work from our own queue first
+  {
+    WorkerQueue &queue = *queues_[worker_idx];
+    std::scoped_lock l(queue.lock);
+    if (!queue.jobs.empty()) {
+      Task *task = queue.jobs.back();
+      queue.jobs.pop_back();
+      return task;
+    }
+  }
+
+  // otherwise steal the oldest work from someone else
+  for (size_t i = 1; i < queues_.size(); i++) {
+    WorkerQueue &queue = *queues_[(worker_idx + i) % queues_.size()];
+    std::scoped_lock l(queue.lock);
+    if (!queue.jobs.empty()) {
+      Task *task = queue.jobs.front();
+      queue.jobs.pop_front();
+      stat_steals_++;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void TickScheduler::workerThread(size_t worker_idx) {
+  TRACE_THREAD_NAME("tick worker");
+  while (true) {
+    Task *task = popJob(worker_idx);
+    if (task == nullptr) {
+      std::unique_lock l(wake_lock_);
+      wake_cv_.wait(l, [this] { return !running_ || queued_jobs_ > 0; });
+      if (!running_) {
+        break;
+      }
+      continue;
+    }
+    queued_jobs_--;
+    runTask(task, worker_idx);
+  }
+}
+
+void TickScheduler::runTask(Task *task, size_t worker_idx) {
+  uint32_t ticks_due = task->pending_ticks.exchange(0);
+  if (max_catch_up_ticks_ > 0 && ticks_due > max_catch_up_ticks_) {
+    stat_ticks_skipped_ += ticks_due - max_catch_up_ticks_;
+    ticks_due = max_catch_up_ticks_;
+  }
+  if (task->active && ticks_due > 0) {
+    int64_t start_ns =
+        duration_cast<nanoseconds>(Clock::now().time_since_epoch()).count();
+    recordLateness(start_ns - task->deadline_ns);
+    task->fn(ticks_due);
+    stat_tasks_run_++;
+    if (ticks_due > 1) {
+      int64_t end_ns =
+          duration_cast<nanoseconds>(Clock::now().time_since_epoch()).count();
+      stat_catch_up_ns_ += end_ns - start_ns;
+    }
+  }
+
+  task->queued = false;
+  // the dispatcher may have handed us more ticks while we were running
+  if (task->active && task->pending_ticks > 0 &&
+      !task->queued.exchange(true)) {
+    enqueue(task, worker_idx);
+  }
+}
+
+void TickScheduler::recordLateness(int64_t lateness_ns) {
+  lateness_ns = std::max<int64_t>(lateness_ns, 0);
+  stat_lateness_sum_ns_ += lateness_ns;
+  size_t bucket = std::upper_bound(LATENESS_BUCKET_BOUNDS_US.begin(),
+                                   LATENESS_BUCKET_BOUNDS_US.end(),
+                                   lateness_ns / 1000) -
+                  LATENESS_BUCKET_BOUNDS_US.begin();
+  stat_lateness_hist_[bucket]++;
+  int64_t prev_max = stat_lateness_max_ns_;
+  while (prev_max < lateness_ns &&
+         !stat_lateness_max_ns_.compare_exchange_weak(prev_max, lateness_ns)) {
+  }
+}
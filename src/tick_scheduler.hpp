@@ -0,0 +1,105 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// upper bounds of the lateness histogram buckets, the last bucket is
+// everything later than that
+constexpr std::array<int64_t, 8> LATENESS_BUCKET_BOUNDS_US = {
+    100, 250, 500, 1000, 2000, 4000, 8000, 16000};
+constexpr size_t NUM_LATENESS_BUCKETS = LATENESS_BUCKET_BOUNDS_US.size() + 1;
+
+// lateness numbers collected since the last call to collectStats()
+struct TickSchedulerStats {
+  uint64_t ticks = 0;     // scheduler ticks that fired
+  uint64_t tasks_run = 0; // room steps executed by the workers
+  uint64_t steals = 0;    // steps a worker took from another worker's queue
+  double mean_lateness_ms = 0.0;
+  double max_lateness_ms = 0.0;
+  // how late room steps started after their deadline
+  std::array<uint64_t, NUM_LATENESS_BUCKETS> lateness_histogram = {};
+  // room ticks dropped because a room fell further behind than the cap
+  uint64_t ticks_skipped = 0;
+  // time spent in steps that had to run more than one tick to catch up
+  double catch_up_ms = 0.0;
+};
+
+// Steps every registered task on a shared fixed-rate cadence using a fixed
+// pool of worker threads, instead of each room owning its own thread.
+// A task is never run by two workers at the same time; if a step overruns
+// the ticks it missed are handed to it on its next run, up to
+// max_catch_up_ticks at once (0 for no limit). Anything past that is skipped
+// so a room that fell far behind doesn't spiral trying to catch up.
+class TickScheduler {
+public:
+  using TaskId = size_t;
+  using TaskFn = std::function<void(uint32_t ticks_due)>;
+
+  explicit TickScheduler(double tick_length, uint32_t max_catch_up_ticks = 0);
+  ~TickScheduler();
+
+  void start(size_t num_workers = std::thread::hardware_concurrency());
+  void stop();
+
+  // register a task to be stepped every tick, starting with the next one
+  TaskId add(TaskFn fn);
+  // unregister a task, returns once it is guaranteed to not be running
+  void remove(TaskId id);
+
+  TickSchedulerStats collectStats();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Task {
+    TaskFn fn;
+    std::atomic<bool> active{false};
+    std::atomic<bool> queued{false}; // sitting in a queue or being run
+    std::atomic<uint32_t> pending_ticks{0};
+    std::atomic<int64_t> deadline_ns{0};
+  };
+
+  struct WorkerQueue {
+    std::mutex lock;
+    std::deque<Task *> jobs;
+  };
+
+  void dispatcherThread();
+  void workerThread(size_t worker_idx);
+  void enqueue(Task *task, size_t worker_idx);
+  Task *popJob(size_t worker_idx);
+  void runTask(Task *task, size_t worker_idx);
+  void recordLateness(int64_t lateness_ns);
+
+  const Clock::duration tick_length_;
+  const uint32_t max_catch_up_ticks_;
+
+  std::mutex tasks_lock_;
+  std::vector<std::unique_ptr<Task>> tasks_;
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::thread dispatcher_;
+  std::atomic<bool> running_{false};
+  std::atomic<int64_t> queued_jobs_{0};
+  std::mutex wake_lock_;
+  std::condition_variable wake_cv_;
+  size_t next_worker_ = 0;
+
+  std::atomic<uint64_t> stat_ticks_{0};
+  std::atomic<uint64_t> stat_tasks_run_{0};
+  std::atomic<uint64_t> stat_steals_{0};
+  std::atomic<int64_t> stat_lateness_sum_ns_{0};
+  std::atomic<int64_t> stat_lateness_max_ns_{0};
+  std::array<std::atomic<uint64_t>, NUM_LATENESS_BUCKETS> stat_lateness_hist_;
+  std::atomic<uint64_t> stat_ticks_skipped_{0};
+  std::atomic<int64_t> stat_catch_up_ns_{0};
+};
@@ -0,0 +1,101 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+
+#ifdef SVB_TRACING
+// spans this close to being overwritten are left out of a dump, a thread may
+// be writing over them while we read
+constexpr uint64_t TRACE_DUMP_SLACK = 1024;
+
+// what the dump is relative to, so timestamps start near 0
+static const int64_t trace_epoch_ns = traceNowNs();
+
+bool writeTrace(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    std::cout << "ERROR: can't write trace to " << path << std::endl;
+    return false;
+  }
+  setvbuf(file, nullptr, _IOFBF, 1 << 16);
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  bool first = true;
+  size_t num_spans = 0;
+  TraceBuffers &all = traceBuffers();
+  std::scoped_lock l(all.lock);
+  for (const std::unique_ptr<TraceBuffer> &buffer : all.buffers) {
+    const char *thread_name =
+        buffer->thread_name.load(std::memory_order_relaxed);
+    if (thread_name != nullptr) {
+      fprintf(file,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", buffer->thread_id, thread_name);
+      first = false;
+    }
+
+    uint64_t head = buffer->head();
+    uint64_t oldest =
+        head > TRACE_BUFFER_CAPACITY - TRACE_DUMP_SLACK
+            ? head - (TRACE_BUFFER_CAPACITY - TRACE_DUMP_SLACK)
+            : 0;
+    for (uint64_t i = oldest; i < head; i++) {
+      const TraceBuffer::Span &span = buffer->span(i);
+      const char *name = span.name.load(std::memory_order_relaxed);
+      int64_t start_ns = span.start_ns.load(std::memory_order_relaxed);
+      int64_t end_ns = span.end_ns.load(std::memory_order_relaxed);
+      if (name == nullptr) {
+        continue;
+      }
+      // complete events, in microseconds
+      fprintf(file,
+              "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              first ? "" : ",\n", name, buffer->thread_id,
+              (start_ns - trace_epoch_ns) / 1000.0,
+              std::max<int64_t>(end_ns - start_ns, 0) / 1000.0);
+      first = false;
+      num_spans++;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  bool ok = ferror(file) == 0;
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    std::cout << "ERROR: can't write trace to " << path << std::endl;
+    return false;
+  }
+  std::cout << "wrote " << num_spans << " spans to " << path << std::endl;
+  return true;
+}
+#else
+bool writeTrace(const std::string &path) {
+  std::cout << "ERROR: built without tracing, configure with "
+               "-DSVB_TRACING=ON to write "
+            << path << std::endl;
+  return false;
+}
+#endif
+
+bool writeTrace() {
+  int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  return writeTrace("trace_" + std::to_string(now_ms) + ".json");
+}
+
+static std::atomic<bool> trace_requested{false};
+
+#ifdef SIGUSR1
+static void onTraceSignal(int) { trace_requested = true; }
+
+void requestTraceOnSignal() { std::signal(SIGUSR1, onTraceSignal); }
+#else
+void requestTraceOnSignal() {}
+#endif
+
+bool traceRequested() { return trace_requested.exchange(false); }
@@ -0,0 +1,127 @@
+#pragma once
+#include <string>
+
+// Scoped spans for a timeline of what happened inside a tick or a frame,
+// dumped as Chrome trace event json (open it in chrome://tracing or
+// ui.perfetto.dev). They are only recorded when built with -DSVB_TRACING=ON,
+// otherwise TRACE_SPAN and TRACE_THREAD_NAME expand to nothing.
+//
+//   void step() {
+//     TRACE_SPAN("Room::step"); // until the end of the scope
+//     ...
+//   }
+//
+// span and thread names have to be string literals, only the pointer is kept.
+#ifdef SVB_TRACING
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+// spans each thread keeps, the oldest get overwritten. a busy tick worker
+// fills this in a few seconds
+constexpr size_t TRACE_BUFFER_CAPACITY = 1 << 16;
+
+inline int64_t traceNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Spans one thread recorded. Only that thread writes, and a dump may read it
+// at any time, so the fields are relaxed atomics and the head is published
+// after the span it counts. A span overwritten while it's being dumped can
+// come out mangled, so the dump leaves the oldest ones out.
+class TraceBuffer {
+public:
+  struct Span {
+    std::atomic<const char *> name{nullptr};
+    std::atomic<int64_t> start_ns{0};
+    std::atomic<int64_t> end_ns{0};
+  };
+
+  explicit TraceBuffer(uint32_t thread_id) : thread_id(thread_id) {}
+
+  void record(const char *name, int64_t start_ns, int64_t end_ns) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    Span &span = spans_[head % TRACE_BUFFER_CAPACITY];
+    span.name.store(name, std::memory_order_relaxed);
+    span.start_ns.store(start_ns, std::memory_order_relaxed);
+    span.end_ns.store(end_ns, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  uint64_t head() const { return head_.load(std::memory_order_acquire); }
+  const Span &span(uint64_t i) const {
+    return spans_[i % TRACE_BUFFER_CAPACITY];
+  }
+
+  const uint32_t thread_id;
+  std::atomic<const char *> thread_name{nullptr};
+
+private:
+  std::atomic<uint64_t> head_{0};
+  std::unique_ptr<Span[]> spans_{new Span[TRACE_BUFFER_CAPACITY]};
+};
+
+// every thread's buffer, kept after the thread exits so its spans still
+// make it into the dump
+struct TraceBuffers {
+  std::mutex lock;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+inline TraceBuffers &traceBuffers() {
+  static TraceBuffers buffers;
+  return buffers;
+}
+
+inline TraceBuffer &threadTraceBuffer() {
+  thread_local TraceBuffer *buffer = [] {
+    TraceBuffers &all = traceBuffers();
+    std::scoped_lock l(all.lock);
+    all.buffers.push_back(std::make_unique<TraceBuffer>(
+        static_cast<uint32_t>(all.buffers.size())));
+    return all.buffers.back().get();
+  }();
+  return *buffer;
+}
+
+class TraceSpan {
+public:
+  explicit TraceSpan(const char *name)
+      : name_(name), start_ns_(traceNowNs()) {}
+  ~TraceSpan() { threadTraceBuffer().record(name_, start_ns_, traceNowNs()); }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+  const char *name_;
+  int64_t start_ns_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name)                                               \
+  threadTraceBuffer().thread_name.store(name, std::memory_order_relaxed)
+#else
+#define TRACE_SPAN(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+// write every thread's spans to path, false after saying why if we can't.
+// without SVB_TRACING there is nothing to write
+bool writeTrace(const std::string &path);
+
+// write them to trace_<unix time in ms>.json in the working directory
+bool writeTrace();
+
+// have SIGUSR1 ask for a dump, for processes without a window to press a key
+// in. nothing happens on platforms without it
+void requestTraceOnSignal();
+// whether a dump was asked for since the last call
+bool traceRequested();
@@ -0,0 +1,156 @@
+#pragma once
+#include <array>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// longest string we will ever decode, keeps nicknames inside the SSO buffer
+constexpr size_t WIRE_MAX_STRING_LENGTH = 15;
+
+// Binary archive that serializes straight into a fixed size buffer. It is
+// call compatible with the serialize() members on our messages, so
+// `archive(a, b, c)` works the same way it did with cereal. Running out of
+// room marks the archive as failed instead of growing the buffer.
+class WireWriter {
+public:
+  WireWriter(void *data, size_t capacity)
+      : data_(static_cast<uint8_t *>(data)), capacity_(capacity) {}
+
+  template <class... Ts> void operator()(const Ts &...values) {
+    (write(values), ...);
+  }
+
+  size_t size() const { return size_; }
+  bool ok() const { return ok_; }
+
+  void writeBytes(const void *bytes, size_t length) {
+    if (!ok_ || capacity_ - size_ < length) {
+      ok_ = false;
+      return;
+    }
+    memcpy(data_ + size_, bytes, length);
+    size_ += length;
+  }
+
+private:
+  template <class T> void write(const T &value) {
+    if constexpr (std::is_arithmetic_v<T>) {
+      writeBytes(&value, sizeof(T));
+    } else {
+      // serialize() is shared with the reader so it can't be const
+      const_cast<T &>(value).serialize(*this);
+    }
+  }
+
+  void write(const std::string &value) {
+    if (value.size() > WIRE_MAX_STRING_LENGTH) {
+      ok_ = false;
+      return;
+    }
+    write(static_cast<uint16_t>(value.size()));
+    writeBytes(value.data(), value.size());
+  }
+
+  template <class T, size_t N> void write(const std::array<T, N> &values) {
+    for (const T &value : values) {
+      write(value);
+    }
+  }
+
+  template <class T> void write(const std::vector<T> &values) {
+    if (values.size() > UINT16_MAX) {
+      ok_ = false;
+      return;
+    }
+    write(static_cast<uint16_t>(values.size()));
+    for (const T &value : values) {
+      write(value);
+    }
+  }
+
+  uint8_t *data_;
+  size_t capacity_;
+  size_t size_ = 0;
+  bool ok_ = true;
+};
+
+// Reads what WireWriter wrote, in place. Lengths are checked against the
+// bytes actually left in the buffer before anything is allocated, so a
+// hostile length prefix can't make us allocate more than the message size.
+// Once a read fails every following read is skipped and ok() is false.
+class WireReader {
+public:
+  WireReader(const void *data, size_t size)
+      : data_(static_cast<const uint8_t *>(data)), size_(size) {}
+
+  template <class... Ts> void operator()(Ts &...values) { (read(values), ...); }
+
+  bool ok() const { return ok_; }
+  size_t remaining() const { return size_ - offset_; }
+  // for serialize() members that find something they can't accept
+  void fail() { ok_ = false; }
+
+  bool readBytes(void *bytes, size_t length) {
+    if (!ok_ || remaining() < length) {
+      ok_ = false;
+      return false;
+    }
+    memcpy(bytes, data_ + offset_, length);
+    offset_ += length;
+    return true;
+  }
+
+private:
+  template <class T> void read(T &value) {
+    if constexpr (std::is_arithmetic_v<T>) {
+      readBytes(&value, sizeof(T));
+    } else {
+      value.serialize(*this);
+    }
+  }
+
+  void read(bool &value) {
+    uint8_t byte = 0;
+    readBytes(&byte, 1);
+    value = byte != 0;
+  }
+
+  void read(std::string &value) {
+    uint16_t length = 0;
+    read(length);
+    if (!ok_ || length > WIRE_MAX_STRING_LENGTH || length > remaining()) {
+      ok_ = false;
+      return;
+    }
+    value.assign(reinterpret_cast<const char *>(data_ + offset_), length);
+    offset_ += length;
+  }
+
+  template <class T, size_t N> void read(std::array<T, N> &values) {
+    for (T &value : values) {
+      read(value);
+    }
+  }
+
+  template <class T> void read(std::vector<T> &values) {
+    uint16_t count = 0;
+    read(count);
+    // every element takes at least a byte on the wire
+    size_t min_element_size = std::is_arithmetic_v<T> ? sizeof(T) : 1;
+    if (!ok_ || count * min_element_size > remaining()) {
+      ok_ = false;
+      return;
+    }
+    values.resize(count);
+    for (T &value : values) {
+      read(value);
+    }
+  }
+
+  const uint8_t *data_;
+  size_t size_;
+  size_t offset_ = 0;
+  bool ok_ = true;
+};
@@ -0,0 +1,259 @@
+#include "wire_format.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+constexpr int BALL_STATE_BITS = 3;
+constexpr int PLAYER_SLOT_BITS = 3;
+// ball_owner runs from -3 (previous owner) to 4
+constexpr int BALL_OWNER_BITS = 3;
+constexpr int BALL_OWNER_BIAS = 3;
+
+static_assert(BALL_STATE_GAME_OVER < (1 << BALL_STATE_BITS), "");
+static_assert(PLAYERS_PER_ROOM < (1 << PLAYER_SLOT_BITS), "");
+static_assert(PLAYERS_PER_ROOM + BALL_OWNER_BIAS < (1 << BALL_OWNER_BITS), "");
+
+static const Quantization *quantizationOf(FieldKind kind) {
+  switch (kind) {
+  case FIELD_POS_X:
+    return &QUANT_POS_X;
+  case FIELD_POS_Y:
+    return &QUANT_POS_Y;
+  case FIELD_POS_Z:
+    return &QUANT_POS_Z;
+  case FIELD_VEL:
+    return &QUANT_VEL;
+  case FIELD_TIME:
+    return &QUANT_TIME;
+  default:
+    return nullptr;
+  }
+}
+
+// with fixed point the client has to end up with exactly the server's
+// numbers, so instead of rounding to the quantization step the raw values
+// are sent, offset from the bottom of the range
+#ifdef SVB_FIXED_POINT
+static int scalarBits(const Quantization &quant) {
+  uint32_t steps = Fixed(quant.max).raw() - Fixed(quant.min).raw();
+  int bits = 0;
+  while (bits < 32 && (uint64_t(1) << bits) <= steps) {
+    bits++;
+  }
+  return bits;
+}
+
+static uint32_t quantizeScalar(const Quantization &quant, Scalar value) {
+  int32_t min = Fixed(quant.min).raw();
+  return std::clamp(value.raw(), min, Fixed(quant.max).raw()) - min;
+}
+
+static Scalar dequantizeScalar(const Quantization &quant, uint32_t q) {
+  return Fixed::fromRaw(Fixed(quant.min).raw() + static_cast<int32_t>(q));
+}
+#else
+static int scalarBits(const Quantization &quant) { return quant.bits(); }
+
+static uint32_t quantizeScalar(const Quantization &quant, Scalar value) {
+  return quant.quantize(value);
+}
+
+static Scalar dequantizeScalar(const Quantization &quant, uint32_t q) {
+  return quant.dequantize(q);
+}
+#endif
+
+template <class T> static T load(const GameState &state, size_t offset) {
+  T value;
+  memcpy(&value, reinterpret_cast<const uint8_t *>(&state) + offset,
+         sizeof(T));
+  return value;
+}
+
+template <class T>
+static void store(GameState &state, size_t offset, T value) {
+  memcpy(reinterpret_cast<uint8_t *>(&state) + offset, &value, sizeof(T));
+}
+
+// the integer that goes on the wire for this field, before bit packing
+static uint32_t wireValue(const GameStateField &field,
+                          const GameState &state) {
+  if (const Quantization *quant = quantizationOf(field.kind)) {
+    return quantizeScalar(*quant, load<Scalar>(state, field.offset));
+  }
+  switch (field.kind) {
+  case FIELD_SCORE:
+    return load<uint16_t>(state, field.offset);
+  case FIELD_TICK:
+  case FIELD_BALL_STATE:
+  case FIELD_SEED:
+    return load<uint32_t>(state, field.offset);
+  case FIELD_PLAYER_SLOT:
+    return load<uint8_t>(state, field.offset);
+  case FIELD_BALL_OWNER:
+    return load<int16_t>(state, field.offset) + BALL_OWNER_BIAS;
+  case FIELD_FLAG:
+    return load<bool>(state, field.offset);
+  default:
+    return 0;
+  }
+}
+
+void packField(BitWriter &bits, const GameStateField &field,
+               const GameState &state) {
+  uint32_t value = wireValue(field, state);
+  if (const Quantization *quant = quantizationOf(field.kind)) {
+    bits.write(value, scalarBits(*quant));
+    return;
+  }
+  switch (field.kind) {
+  case FIELD_SCORE:
+    bits.writeVarint(value);
+    break;
+  case FIELD_BALL_STATE:
+    bits.write(value, BALL_STATE_BITS);
+    break;
+  case FIELD_PLAYER_SLOT:
+    bits.write(value, PLAYER_SLOT_BITS);
+    break;
+  case FIELD_BALL_OWNER:
+    bits.write(value, BALL_OWNER_BITS);
+    break;
+  case FIELD_FLAG:
+    bits.write(value, 1);
+    break;
+  case FIELD_SEED:
+    bits.write(value, 32);
+    break;
+  default:
+    break;
+  }
+}
+
+void unpackField(BitReader &bits, const GameStateField &field,
+                 GameState &state) {
+  if (const Quantization *quant = quantizationOf(field.kind)) {
+    store(state, field.offset,
+          dequantizeScalar(*quant, bits.read(scalarBits(*quant))));
+    return;
+  }
+  uint32_t value = 0;
+  switch (field.kind) {
+  case FIELD_SCORE:
+    bits.readVarint(value);
+    store(state, field.offset, static_cast<uint16_t>(value));
+    break;
+  case FIELD_BALL_STATE:
+    store(state, field.offset, bits.read(BALL_STATE_BITS));
+    break;
+  case FIELD_PLAYER_SLOT:
+    value = bits.read(PLAYER_SLOT_BITS);
+    store(state, field.offset, static_cast<uint8_t>(value));
+    break;
+  case FIELD_BALL_OWNER:
+    value = bits.read(BALL_OWNER_BITS);
+    store(state, field.offset,
+          static_cast<int16_t>(static_cast<int>(value) - BALL_OWNER_BIAS));
+    break;
+  case FIELD_FLAG:
+    store(state, field.offset, bits.read(1) != 0);
+    break;
+  case FIELD_SEED:
+    store(state, field.offset, bits.read(32));
+    break;
+  default:
+    break;
+  }
+}
+
+bool fieldEqualOnWire(const GameStateField &field, const GameState &a,
+                      const GameState &b) {
+  return wireValue(field, a) == wireValue(field, b);
+}
+
+double fieldValue(const GameStateField &field, const GameState &state) {
+  if (quantizationOf(field.kind) != nullptr) {
+    return toFloat(load<Scalar>(state, field.offset));
+  }
+  if (field.kind == FIELD_BALL_OWNER) {
+    return load<int16_t>(state, field.offset);
+  }
+  return wireValue(field, state);
+}
+
+uint64_t hashGameState(const GameState &state) {
+  // FNV-1a over the 32 bit wire values, a word at a time
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const GameStateField &field : GAME_STATE_FIELDS) {
+    hash ^= wireValue(field, state);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+uint32_t packButtons(const InputMessage &input) {
+  return input.up << 0 | input.down << 1 | input.left << 2 | input.right << 3 |
+         input.target_up << 4 | input.target_down << 5 |
+         input.target_left << 6 | input.target_right << 7 | input.jump << 8 |
+         input.hit << 9;
+}
+
+void unpackButtons(uint32_t buttons, InputMessage &input) {
+  input.up = buttons & (1 << 0);
+  input.down = buttons & (1 << 1);
+  input.left = buttons & (1 << 2);
+  input.right = buttons & (1 << 3);
+  input.target_up = buttons & (1 << 4);
+  input.target_down = buttons & (1 << 5);
+  input.target_left = buttons & (1 << 6);
+  input.target_right = buttons & (1 << 7);
+  input.jump = buttons & (1 << 8);
+  input.hit = buttons & (1 << 9);
+}
+
+void InputPacket::serialize(WireWriter &archive) {
+  archive(WIRE_FORMAT_VERSION, count);
+  if (count == 0) {
+    return;
+  }
+  // only the first tick goes on the wire, the reader counts up from it
+  for (size_t i = 1; i < count; i++) {
+    assert(inputs[i].tick == inputs[0].tick + i);
+  }
+  writeVarint(archive, inputs[0].tick);
+  BitWriter bits(archive);
+  uint32_t previous = packButtons(inputs[0]);
+  bits.write(previous, INPUT_BUTTON_BITS);
+  for (size_t i = 1; i < count; i++) {
+    uint32_t buttons = packButtons(inputs[i]);
+    bits.write(buttons != previous, 1);
+    if (buttons != previous) {
+      bits.write(buttons, INPUT_BUTTON_BITS);
+    }
+    previous = buttons;
+  }
+  bits.finish();
+}
+
+void InputPacket::serialize(WireReader &archive) {
+  uint8_t version = 0;
+  archive(version, count);
+  if (version != WIRE_FORMAT_VERSION || count > MAX_INPUTS_PER_PACKET) {
+    archive.fail();
+    return;
+  }
+  if (count == 0) {
+    return;
+  }
+  uint32_t tick = 0;
+  readVarint(archive, tick);
+  BitReader bits(archive);
+  uint32_t buttons = bits.read(INPUT_BUTTON_BITS);
+  for (size_t i = 0; i < count; i++) {
+    if (i > 0 && bits.read(1)) {
+      buttons = bits.read(INPUT_BUTTON_BITS);
+    }
+    inputs[i].tick = tick + i;
+    unpackButtons(buttons, inputs[i]);
+  }
+}
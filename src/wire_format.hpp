@@ -0,0 +1,273 @@
+#pragma once
+#include "game_state.hpp"
+#include "network_signals.hpp"
+#include "wire_archive.hpp"
+#include <stdint.h>
+
+// bump whenever the layout of a packed snapshot or input changes, peers on a
+// different version drop each other's game traffic instead of misreading it.
+// fixed point builds pack snapshots differently and set the top bit
+constexpr uint8_t WIRE_FORMAT_VERSION = 4 | (SCALAR_IS_FIXED ? 0x80 : 0);
+
+// LEB128 style varints, small ticks and tick offsets take a byte or two
+inline void writeVarint(WireWriter &archive, uint32_t value) {
+  while (value >= 0x80) {
+    uint8_t byte = static_cast<uint8_t>(value) | 0x80;
+    archive(byte);
+    value >>= 7;
+  }
+  uint8_t byte = static_cast<uint8_t>(value);
+  archive(byte);
+}
+
+inline bool readVarint(WireReader &archive, uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    uint8_t byte = 0;
+    if (!archive.readBytes(&byte, 1)) {
+      return false;
+    }
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  archive.fail();
+  return false;
+}
+
+// Packs values of any bit width back to back, and flushes whole bytes into
+// the archive as it goes. finish() pads the last byte with zeros.
+class BitWriter {
+public:
+  explicit BitWriter(WireWriter &archive) : archive_(archive) {}
+
+  void write(uint32_t value, int bits) {
+    pending_ |= static_cast<uint64_t>(value & mask(bits)) << num_pending_;
+    num_pending_ += bits;
+    while (num_pending_ >= 8) {
+      uint8_t byte = static_cast<uint8_t>(pending_);
+      archive_(byte);
+      pending_ >>= 8;
+      num_pending_ -= 8;
+    }
+  }
+
+  // 4 bit groups with a continuation bit, for counters that are usually small
+  void writeVarint(uint32_t value) {
+    while (value >= 0x8) {
+      write((value & 0x7) | 0x8, 4);
+      value >>= 3;
+    }
+    write(value, 4);
+  }
+
+  void finish() {
+    if (num_pending_ > 0) {
+      write(0, 8 - num_pending_);
+    }
+  }
+
+  static uint32_t mask(int bits) {
+    return bits >= 32 ? UINT32_MAX : (uint32_t(1) << bits) - 1;
+  }
+
+private:
+  WireWriter &archive_;
+  uint64_t pending_ = 0;
+  int num_pending_ = 0;
+};
+
+class BitReader {
+public:
+  explicit BitReader(WireReader &archive) : archive_(archive) {}
+
+  uint32_t read(int bits) {
+    while (num_pending_ < bits) {
+      uint8_t byte = 0;
+      if (!archive_.readBytes(&byte, 1)) {
+        return 0;
+      }
+      pending_ |= static_cast<uint64_t>(byte) << num_pending_;
+      num_pending_ += 8;
+    }
+    uint32_t value = static_cast<uint32_t>(pending_) & BitWriter::mask(bits);
+    pending_ >>= bits;
+    num_pending_ -= bits;
+    return value;
+  }
+
+  bool readVarint(uint32_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 33; shift += 3) {
+      uint32_t group = read(4);
+      value |= (group & 0x7) << shift;
+      if ((group & 0x8) == 0) {
+        return archive_.ok();
+      }
+    }
+    archive_.fail();
+    return false;
+  }
+
+  bool ok() const { return archive_.ok(); }
+
+private:
+  WireReader &archive_;
+  uint64_t pending_ = 0;
+  int num_pending_ = 0;
+};
+
+// Fixed point encoding of a bounded float, q = round((value - min) / step).
+// Steps are powers of two so that 0, every arena constant and every multiple
+// of the tick length land exactly on a step, which keeps the exact compares
+// in the simulation (pos.z == 0.0, jump_cooldown == 0.0) behaving the same on
+// both ends. Values outside the range are clamped.
+struct Quantization {
+  float min;
+  float max;
+  float step;
+
+  constexpr uint32_t steps() const {
+    return static_cast<uint32_t>((max - min) / step);
+  }
+
+  constexpr int bits() const {
+    int bits = 0;
+    while ((uint64_t(1) << bits) <= steps()) {
+      bits++;
+    }
+    return bits;
+  }
+
+  constexpr uint32_t quantize(float value) const {
+    if (!(value > min)) {
+      return 0;
+    }
+    if (value >= max) {
+      return steps();
+    }
+    return static_cast<uint32_t>((value - min) / step + 0.5f);
+  }
+
+  constexpr float dequantize(uint32_t q) const { return min + q * step; }
+
+  // worst case round trip error for anything inside the range
+  constexpr float maxError() const { return step / 2; }
+
+  constexpr float roundTrip(float value) const {
+    return dequantize(quantize(value));
+  }
+};
+
+// positions may leave the arena while the ball is flying, so give them slack
+constexpr Quantization QUANT_POS_X = {-arena_width, 2 * arena_width,
+                                      1.0f / 32};
+constexpr Quantization QUANT_POS_Y = {-arena_height, 2 * arena_height,
+                                      1.0f / 32};
+constexpr Quantization QUANT_POS_Z = {0.0f, 16 * ball_max_passing_height,
+                                      1.0f / 32};
+constexpr Quantization QUANT_VEL = {-4 * ball_spiking_speed,
+                                    4 * ball_spiking_speed, 1.0f / 32};
+constexpr Quantization QUANT_TIME = {0.0f, 2 * service_max_time, 1.0f / 1024};
+
+// the round trip error is a small fraction of the EPSILON fcmp() uses, so a
+// prediction that matched the server still matches after the snapshot has
+// been through the wire and rollback decisions don't change
+static_assert(QUANT_POS_X.maxError() < EPSILON / 16, "x step too coarse");
+static_assert(QUANT_POS_Y.maxError() < EPSILON / 16, "y step too coarse");
+static_assert(QUANT_POS_Z.maxError() < EPSILON / 16, "z step too coarse");
+static_assert(QUANT_VEL.maxError() < EPSILON / 16, "vel step too coarse");
+static_assert(QUANT_TIME.maxError() < EPSILON / 16, "time step too coarse");
+
+// the values the simulation resets to and compares against exactly
+static_assert(QUANT_POS_X.roundTrip(0.0f) == 0.0f, "");
+static_assert(QUANT_POS_X.roundTrip(arena_width) == arena_width, "");
+static_assert(QUANT_POS_X.roundTrip(arena_width / 2) == arena_width / 2, "");
+static_assert(QUANT_POS_X.roundTrip(starting_dist_from_screen) ==
+                  starting_dist_from_screen,
+              "");
+static_assert(QUANT_POS_X.roundTrip(arena_width - paddle_width) ==
+                  arena_width - paddle_width,
+              "");
+static_assert(QUANT_POS_Y.roundTrip(0.0f) == 0.0f, "");
+static_assert(QUANT_POS_Y.roundTrip(arena_height - paddle_height) ==
+                  arena_height - paddle_height,
+              "");
+static_assert(QUANT_POS_Z.roundTrip(0.0f) == 0.0f, "");
+static_assert(QUANT_POS_Z.roundTrip(jump_height) == jump_height, "");
+static_assert(QUANT_VEL.roundTrip(0.0f) == 0.0f, "");
+static_assert(QUANT_VEL.roundTrip(paddle_speed) == paddle_speed, "");
+static_assert(QUANT_VEL.roundTrip(-paddle_speed) == -paddle_speed, "");
+static_assert(QUANT_VEL.roundTrip(jump_speed) == jump_speed, "");
+static_assert(QUANT_VEL.roundTrip(-2 * ball_up_speed) == -2 * ball_up_speed,
+              "");
+static_assert(QUANT_TIME.roundTrip(0.0f) == 0.0f, "");
+static_assert(QUANT_TIME.roundTrip(jump_cooldown) == jump_cooldown, "");
+static_assert(QUANT_TIME.roundTrip(jump_cooldown - 3 * DESIRED_TICK_LENGTH) ==
+                  static_cast<float>(jump_cooldown - 3 * DESIRED_TICK_LENGTH),
+              "");
+
+// and values off the grid stay within the bound
+static_assert(QUANT_POS_X.roundTrip(123.4567f) - 123.4567f <=
+                      QUANT_POS_X.maxError() &&
+                  123.4567f - QUANT_POS_X.roundTrip(123.4567f) <=
+                      QUANT_POS_X.maxError(),
+              "");
+static_assert(QUANT_VEL.roundTrip(-411.111f) - -411.111f <=
+                      QUANT_VEL.maxError() &&
+                  -411.111f - QUANT_VEL.roundTrip(-411.111f) <=
+                      QUANT_VEL.maxError(),
+              "");
+
+// pack one field of a GameState according to its kind. the tick is not
+// packed here, it leads the snapshot as a varint
+void packField(BitWriter &bits, const GameStateField &field,
+               const GameState &state);
+void unpackField(BitReader &bits, const GameStateField &field,
+                 GameState &state);
+
+// do two states look the same once they are on the wire?
+bool fieldEqualOnWire(const GameStateField &field, const GameState &a,
+                      const GameState &b);
+
+// the field as a plain number, for logs and tools
+double fieldValue(const GameStateField &field, const GameState &state);
+
+// a hash of the state as it looks on the wire, tick included. client and
+// server compare these to check they are still in sync without sending the
+// whole state. it is exactly as forgiving as a snapshot: noise below the
+// quantization step doesn't change it, but a float that lands on the other
+// side of a step does
+uint64_t hashGameState(const GameState &state);
+
+// an input's buttons, a bit each
+constexpr int INPUT_BUTTON_BITS = 10;
+uint32_t packButtons(const InputMessage &input);
+void unpackButtons(uint32_t buttons, InputMessage &input);
+
+// how many of its newest unacknowledged inputs a client repeats in every
+// packet, so a lost packet is covered by the next ones (0.25s at 64hz)
+constexpr size_t MAX_INPUTS_PER_PACKET = 16;
+
+// MSG_CLIENT_INPUT body, a run of inputs for consecutive ticks. only the
+// first tick is sent, and every input after the first is a single bit when
+// the buttons didn't change from the one before it
+struct InputPacket {
+  uint8_t count = 0;
+  std::array<InputMessage, MAX_INPUTS_PER_PACKET> inputs;
+
+  void serialize(WireWriter &archive);
+  void serialize(WireReader &archive);
+};
+
+// MSG_REMOTE_INPUTS body, the inputs from another player's packet that the
+// server took, so everyone can predict every paddle
+struct RemoteInputs {
+  uint8_t player = 0;
+  InputPacket packet;
+
+  template <class Archive> void serialize(Archive &archive) {
+    archive(player, packet);
+  }
+};